@@ -14,6 +14,7 @@
 #include "yahoo/cnet/android/pool_adapter.h"
 #include "yahoo/cnet/android/response_adapter.h"
 #include "yahoo/cnet/android/response_completion_adapter.h"
+#include "yahoo/cnet/android/response_data_callback_adapter.h"
 
 namespace cnet {
 namespace android { 
@@ -24,6 +25,7 @@ static base::android::RegistrationMethod kCnetRegisterMethods[] = {
   { "Pool", PoolAdapterRegisterJni },
   { "Response", ResponseAdapterRegisterJni },
   { "ResponseCompletion", ResponseCompletionRegisterJni },
+  { "ResponseDataCallback", ResponseDataCallbackRegisterJni },
 };
 
 bool RegisterJni(JNIEnv* env) {
@@ -6,10 +6,13 @@
 #include "base/android/jni_android.h"
 #include "base/android/jni_array.h"
 #include "base/android/jni_string.h"
+#include "base/bind.h"
+#include "net/base/io_buffer.h"
 #include "net/http/http_response_headers.h"
 #include "yahoo/cnet/android/pool_adapter.h"
 #include "yahoo/cnet/android/response_adapter.h"
 #include "yahoo/cnet/android/response_completion_adapter.h"
+#include "yahoo/cnet/android/response_data_callback_adapter.h"
 #include "yahoo/cnet/android/cnet_jni.h"
 #include "yahoo/cnet/cnet_fetcher.h"
 #include "yahoo/cnet/cnet_pool.h"
@@ -31,6 +34,29 @@ void InvokeFetcherRelease(JNIEnv* j_env, jobject j_fetcher) {
   Java_CnetFetcher_release(j_env, j_fetcher);
 }
 
+// Retains the Java objects used by a data callback, for as long as the
+// fetcher may still invoke it.
+class FetcherAdapter::DataCallbackRefs
+    : public base::RefCountedThreadSafe<DataCallbackRefs> {
+ public:
+  DataCallbackRefs(JNIEnv* j_env, jobject j_callback, jobject j_fetcher) {
+    callback_.Reset(j_env, j_callback);
+    fetcher_.Reset(j_env, j_fetcher);
+  }
+
+  jobject callback() const { return callback_.obj(); }
+  jobject fetcher() const { return fetcher_.obj(); }
+
+ private:
+  ~DataCallbackRefs() {}
+  friend class base::RefCountedThreadSafe<DataCallbackRefs>;
+
+  base::android::ScopedJavaGlobalRef<jobject> callback_;
+  base::android::ScopedJavaGlobalRef<jobject> fetcher_;
+
+  DISALLOW_COPY_AND_ASSIGN(DataCallbackRefs);
+};
+
 /* static */
 jlong FetcherAdapter::CreateFetcherAdapter(PoolAdapter* pool_adapter,
     JNIEnv* j_env, jobject j_caller, jstring j_url, jstring j_method,
@@ -93,12 +119,25 @@ void FetcherAdapter::Cancel(JNIEnv* j_env, jobject j_caller) {
   fetcher_->Cancel();
 }
 
+void FetcherAdapter::Pause(JNIEnv* j_env, jobject j_caller) {
+  fetcher_->Pause();
+}
+
+void FetcherAdapter::Resume(JNIEnv* j_env, jobject j_caller) {
+  fetcher_->Resume();
+}
+
 void FetcherAdapter::SetCacheBehavior(JNIEnv* j_env, jobject j_caller,
     jint j_behavior) {
   fetcher_->SetCacheBehavior(
       static_cast<cnet::Fetcher::CacheBehavior>(j_behavior));
 }
 
+void FetcherAdapter::SetPriority(JNIEnv* j_env, jobject j_caller,
+    jint j_priority) {
+  fetcher_->SetPriority(static_cast<cnet::Fetcher::Priority>(j_priority));
+}
+
 void FetcherAdapter::SetHeader(JNIEnv* j_env, jobject j_caller, jstring j_key,
     jstring j_value) {
   std::string key;
@@ -219,6 +258,43 @@ void FetcherAdapter::SetUploadByteBody(JNIEnv* j_env, jobject j_caller,
   fetcher_->SetUploadBody(content_type, body);
 }
 
+namespace {
+
+void ReleaseDirectBody(base::android::ScopedJavaGlobalRef<jobject>* j_body) {
+  // Let the garbage collector reclaim the buffer.
+  j_body->Reset();
+}
+
+} // namespace
+
+void FetcherAdapter::SetUploadDirectBody(JNIEnv* j_env, jobject j_caller,
+    jstring j_content_type, jobject j_body, jint j_offset, jint j_length) {
+  std::string content_type;
+
+  if (j_content_type != NULL) {
+    content_type = base::android::ConvertJavaStringToUTF8(j_env,
+        j_content_type);
+  }
+
+  char* data = NULL;
+  if (j_body != NULL) {
+    data = static_cast<char*>(j_env->GetDirectBufferAddress(j_body));
+  }
+  if ((data == NULL) || (j_offset < 0) || (j_length < 0) ||
+      (j_offset + static_cast<int64>(j_length) >
+       j_env->GetDirectBufferCapacity(j_body))) {
+    fetcher_->SetUploadBody(content_type, std::string());
+    return;
+  }
+
+  // Hold the buffer until the fetcher is done reading it.
+  base::android::ScopedJavaGlobalRef<jobject>* body_ref =
+      new base::android::ScopedJavaGlobalRef<jobject>();
+  body_ref->Reset(j_env, j_body);
+  fetcher_->SetUploadBuffer(content_type, data + j_offset, j_length,
+      base::Bind(&ReleaseDirectBody, base::Owned(body_ref)));
+}
+
 void FetcherAdapter::SetUploadFilePath(JNIEnv* j_env, jobject j_caller,
     jstring j_content_type, jstring j_path,
     jlong j_range_offset, jlong j_range_length) {
@@ -238,6 +314,61 @@ void FetcherAdapter::SetUploadFilePath(JNIEnv* j_env, jobject j_caller,
       j_range_length);
 }
 
+void FetcherAdapter::SetUploadEncoding(JNIEnv* j_env, jobject j_caller,
+    jint j_encoding) {
+  fetcher_->SetUploadEncoding(
+      static_cast<cnet::Fetcher::UploadEncoding>(j_encoding));
+}
+
+void FetcherAdapter::SetSpillThreshold(JNIEnv* j_env, jobject j_caller,
+    jlong j_threshold_bytes) {
+  fetcher_->SetSpillThreshold(j_threshold_bytes);
+}
+
+void FetcherAdapter::SetDataCallback(JNIEnv* j_env, jobject j_caller,
+    jobject j_callback, jint j_max_unacked_chunks) {
+  cnet::Fetcher::DataCallback data_callback;
+  if (j_callback != NULL) {
+    scoped_refptr<DataCallbackRefs> refs(
+        new DataCallbackRefs(j_env, j_callback, j_caller));
+    data_callback = base::Bind(&FetcherAdapter::InvokeData, refs);
+  }
+  fetcher_->SetDataCallback(data_callback, j_max_unacked_chunks);
+}
+
+void FetcherAdapter::AckData(JNIEnv* j_env, jobject j_caller) {
+  fetcher_->AckData();
+}
+
+void FetcherAdapter::SetCallbackOrderTag(JNIEnv* j_env, jobject j_caller,
+    jint j_tag) {
+  fetcher_->SetCallbackOrderTag(j_tag);
+}
+
+void FetcherAdapter::SetInlineCallbacks(JNIEnv* j_env, jobject j_caller,
+    jboolean j_inline_callbacks) {
+  fetcher_->SetInlineCallbacks(j_inline_callbacks);
+}
+
+/* static */
+void FetcherAdapter::InvokeData(
+    scoped_refptr<DataCallbackRefs> refs,
+    scoped_refptr<cnet::Fetcher> fetcher,
+    scoped_refptr<net::IOBuffer> buffer, int length) {
+  // We are on a background thread.  The completion, which always runs
+  // after the last chunk, detaches the thread from the VM.
+  JNIEnv* j_env = base::android::AttachCurrentThread();
+  CHECK(j_env != NULL);
+  {
+    base::android::ScopedJavaLocalRef<jbyteArray> j_data =
+        base::android::ToJavaByteArray(j_env,
+            reinterpret_cast<const uint8*>(buffer->data()), length);
+    InvokeFetcherResponseData(j_env, refs->callback(), refs->fetcher(),
+        j_data.obj());
+    base::android::ClearException(j_env);
+  }
+}
+
 /* static */
 void FetcherAdapter::InvokeCompletion(
     jobject j_completion_global,
@@ -10,6 +10,10 @@
 #include "base/macros.h"
 #include "base/memory/ref_counted.h"
 
+namespace net {
+class IOBuffer;
+}
+
 namespace cnet {
 class Fetcher;
 class Response;
@@ -34,8 +38,11 @@ class FetcherAdapter {
 
   void Start(JNIEnv* j_env, jobject j_caller);
   void Cancel(JNIEnv* j_env, jobject j_caller);
+  void Pause(JNIEnv* j_env, jobject j_caller);
+  void Resume(JNIEnv* j_env, jobject j_caller);
 
   void SetCacheBehavior(JNIEnv* j_env, jobject j_caller, jint j_behavior);
+  void SetPriority(JNIEnv* j_env, jobject j_caller, jint j_priority);
 
   void SetHeader(JNIEnv* j_env, jobject j_caller, jstring j_key, jstring j_value);
 
@@ -53,16 +60,37 @@ class FetcherAdapter {
       jstring j_body);
   void SetUploadByteBody(JNIEnv* j_env, jobject j_caller, jstring j_content_type,
       jbyteArray j_body);
+  void SetUploadDirectBody(JNIEnv* j_env, jobject j_caller,
+      jstring j_content_type, jobject j_body, jint j_offset, jint j_length);
   void SetUploadFilePath(JNIEnv* j_env, jobject j_caller,
       jstring j_content_type, jstring j_path, jlong j_range_offset,
       jlong j_range_length);
 
+  void SetUploadEncoding(JNIEnv* j_env, jobject j_caller, jint j_encoding);
+
+  void SetSpillThreshold(JNIEnv* j_env, jobject j_caller,
+      jlong j_threshold_bytes);
+
+  void SetDataCallback(JNIEnv* j_env, jobject j_caller, jobject j_callback,
+      jint j_max_unacked_chunks);
+  void AckData(JNIEnv* j_env, jobject j_caller);
+
+  void SetCallbackOrderTag(JNIEnv* j_env, jobject j_caller, jint j_tag);
+  void SetInlineCallbacks(JNIEnv* j_env, jobject j_caller,
+      jboolean j_inline_callbacks);
+
   static void InvokeCompletion(
       jobject j_completion_global,
       jobject j_fetcher_global,
       scoped_refptr<cnet::Fetcher> fetcher,
       scoped_refptr<cnet::Response> response);
 
+  class DataCallbackRefs;
+  static void InvokeData(
+      scoped_refptr<DataCallbackRefs> refs,
+      scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<net::IOBuffer> buffer, int length);
+
  private:
   scoped_refptr<cnet::Fetcher> fetcher_;
 
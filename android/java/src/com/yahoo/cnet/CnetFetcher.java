@@ -6,6 +6,7 @@ package com.yahoo.cnet;
 import org.chromium.base.CalledByNative;
 import org.chromium.base.JNINamespace;
 
+import java.nio.ByteBuffer;
 import java.util.Map;
 
 @JNINamespace("cnet::android")
@@ -39,6 +40,20 @@ public class CnetFetcher implements Fetcher {
         }
     }
 
+    @Override
+    public synchronized void pause() {
+        if (mNativeFetcherAdapter != 0) {
+            nativePause(mNativeFetcherAdapter);
+        }
+    }
+
+    @Override
+    public synchronized void resume() {
+        if (mNativeFetcherAdapter != 0) {
+            nativeResume(mNativeFetcherAdapter);
+        }
+    }
+
     @Override
     public synchronized void setCacheBehavior(int behavior) {
         if (mNativeFetcherAdapter != 0) {
@@ -46,6 +61,13 @@ public class CnetFetcher implements Fetcher {
         }
     }
 
+    @Override
+    public synchronized void setPriority(int priority) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetPriority(mNativeFetcherAdapter, priority);
+        }
+    }
+
     @Override
     public synchronized void setOauthCredentials(String appKey,
             String appSecret, String token, String tokenSecret) {
@@ -103,6 +125,22 @@ public class CnetFetcher implements Fetcher {
         }
     }
 
+    @Override
+    public synchronized void setUploadBody(String contentType,
+            ByteBuffer body) {
+        if (mNativeFetcherAdapter != 0) {
+            if (body.isDirect()) {
+                nativeSetUploadDirectBody(mNativeFetcherAdapter, contentType,
+                        body, body.position(), body.remaining());
+            } else {
+                byte[] bytes = new byte[body.remaining()];
+                body.duplicate().get(bytes);
+                nativeSetUploadByteBody(mNativeFetcherAdapter, contentType,
+                        bytes);
+            }
+        }
+    }
+
     @Override
     public synchronized void setUploadFilePath(String contentType, String path,
             long rangeOffset, long rangeLength) {
@@ -112,6 +150,50 @@ public class CnetFetcher implements Fetcher {
         }
     }
 
+    @Override
+    public synchronized void setUploadEncoding(int encoding) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetUploadEncoding(mNativeFetcherAdapter, encoding);
+        }
+    }
+
+    @Override
+    public synchronized void setSpillThreshold(long thresholdBytes) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetSpillThreshold(mNativeFetcherAdapter, thresholdBytes);
+        }
+    }
+
+    @Override
+    public synchronized void setDataCallback(ResponseDataCallback callback,
+            int maxUnackedChunks) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetDataCallback(mNativeFetcherAdapter, callback,
+                    maxUnackedChunks);
+        }
+    }
+
+    @Override
+    public synchronized void ackData() {
+        if (mNativeFetcherAdapter != 0) {
+            nativeAckData(mNativeFetcherAdapter);
+        }
+    }
+
+    @Override
+    public synchronized void setCallbackOrderTag(int tag) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetCallbackOrderTag(mNativeFetcherAdapter, tag);
+        }
+    }
+
+    @Override
+    public synchronized void setInlineCallbacks(boolean inlineCallbacks) {
+        if (mNativeFetcherAdapter != 0) {
+            nativeSetInlineCallbacks(mNativeFetcherAdapter, inlineCallbacks);
+        }
+    }
+
     @Override
     public synchronized void setHeader(String key, String value) {
         if (mNativeFetcherAdapter != 0) {
@@ -143,10 +225,15 @@ public class CnetFetcher implements Fetcher {
 
     private native void nativeStart(long nativeFetcherAdapter);
     private native void nativeCancel(long nativeFetcherAdapter);
+    private native void nativePause(long nativeFetcherAdapter);
+    private native void nativeResume(long nativeFetcherAdapter);
 
     private native void nativeSetCacheBehavior(long nativeFetcherAdapter,
             int behavior);
 
+    private native void nativeSetPriority(long nativeFetcherAdapter,
+            int priority);
+
     private native void nativeSetOauthCredentials(long nativeFetcherAdapter,
             String appKey, String appSecret, String token, String tokenSecret);
 
@@ -162,10 +249,26 @@ public class CnetFetcher implements Fetcher {
             String contentType, String body);
     private native void nativeSetUploadByteBody(long nativeFetcherAdapter,
             String contentType, byte[] body);
+    private native void nativeSetUploadDirectBody(long nativeFetcherAdapter,
+            String contentType, ByteBuffer body, int offset, int length);
     private native void nativeSetUploadFilePath(long nativeFetcherAdapter,
             String contentType, String path,
             long rangeOffset, long rangeLength);
 
+    private native void nativeSetUploadEncoding(long nativeFetcherAdapter,
+            int encoding);
+
+    private native void nativeSetSpillThreshold(long nativeFetcherAdapter,
+            long thresholdBytes);
+    private native void nativeSetDataCallback(long nativeFetcherAdapter,
+            ResponseDataCallback callback, int maxUnackedChunks);
+    private native void nativeAckData(long nativeFetcherAdapter);
+
+    private native void nativeSetCallbackOrderTag(long nativeFetcherAdapter,
+            int tag);
+    private native void nativeSetInlineCallbacks(long nativeFetcherAdapter,
+            boolean inlineCallbacks);
+
     private native void nativeSetHeader(long nativeFetcherAdapter, String key,
             String value);
 }
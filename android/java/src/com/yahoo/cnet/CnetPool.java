@@ -21,6 +21,41 @@ public class CnetPool implements Pool {
         public String cachePath;
         public int cacheMaxBytes;
 
+        // Idle read buffers kept for reuse across fetchers; 0 disables.
+        public int readBufferPoolMaxBytes = 1024 * 1024;
+
+        // Bytes of a file download to collect before each write; 0 writes
+        // every read as it arrives.
+        public int fileWriteBatchBytes = 1024 * 1024;
+
+        // Minimum spacing of each fetch's progress callbacks, in time and in
+        // bytes; the final progress is always reported.
+        public int progressIntervalMs;
+        public int progressMinBytes;
+
+        // Bytes of buffered bodies that in-flight fetches may hold; 0 is
+        // unlimited.  Over budget, the largest bodies may move to spillPath.
+        public int bodyMemoryBudget;
+        public boolean spillBodiesOverBudget;
+        public String spillPath;
+
+        // Network threads to run fetches on; fetches for a host always share
+        // one.  Each gets its own cache under cachePath.
+        public int networkThreads = 1;
+
+        // Threads that run callbacks.  Each fetcher's callbacks stay in
+        // order on one of them.
+        public int workThreads = 1;
+
+        // Fetches in flight at once, in all and per host; 0 is unlimited.
+        // The rest wait by priority, taking turns by tag.
+        public int maxRequests;
+        public int maxRequestsPerHost;
+
+        // Identical cacheable GETs in flight share one request, and each
+        // gets its own response.
+        public boolean coalesceRequests;
+
         public int logLevel;
     }
 
@@ -29,7 +64,13 @@ public class CnetPool implements Pool {
                 config.enableSpdy, config.enableQuic,
                 config.enableSslFalseStart, config.cachePath,
                 config.cacheMaxBytes, config.trustAllCertAuthorities,
-                config.disableSystemProxy, config.logLevel);
+                config.disableSystemProxy, config.readBufferPoolMaxBytes,
+                config.fileWriteBatchBytes, config.progressIntervalMs,
+                config.progressMinBytes,
+                config.bodyMemoryBudget, config.spillBodiesOverBudget,
+                config.spillPath, config.networkThreads, config.workThreads,
+                config.maxRequests, config.maxRequestsPerHost,
+                config.coalesceRequests, config.logLevel);
     }
 
     @Override
@@ -118,7 +159,12 @@ public class CnetPool implements Pool {
             boolean enableSpdy, boolean enableQuic, boolean enableSslFalseStart,
             String cachePath, int cacheMaxBytes,
             boolean trustAllCertAuthorities, boolean disableSystemProxy,
-            int logLevel);
+            int readBufferPoolMaxBytes, int fileWriteBatchBytes,
+            int progressIntervalMs, int progressMinBytes,
+            int bodyMemoryBudget,
+            boolean spillBodiesOverBudget, String spillPath,
+            int networkThreads, int workThreads, int maxRequests,
+            int maxRequestsPerHost, boolean coalesceRequests, int logLevel);
 
     private native void nativeReleasePoolAdapter(long nativePoolAdapter);
 
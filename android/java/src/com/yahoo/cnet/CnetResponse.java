@@ -68,6 +68,15 @@ public class CnetResponse implements Response {
         }
     }
 
+    @Override
+    public synchronized String getBodyFilePath() {
+        if (mNativeResponseAdapter != 0) {
+            return nativeGetBodyFilePath(mNativeResponseAdapter);
+        } else {
+            return null;
+        }
+    }
+
     @Override
     public synchronized int getHttpResponseCode() {
         if (mNativeResponseAdapter != 0) {
@@ -205,6 +214,7 @@ public class CnetResponse implements Response {
             Bitmap recycledBitmap, int maxWidth, int maxHeight, int scaleType);
     private native String nativeGetOriginalUrl(long nativeResponseAdapter);
     private native String nativeGetFinalUrl(long nativeResponseAdapter);
+    private native String nativeGetBodyFilePath(long nativeResponseAdapter);
     private native int nativeGetHttpResponseCode(long nativeResponseAdapter);
     private native int nativeGetNetError(long nativeResponseAdapter);
     private native void nativeReleaseResponseAdapter(
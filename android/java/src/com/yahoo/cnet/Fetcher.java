@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 package com.yahoo.cnet;
 
+import java.nio.ByteBuffer;
 import java.util.Map;
 
 public interface Fetcher {
@@ -53,6 +54,29 @@ public interface Fetcher {
      */
     public static final int PARAMS_ENCODE_BODY_URL = 2;
 
+    /**
+     * Request priorities, for sockets and for bandwidth on shared
+     * connections.
+     */
+    public static final int PRIORITY_IDLE = 0;
+    public static final int PRIORITY_LOWEST = 1;
+    public static final int PRIORITY_LOW = 2;
+    public static final int PRIORITY_MEDIUM = 3;
+    public static final int PRIORITY_HIGHEST = 4;
+
+    /**
+     * Send the request body as is.
+     */
+    public static final int UPLOAD_ENCODING_IDENTITY = 0;
+    /**
+     * Compress the request body with gzip.
+     */
+    public static final int UPLOAD_ENCODING_GZIP = 1;
+    /**
+     * Compress the request body with deflate (the zlib format).
+     */
+    public static final int UPLOAD_ENCODING_DEFLATE = 2;
+
     /**
      * Start the fetch.
      * You may no longer adjust the fetcher properties once it is started.
@@ -67,6 +91,14 @@ public interface Fetcher {
      */
     public void cancel();
 
+    /**
+     * Pause or resume the fetch.
+     * A paused fetch stops reading the response body, so that flow control
+     * throttles the server, and resuming continues where it left off.
+     */
+    public void pause();
+    public void resume();
+
     /**
      * Release the native resources used by this object.
      * This ensures immediate recovery of native memory, instead of waiting
@@ -83,6 +115,12 @@ public interface Fetcher {
      */
     public void setCacheBehavior(int behavior);
 
+    /**
+     * Set the priority of the fetch, which may also change after it starts.
+     * Use one of the PRIORITY_ constants.
+     */
+    public void setPriority(int priority);
+
     /**
      * Set the OAuth v1 credentials.
      * When these credentials are set, the request will be signed
@@ -125,12 +163,69 @@ public interface Fetcher {
      */
     public void setUploadBody(String contentType, byte[] body);
 
+    /**
+     * Set the request body to upload, from the buffer's position to its
+     * limit.  A direct buffer is sent without copying it, and it must not
+     * be modified until the fetcher completes.
+     */
+    public void setUploadBody(String contentType, ByteBuffer body);
+
     /**
      * Request a file upload as the request body.
      */
     public void setUploadFilePath(String contentType, String path,
             long rangeOffset, long rangeLength);
 
+    /**
+     * Compress the request body in the background as it is sent, and set
+     * its Content-Encoding.  The compressed body is sent with chunked
+     * transfer encoding.
+     * Use one of the UPLOAD_ENCODING_ constants.
+     */
+    public void setUploadEncoding(int encoding);
+
+    /**
+     * Buffer the response body in memory until it grows beyond a threshold
+     * (or its content length does), and then move it to a temporary file.
+     * Use {@link Response#getBodyFilePath()} to tell where the body ended up.
+     * @param thresholdBytes If 0, the body stays in memory.
+     */
+    public void setSpillThreshold(long thresholdBytes);
+
+    /**
+     * Stream the response body to a callback as it arrives.
+     * The body is neither buffered in memory nor saved to a file, so the
+     * response's body will be empty.
+     * @param callback Receives each chunk of the body on a background thread.
+     * @param maxUnackedChunks If positive, the fetcher stops reading from the
+     *        network once this many chunks are delivered without a call to
+     *        {@link #ackData()}.  If 0, chunks are delivered as they arrive.
+     */
+    public void setDataCallback(ResponseDataCallback callback,
+            int maxUnackedChunks);
+
+    /**
+     * Acknowledge that a chunk from the data callback has been consumed.
+     */
+    public void ackData();
+
+    /**
+     * Run the callbacks in order with those of every other fetcher given the
+     * same tag.  By default, only this fetcher's own callbacks are ordered,
+     * and fetchers' callbacks may run concurrently if the pool has several
+     * work threads.
+     */
+    public void setCallbackOrderTag(int tag);
+
+    /**
+     * Run the completion, progress and data callbacks directly on the
+     * network thread, rather than on a work thread.  They keep their order,
+     * so the completion still runs after the last chunk.  This saves a
+     * thread switch per callback, but the callbacks then delay every other
+     * fetch: they must return quickly, and must never block or do I/O.
+     */
+    public void setInlineCallbacks(boolean inlineCallbacks);
+
     /**
      * Set a request header.
      * This replaces an existing header.
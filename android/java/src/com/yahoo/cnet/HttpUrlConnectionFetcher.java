@@ -12,6 +12,7 @@ import java.net.HttpURLConnection;
 import java.net.MalformedURLException;
 import java.net.URL;
 import java.net.URLConnection;
+import java.nio.ByteBuffer;
 import java.util.List;
 import java.util.Map;
 import java.util.concurrent.BlockingQueue;
@@ -154,6 +155,16 @@ public class HttpUrlConnectionFetcher implements Fetcher {
         }
     }
 
+    @Override
+    public void pause() {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void resume() {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
     @Override
     public void release() {  }
 
@@ -162,6 +173,11 @@ public class HttpUrlConnectionFetcher implements Fetcher {
         throw new UnsupportedOperationException("unimplemented");
     }
 
+    @Override
+    public void setPriority(int priority) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
     @Override
     public void setOauthCredentials(String appKey, String appSecret,
                                     String token, String tokenSecret) {
@@ -200,12 +216,48 @@ public class HttpUrlConnectionFetcher implements Fetcher {
         throw new UnsupportedOperationException("unimplemented");
     }
 
+    @Override
+    public void setUploadBody(String contentType, ByteBuffer body) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
     @Override
     public void setUploadFilePath(String contentType, String path,
                                   long rangeOffset, long rangeLength) {
         throw new UnsupportedOperationException("unimplemented");
     }
 
+    @Override
+    public void setUploadEncoding(int encoding) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void setSpillThreshold(long thresholdBytes) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void setDataCallback(ResponseDataCallback callback,
+                                int maxUnackedChunks) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void ackData() {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void setCallbackOrderTag(int tag) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
+    @Override
+    public void setInlineCallbacks(boolean inlineCallbacks) {
+        throw new UnsupportedOperationException("unimplemented");
+    }
+
     @Override
     public void setHeader(String key, String value) {
         throw new UnsupportedOperationException("unimplemented");
@@ -53,6 +53,9 @@ public class HttpUrlConnectionResponse implements Response {
     @Override
     public String getFinalUrl() { return mFinalUrl; }
 
+    @Override
+    public String getBodyFilePath() { return null; }
+
     @Override
     public int getHttpResponseCode() { return mHttpResponseCode; }
 
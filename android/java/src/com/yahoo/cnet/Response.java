@@ -20,6 +20,14 @@ public interface Response {
      */
     public int getBodyLength();
 
+    /**
+     * Get the path of the file that holds the response body, if the body
+     * was written to a file instead of memory.  A body that was moved to a
+     * temporary file is deleted when the response is released.
+     * @return the path if the body is in a file; otherwise null.
+     */
+    public String getBodyFilePath();
+
     /**
      * Scale and leave a letterbox (black bars) around the image.
      */
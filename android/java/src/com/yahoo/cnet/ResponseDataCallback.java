@@ -0,0 +1,20 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+package com.yahoo.cnet;
+
+import org.chromium.base.CalledByNative;
+import org.chromium.base.JNINamespace;
+
+@JNINamespace("cnet::android")
+public interface ResponseDataCallback {
+    /**
+     * Invoked for each chunk of the response body, in order, as it arrives.
+     * This is called on a work thread shared by all fetchers in a Cnet pool.
+     * The response completion runs after the last chunk.
+     * @param fetcher The fetcher that is receiving the body.
+     * @param data The next chunk of the response body.
+     */
+    @CalledByNative
+    void onBackgroundData(Fetcher fetcher, byte[] data);
+}
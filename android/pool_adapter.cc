@@ -27,7 +27,13 @@ static jlong CreatePoolAdapter(JNIEnv* j_env, jobject j_caller,
     jboolean j_enable_ssl_false_start,
     jstring j_cache_path, jint j_cache_max_bytes,
     jboolean j_trust_all_cert_authorities, jboolean j_disable_system_proxy,
-    jint j_log_level) {
+    jint j_read_buffer_pool_max_bytes, jint j_file_write_batch_bytes,
+    jint j_progress_interval_ms, jint j_progress_min_bytes,
+    jint j_body_memory_budget,
+    jboolean j_spill_bodies_over_budget, jstring j_spill_path,
+    jint j_network_threads, jint j_work_threads,
+    jint j_max_requests, jint j_max_requests_per_host,
+    jboolean j_coalesce_requests, jint j_log_level) {
   scoped_refptr<base::SingleThreadTaskRunner> ui_runner;
   if (CnetMessageLoopForUiGet() != NULL) {
     ui_runner = reinterpret_cast<base::MessageLoopForUI*>(
@@ -38,6 +44,8 @@ static jlong CreatePoolAdapter(JNIEnv* j_env, jobject j_caller,
       base::android::ConvertJavaStringToUTF8(j_env, j_user_agent);
   std::string cache_path = (j_cache_path == NULL) ? "" :
       base::android::ConvertJavaStringToUTF8(j_env, j_cache_path);
+  std::string spill_path = (j_spill_path == NULL) ? "" :
+      base::android::ConvertJavaStringToUTF8(j_env, j_spill_path);
 
   cnet::Pool::Config pool_config;
   pool_config.user_agent = user_agent;
@@ -48,6 +56,18 @@ static jlong CreatePoolAdapter(JNIEnv* j_env, jobject j_caller,
   pool_config.cache_path = base::FilePath(cache_path);
   pool_config.cache_max_bytes = j_cache_max_bytes;
   pool_config.trust_all_cert_authorities = j_trust_all_cert_authorities;
+  pool_config.read_buffer_pool_max_bytes = j_read_buffer_pool_max_bytes;
+  pool_config.file_write_batch_bytes = j_file_write_batch_bytes;
+  pool_config.progress_interval_ms = j_progress_interval_ms;
+  pool_config.progress_min_bytes = j_progress_min_bytes;
+  pool_config.body_memory_budget = j_body_memory_budget;
+  pool_config.spill_bodies_over_budget = j_spill_bodies_over_budget;
+  pool_config.spill_path = base::FilePath(spill_path);
+  pool_config.network_threads = j_network_threads;
+  pool_config.work_threads = j_work_threads;
+  pool_config.max_requests = j_max_requests;
+  pool_config.max_requests_per_host = j_max_requests_per_host;
+  pool_config.coalesce_requests = j_coalesce_requests;
   pool_config.log_level = j_log_level;
   scoped_refptr<cnet::Pool> pool(new cnet::Pool(ui_runner, pool_config));
   pool->Start();
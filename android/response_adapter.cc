@@ -115,6 +115,16 @@ base::android::ScopedJavaLocalRef<jstring> ResponseAdapter::GetFinalUrl(
   }
 }
 
+base::android::ScopedJavaLocalRef<jstring> ResponseAdapter::GetBodyFilePath(
+    JNIEnv* j_env, jobject j_caller) {
+  const base::FilePath& path(response_->response_file_path());
+  if (!path.empty()) {
+    return base::android::ConvertUTF8ToJavaString(j_env, path.value());
+  } else {
+    return base::android::ScopedJavaLocalRef<jstring>();
+  }
+}
+
 jint ResponseAdapter::GetHttpResponseCode(JNIEnv* j_env, jobject j_caller) {
   return response_->http_response_code();
 }
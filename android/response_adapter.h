@@ -42,6 +42,8 @@ class ResponseAdapter {
       jobject j_caller);
   base::android::ScopedJavaLocalRef<jstring> GetFinalUrl(JNIEnv* j_env,
       jobject j_caller);
+  base::android::ScopedJavaLocalRef<jstring> GetBodyFilePath(JNIEnv* j_env,
+      jobject j_caller);
   jint GetHttpResponseCode(JNIEnv* j_env, jobject j_caller);
   jint GetNetError(JNIEnv* j_env, jobject j_caller);
   base::android::ScopedJavaLocalRef<jobjectArray> GetResponseHeader(
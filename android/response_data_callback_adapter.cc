@@ -0,0 +1,24 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/android/response_data_callback_adapter.h"
+
+// Generated headers
+#include "jni/ResponseDataCallback_jni.h"
+
+namespace cnet {
+namespace android {
+
+bool ResponseDataCallbackRegisterJni(JNIEnv* j_env) {
+  // Register the generated JNI methods.
+  return RegisterNativesImpl(j_env);
+}
+
+void InvokeFetcherResponseData(JNIEnv* j_env, jobject j_callback,
+    jobject j_fetcher, jbyteArray j_data) {
+  Java_ResponseDataCallback_onBackgroundData(j_env, j_callback, j_fetcher,
+      j_data);
+}
+
+} // namespace android
+} // namespace cnet
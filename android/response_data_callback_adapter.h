@@ -0,0 +1,20 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_ANDROID_COM_YAHOO_CNET_RESPONSEDATACALLBACK_H_
+#define YAHOO_CNET_ANDROID_COM_YAHOO_CNET_RESPONSEDATACALLBACK_H_
+
+#include <jni.h>
+
+namespace cnet {
+namespace android {
+
+bool ResponseDataCallbackRegisterJni(JNIEnv* j_env);
+
+void InvokeFetcherResponseData(JNIEnv* j_env, jobject j_callback,
+    jobject j_fetcher, jbyteArray j_data);
+
+} // namespace android
+} // namespace cnet
+
+#endif //  YAHOO_CNET_ANDROID_COM_YAHOO_CNET_RESPONSEDATACALLBACK_H_
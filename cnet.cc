@@ -3,18 +3,27 @@
 // found in the LICENSE file.
 #include "yahoo/cnet/cnet.h"
 
+#include <stdlib.h>
+
+#include <algorithm>
 #include <string>
 
 #include "base/at_exit.h"
+#include "base/barrier_closure.h"
 #include "base/command_line.h"
 #include "base/metrics/statistics_recorder.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/synchronization/waitable_event.h"
+#include "net/base/io_buffer.h"
+#include "net/base/net_errors.h"
 #include "net/http/http_response_headers.h"
+#include "yahoo/cnet/cnet_engine.h"
 #include "yahoo/cnet/cnet_pool.h"
 #include "yahoo/cnet/cnet_fetcher.h"
 #include "yahoo/cnet/cnet_oauth.h"
+#include "yahoo/cnet/cnet_parallel_upload.h"
 #include "yahoo/cnet/cnet_response.h"
+#include "yahoo/cnet/cnet_segmented_download.h"
 #include "url/url_util.h"
 
 #if !defined(USE_ICU_ALTERNATIVES_ON_ANDROID)
@@ -79,9 +88,13 @@ PoolSyncDrainer::~PoolSyncDrainer() {
 }
 
 void PoolSyncDrainer::OnPoolIdle(scoped_refptr<Pool> pool) {
-  // On network thread.
-  pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+  // On network thread.  Wait for the callbacks on every work thread.
+  base::Closure drained = base::BarrierClosure(
+      static_cast<int>(pool_->work_thread_count()),
       base::Bind(&PoolSyncDrainer::OnWorkDrained, base::Unretained(this)));
+  for (size_t i = 0; i < pool_->work_thread_count(); i++) {
+    pool_->GetWorkThreadTaskRunner(i)->PostTask(FROM_HERE, drained);
+  }
 }
 
 void PoolSyncDrainer::OnWorkDrained() {
@@ -93,6 +106,22 @@ void PoolSyncDrainer::Drain() {
   event_.Wait();
 }
 
+static Fetcher::Priority ConvertPriority(CnetPriority priority) {
+  switch (priority) {
+    case CNET_PRIORITY_IDLE:
+      return Fetcher::PRIORITY_IDLE;
+    case CNET_PRIORITY_LOWEST:
+      return Fetcher::PRIORITY_LOWEST;
+    case CNET_PRIORITY_MEDIUM:
+      return Fetcher::PRIORITY_MEDIUM;
+    case CNET_PRIORITY_HIGHEST:
+      return Fetcher::PRIORITY_HIGHEST;
+    case CNET_PRIORITY_LOW:
+    default:
+      return Fetcher::PRIORITY_LOW;
+  }
+}
+
 } // namespace cnet
 
 
@@ -123,17 +152,63 @@ void CnetCleanup() {
 
 void CnetPoolDefaultConfigPrepare(CnetPoolConfig* config) {
   memset(config, 0, sizeof(CnetPoolConfig));
+  cnet::Pool::Config defaults;
+  config->read_buffer_pool_max_bytes = defaults.read_buffer_pool_max_bytes;
+  config->file_write_batch_bytes = defaults.file_write_batch_bytes;
+  config->network_threads = defaults.network_threads;
+  config->work_threads = defaults.work_threads;
 }
 
-CnetPool CnetPoolCreate(CnetMessageLoopForUi ui_loop,
-    CnetPoolConfig pool_config) {
+void CnetEngineDefaultConfigPrepare(CnetEngineConfig* config) {
+  memset(config, 0, sizeof(CnetEngineConfig));
+  cnet::Engine::Config defaults;
+  config->network_threads = defaults.network_threads;
+  config->work_threads = defaults.work_threads;
+}
+
+CnetEngine CnetEngineCreate(CnetMessageLoopForUi ui_loop,
+    CnetEngineConfig engine_config) {
   scoped_refptr<base::SingleThreadTaskRunner> ui_runner;
   if (ui_loop != NULL) {
     ui_runner =
         reinterpret_cast<base::MessageLoopForUI*>(ui_loop)->task_runner();
   }
 
+  cnet::Engine::Config config;
+  config.network_threads = std::max(engine_config.network_threads, 1);
+  config.work_threads = std::max(engine_config.work_threads, 1);
+  config.share_network_session = engine_config.share_network_session != 0;
+  config.enable_spdy = engine_config.enable_spdy != 0;
+  config.enable_quic = engine_config.enable_quic != 0;
+  config.enable_ssl_false_start = engine_config.enable_ssl_false_start != 0;
+  config.disable_system_proxy = engine_config.disable_system_proxy != 0;
+
+  cnet::Engine* engine = new cnet::Engine(ui_runner, config);
+  if (engine != NULL) {
+    engine->AddRef();
+    engine->Start();
+  }
+  return engine;
+}
+
+CnetEngine CnetEngineRetain(CnetEngine engine) {
+  if (engine != NULL) {
+    static_cast<cnet::Engine*>(engine)->AddRef();
+  }
+  return engine;
+}
+
+void CnetEngineRelease(CnetEngine engine) {
+  if (engine != NULL) {
+    static_cast<cnet::Engine*>(engine)->Release();
+  }
+}
+
+static CnetPool CreatePool(
+    scoped_refptr<base::SingleThreadTaskRunner> ui_runner,
+    scoped_refptr<cnet::Engine> engine, const CnetPoolConfig& pool_config) {
   cnet::Pool::Config config;
+  config.engine = engine;
   config.user_agent = pool_config.user_agent != NULL ?
       pool_config.user_agent:"";
   config.enable_spdy = pool_config.enable_spdy != 0;
@@ -144,6 +219,20 @@ CnetPool CnetPoolCreate(CnetMessageLoopForUi ui_loop,
       pool_config.cache_path:"");
   config.cache_max_bytes = pool_config.cache_max_bytes;
   config.trust_all_cert_authorities = pool_config.trust_all_cert_authorities != 0;
+  config.read_buffer_pool_max_bytes = pool_config.read_buffer_pool_max_bytes;
+  config.file_write_batch_bytes = std::min(pool_config.file_write_batch_bytes,
+      (unsigned)kint32max);
+  config.progress_interval_ms = pool_config.progress_interval_ms;
+  config.progress_min_bytes = pool_config.progress_min_bytes;
+  config.body_memory_budget = pool_config.body_memory_budget;
+  config.spill_bodies_over_budget = pool_config.spill_bodies_over_budget != 0;
+  config.spill_path = base::FilePath((pool_config.spill_path != NULL) ?
+      pool_config.spill_path:"");
+  config.network_threads = std::max(pool_config.network_threads, 1);
+  config.work_threads = std::max(pool_config.work_threads, 1);
+  config.max_requests = std::max(pool_config.max_requests, 0);
+  config.max_requests_per_host = std::max(pool_config.max_requests_per_host, 0);
+  config.coalesce_requests = pool_config.coalesce_requests != 0;
   config.log_level = pool_config.log_level;
 
   cnet::Pool* pool = new cnet::Pool(ui_runner, config);
@@ -153,6 +242,25 @@ CnetPool CnetPoolCreate(CnetMessageLoopForUi ui_loop,
   }
   return pool;
 }
+
+CnetPool CnetPoolCreate(CnetMessageLoopForUi ui_loop,
+    CnetPoolConfig pool_config) {
+  scoped_refptr<base::SingleThreadTaskRunner> ui_runner;
+  if (ui_loop != NULL) {
+    ui_runner =
+        reinterpret_cast<base::MessageLoopForUI*>(ui_loop)->task_runner();
+  }
+  return CreatePool(ui_runner, NULL, pool_config);
+}
+
+CnetPool CnetPoolCreateWithEngine(CnetEngine engine,
+    CnetPoolConfig pool_config) {
+  if (engine == NULL) {
+    return NULL;
+  }
+  cnet::Engine* cnet_engine = static_cast<cnet::Engine*>(engine);
+  return CreatePool(cnet_engine->ui_runner(), cnet_engine, pool_config);
+}
     
 CnetPool CnetPoolRetain(CnetPool pool) {
   if (pool != NULL) {
@@ -213,12 +321,70 @@ void CnetPoolTagFetcher(CnetPool pool, CnetFetcher fetcher, int tag) {
   }
 }
 
+void CnetPoolUntagFetcher(CnetPool pool, CnetFetcher fetcher) {
+  if (pool != NULL) {
+    static_cast<cnet::Pool*>(pool)->UntagFetcher(
+        static_cast<cnet::Fetcher*>(fetcher));
+  }
+}
+
 void CnetPoolCancelTag(CnetPool pool, int tag) {
   if (pool != NULL) {
     static_cast<cnet::Pool*>(pool)->CancelTag(tag);
   }
 }
 
+void CnetPoolSetTagPriority(CnetPool pool, int tag, CnetPriority priority) {
+  if (pool != NULL) {
+    static_cast<cnet::Pool*>(pool)->SetTagPriority(tag,
+        cnet::ConvertPriority(priority));
+  }
+}
+
+void CnetPoolPauseTag(CnetPool pool, int tag) {
+  if (pool != NULL) {
+    static_cast<cnet::Pool*>(pool)->PauseTag(tag);
+  }
+}
+
+void CnetPoolResumeTag(CnetPool pool, int tag) {
+  if (pool != NULL) {
+    static_cast<cnet::Pool*>(pool)->ResumeTag(tag);
+  }
+}
+
+void CnetPoolGetStats(CnetPool pool, CnetPoolStats* stats) {
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(CnetPoolStats));
+    if (pool != NULL) {
+      cnet::Pool::Stats pool_stats;
+      static_cast<cnet::Pool*>(pool)->GetStats(&pool_stats);
+      stats->read_buffer_hits = pool_stats.read_buffer_hits;
+      stats->read_buffer_misses = pool_stats.read_buffer_misses;
+      stats->read_buffer_idle_bytes = pool_stats.read_buffer_idle_bytes;
+      stats->body_memory_used_bytes = pool_stats.body_memory_used_bytes;
+      stats->body_memory_waiters = pool_stats.body_memory_waiters;
+      stats->body_spills = pool_stats.body_spills;
+      stats->requests_queued = pool_stats.requests_queued;
+      stats->coalesce_hits = pool_stats.coalesce_hits;
+      stats->coalesce_misses = pool_stats.coalesce_misses;
+    }
+  }
+}
+
+void CnetPoolGetTagStats(CnetPool pool, int tag, CnetTagStats* stats) {
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(CnetTagStats));
+    if (pool != NULL) {
+      cnet::TagRegistry::TagStats tag_stats;
+      static_cast<cnet::Pool*>(pool)->GetTagStats(tag, &tag_stats);
+      stats->fetchers = tag_stats.fetchers;
+      stats->in_flight = tag_stats.in_flight;
+      stats->received_bytes = tag_stats.received_bytes;
+    }
+  }
+}
+
 void CnetInvokeCompletion(CnetFetcherCompletion completion,
     void* callback_param, scoped_refptr<cnet::Fetcher> fetcher,
     scoped_refptr<cnet::Response> response) {
@@ -235,6 +401,14 @@ void CnetInvokeProgressCallback(CnetFetcherProgressCallback callback,
   }
 }
 
+void CnetInvokeDataCallback(CnetFetcherDataCallback callback,
+    void* callback_param, scoped_refptr<cnet::Fetcher> fetcher,
+    scoped_refptr<net::IOBuffer> buffer, int length) {
+  if (callback != NULL) {
+    callback(fetcher.get(), callback_param, buffer->data(), length);
+  }
+}
+
 CnetFetcher CnetFetcherCreate(CnetPool pool, const char* url,
     const char* method, void* callback_param,
     CnetFetcherCompletion completion, CnetFetcherProgressCallback download,
@@ -295,6 +469,18 @@ void CnetFetcherCancel(CnetFetcher fetcher) {
   }
 }
 
+void CnetFetcherPause(CnetFetcher fetcher) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->Pause();
+  }
+}
+
+void CnetFetcherResume(CnetFetcher fetcher) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->Resume();
+  }
+}
+
 void* CnetFetcherGetCallbackParam(CnetFetcher fetcher) {
   if (fetcher != NULL) {
     return static_cast<cnet::Fetcher*>(fetcher)->get_user_data();
@@ -311,6 +497,27 @@ void CnetFetcherSetMinSpeed(CnetFetcher fetcher,
   }
 }
 
+void CnetFetcherSetCallbackOrderTag(CnetFetcher fetcher, int tag) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetCallbackOrderTag(tag);
+  }
+}
+
+void CnetFetcherSetInlineCallbacks(CnetFetcher fetcher,
+    int inline_callbacks) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetInlineCallbacks(
+        inline_callbacks != 0);
+  }
+}
+
+void CnetFetcherSetPriority(CnetFetcher fetcher, CnetPriority priority) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetPriority(
+        cnet::ConvertPriority(priority));
+  }
+}
+
 void CnetFetcherSetCacheBehavior(CnetFetcher raw_fetcher,
     CnetCacheBehavior behavior) {
   if (raw_fetcher != NULL) {
@@ -427,6 +634,19 @@ void CnetFetcherSetUrlParamFile(CnetFetcher fetcher,
         range_offset, range_length);
   }
 }
+
+void CnetFetcherSetUrlParamBytes(CnetFetcher fetcher,
+    const char* key, const char* filename, const char* content_type,
+    const void* data, int length) {
+  if ((fetcher != NULL) && (key != NULL)) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetUrlParamBytes(
+        key,
+        filename != NULL ? filename:"",
+        content_type != NULL ? content_type:"",
+        ((data != NULL) && (length > 0)) ?
+            std::string(static_cast<const char*>(data), length):std::string());
+  }
+}
   
 void CnetFetcherSetOauthCredentials(CnetFetcher fetcher,
     const char* app_key, const char* app_secret, const char* token,
@@ -450,6 +670,29 @@ void CnetFetcherSetUploadBody(CnetFetcher fetcher,
   }
 }
 
+void CnetInvokeUploadRelease(CnetFetcherUploadReleaseCallback release,
+    void* release_param, const void* data) {
+  if (release != NULL) {
+    release(release_param, data);
+  }
+}
+
+void CnetFetcherSetUploadBuffer(CnetFetcher fetcher,
+    const char* content_type, const void* data, int64_t length,
+    CnetFetcherUploadReleaseCallback release, void* release_param) {
+  if (fetcher != NULL) {
+    base::Closure release_callback;
+    if (release != NULL) {
+      release_callback = base::Bind(CnetInvokeUploadRelease, release,
+          release_param, data);
+    }
+    static_cast<cnet::Fetcher*>(fetcher)->SetUploadBuffer(
+        content_type != NULL ? content_type:"",
+        static_cast<const char*>(data), (data != NULL) ? length:0,
+        release_callback);
+  }
+}
+
 void CnetFetcherSetUploadFile(CnetFetcher fetcher, const char* content_type,
     const char* path, uint64_t range_offset, uint64_t range_length) {
   if (fetcher != NULL) {
@@ -460,6 +703,44 @@ void CnetFetcherSetUploadFile(CnetFetcher fetcher, const char* content_type,
   }
 }
 
+int CnetInvokeUploadReadCallback(CnetFetcherUploadReadCallback callback,
+    void* callback_param, scoped_refptr<cnet::Fetcher> fetcher,
+    scoped_refptr<net::IOBuffer> buffer, int length) {
+  int result = callback(fetcher.get(), callback_param, buffer->data(),
+      length);
+  return (result < 0) ? net::ERR_FAILED:result;
+}
+
+void CnetFetcherSetUploadCallback(CnetFetcher raw_fetcher,
+    const char* content_type, int64_t length,
+    CnetFetcherUploadReadCallback callback) {
+  if ((raw_fetcher != NULL) && (callback != NULL)) {
+    cnet::Fetcher* fetcher = static_cast<cnet::Fetcher*>(raw_fetcher);
+    fetcher->SetUploadCallback(
+        (content_type != NULL) ? content_type:"", length,
+        base::Bind(CnetInvokeUploadReadCallback, callback,
+            fetcher->get_user_data()));
+  }
+}
+
+void CnetFetcherSetUploadEncoding(CnetFetcher raw_fetcher,
+    CnetUploadEncoding encoding) {
+  if (raw_fetcher != NULL) {
+    cnet::Fetcher* fetcher = static_cast<cnet::Fetcher*>(raw_fetcher);
+    switch (encoding) {
+      case CNET_UPLOAD_IDENTITY:
+        fetcher->SetUploadEncoding(cnet::Fetcher::UPLOAD_IDENTITY);
+        break;
+      case CNET_UPLOAD_GZIP:
+        fetcher->SetUploadEncoding(cnet::Fetcher::UPLOAD_GZIP);
+        break;
+      case CNET_UPLOAD_DEFLATE:
+        fetcher->SetUploadEncoding(cnet::Fetcher::UPLOAD_DEFLATE);
+        break;
+    }
+  }
+}
+
 void CnetFetcherSetOutputFile(CnetFetcher fetcher, const char* path) {
   if (fetcher != NULL) {
     static_cast<cnet::Fetcher*>(fetcher)->SetOutputFilePath(
@@ -467,6 +748,48 @@ void CnetFetcherSetOutputFile(CnetFetcher fetcher, const char* path) {
   }
 }
 
+void CnetFetcherSetOutputBuffer(CnetFetcher fetcher, void* data,
+    int capacity, CnetOverflowPolicy overflow_policy) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetOutputBuffer(
+        static_cast<char*>(data), capacity,
+        (overflow_policy == CNET_OVERFLOW_FALLBACK) ?
+            cnet::Fetcher::OVERFLOW_FALLBACK:cnet::Fetcher::OVERFLOW_FAIL);
+  }
+}
+
+void CnetFetcherSetResumable(CnetFetcher fetcher, int resumable) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetResumable(resumable != 0);
+  }
+}
+
+void CnetFetcherSetSpillThreshold(CnetFetcher fetcher,
+    int64_t threshold_bytes) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->SetSpillThreshold(threshold_bytes);
+  }
+}
+
+void CnetFetcherSetDataCallback(CnetFetcher raw_fetcher,
+    CnetFetcherDataCallback callback, int max_unacked_chunks) {
+  if (raw_fetcher != NULL) {
+    cnet::Fetcher* fetcher = static_cast<cnet::Fetcher*>(raw_fetcher);
+    cnet::Fetcher::DataCallback data_callback;
+    if (callback != NULL) {
+      data_callback = base::Bind(CnetInvokeDataCallback, callback,
+          fetcher->get_user_data());
+    }
+    fetcher->SetDataCallback(data_callback, max_unacked_chunks);
+  }
+}
+
+void CnetFetcherAckData(CnetFetcher fetcher) {
+  if (fetcher != NULL) {
+    static_cast<cnet::Fetcher*>(fetcher)->AckData();
+  }
+}
+
 CnetPool CnetFetcherPool(CnetFetcher fetcher) {
   if (fetcher != NULL) {
     return static_cast<cnet::Fetcher*>(fetcher)->pool().get();
@@ -488,6 +811,174 @@ const char* CnetFetcherInitialUrl(CnetFetcher raw_fetcher) {
   }
 }
 
+void CnetInvokeSegmentedDownloadCompletion(
+    CnetSegmentedDownloadCompletion completion, void* callback_param,
+    scoped_refptr<cnet::SegmentedDownload> download,
+    scoped_refptr<cnet::Response> response) {
+  if (completion != NULL) {
+    completion(download.get(), response.get(), download->succeeded() ? 1:0,
+        callback_param);
+  }
+}
+
+void CnetInvokeSegmentedDownloadProgress(
+    CnetSegmentedDownloadProgressCallback callback, void* callback_param,
+    scoped_refptr<cnet::SegmentedDownload> download,
+    int64_t current, int64_t total) {
+  if (callback != NULL) {
+    callback(download.get(), callback_param, current, total);
+  }
+}
+
+CnetSegmentedDownload CnetSegmentedDownloadCreate(CnetPool pool,
+    const char* url, const char* output_path, int max_segments,
+    int64_t min_segment_bytes, void* callback_param,
+    CnetSegmentedDownloadCompletion completion,
+    CnetSegmentedDownloadProgressCallback progress) {
+  if ((pool == NULL) || (url == NULL) || (output_path == NULL)) {
+    return NULL;
+  }
+
+  cnet::SegmentedDownload::CompletionCallback completion_callback;
+  if (completion != NULL) {
+    completion_callback = base::Bind(CnetInvokeSegmentedDownloadCompletion,
+        completion, callback_param);
+  }
+  cnet::SegmentedDownload::ProgressCallback progress_callback;
+  if (progress != NULL) {
+    progress_callback = base::Bind(CnetInvokeSegmentedDownloadProgress,
+        progress, callback_param);
+  }
+
+  cnet::SegmentedDownload* download = new cnet::SegmentedDownload(
+      static_cast<cnet::Pool*>(pool), url, base::FilePath(output_path),
+      max_segments, completion_callback, progress_callback);
+  if (download != NULL) {
+    download->SetMinSegmentSize(min_segment_bytes);
+    download->set_user_data(callback_param);
+
+    download->AddRef();
+  }
+  return download;
+}
+
+CnetSegmentedDownload CnetSegmentedDownloadRetain(
+    CnetSegmentedDownload download) {
+  if (download != NULL) {
+    static_cast<cnet::SegmentedDownload*>(download)->AddRef();
+  }
+  return download;
+}
+
+void CnetSegmentedDownloadRelease(CnetSegmentedDownload download) {
+  if (download != NULL) {
+    static_cast<cnet::SegmentedDownload*>(download)->Release();
+  }
+}
+
+void CnetSegmentedDownloadSetHeader(CnetSegmentedDownload download,
+    const char* key, const char* value) {
+  if ((download != NULL) && (key != NULL) && (value != NULL)) {
+    static_cast<cnet::SegmentedDownload*>(download)->SetHeader(key, value);
+  }
+}
+
+void CnetSegmentedDownloadStart(CnetSegmentedDownload download) {
+  if (download != NULL) {
+    static_cast<cnet::SegmentedDownload*>(download)->Start();
+  }
+}
+
+void CnetSegmentedDownloadCancel(CnetSegmentedDownload download) {
+  if (download != NULL) {
+    static_cast<cnet::SegmentedDownload*>(download)->Cancel();
+  }
+}
+
+void CnetInvokeParallelUploadCompletion(
+    CnetParallelUploadCompletion completion, void* callback_param,
+    scoped_refptr<cnet::ParallelUpload> upload,
+    scoped_refptr<cnet::Response> response) {
+  if (completion != NULL) {
+    completion(upload.get(), response.get(), upload->succeeded() ? 1:0,
+        callback_param);
+  }
+}
+
+void CnetInvokeParallelUploadProgress(
+    CnetParallelUploadProgressCallback callback, void* callback_param,
+    scoped_refptr<cnet::ParallelUpload> upload,
+    int64_t current, int64_t total) {
+  if (callback != NULL) {
+    callback(upload.get(), callback_param, current, total);
+  }
+}
+
+CnetParallelUpload CnetParallelUploadCreateS3(CnetPool pool,
+    const char* url, const char* file_path, const char* content_type,
+    int max_parallel_parts, int64_t part_bytes, void* callback_param,
+    CnetParallelUploadCompletion completion,
+    CnetParallelUploadProgressCallback progress) {
+  if ((pool == NULL) || (url == NULL) || (file_path == NULL)) {
+    return NULL;
+  }
+
+  cnet::ParallelUpload::CompletionCallback completion_callback;
+  if (completion != NULL) {
+    completion_callback = base::Bind(CnetInvokeParallelUploadCompletion,
+        completion, callback_param);
+  }
+  cnet::ParallelUpload::ProgressCallback progress_callback;
+  if (progress != NULL) {
+    progress_callback = base::Bind(CnetInvokeParallelUploadProgress,
+        progress, callback_param);
+  }
+
+  cnet::ParallelUpload* upload = new cnet::ParallelUpload(
+      static_cast<cnet::Pool*>(pool), new cnet::S3MultipartProtocol(url),
+      base::FilePath(file_path), (content_type != NULL) ? content_type:"",
+      max_parallel_parts, completion_callback, progress_callback);
+  if (upload != NULL) {
+    upload->SetPartSize(part_bytes);
+    upload->set_user_data(callback_param);
+
+    upload->AddRef();
+  }
+  return upload;
+}
+
+CnetParallelUpload CnetParallelUploadRetain(CnetParallelUpload upload) {
+  if (upload != NULL) {
+    static_cast<cnet::ParallelUpload*>(upload)->AddRef();
+  }
+  return upload;
+}
+
+void CnetParallelUploadRelease(CnetParallelUpload upload) {
+  if (upload != NULL) {
+    static_cast<cnet::ParallelUpload*>(upload)->Release();
+  }
+}
+
+void CnetParallelUploadSetHeader(CnetParallelUpload upload,
+    const char* key, const char* value) {
+  if ((upload != NULL) && (key != NULL) && (value != NULL)) {
+    static_cast<cnet::ParallelUpload*>(upload)->SetHeader(key, value);
+  }
+}
+
+void CnetParallelUploadStart(CnetParallelUpload upload) {
+  if (upload != NULL) {
+    static_cast<cnet::ParallelUpload*>(upload)->Start();
+  }
+}
+
+void CnetParallelUploadCancel(CnetParallelUpload upload) {
+  if (upload != NULL) {
+    static_cast<cnet::ParallelUpload*>(upload)->Cancel();
+  }
+}
+
 CnetResponse CnetResponseRetain(CnetResponse response) {
   if (response != NULL) {
     static_cast<cnet::Response*>(response)->AddRef();
@@ -564,6 +1055,56 @@ int CnetResponseLength(CnetResponse response) {
   }
 }
 
+int CnetResponseBodyChunkCount(CnetResponse response) {
+  if (response != NULL) {
+    return static_cast<int>(
+        static_cast<cnet::Response*>(response)->response_chunk_count());
+  } else {
+    return 0;
+  }
+}
+
+const char* CnetResponseBodyChunk(CnetResponse response, int index,
+    int* length) {
+  int chunk_length = 0;
+  const char* chunk = NULL;
+  if ((response != NULL) && (index >= 0)) {
+    chunk = static_cast<cnet::Response*>(response)->response_chunk(
+        static_cast<size_t>(index), &chunk_length);
+  }
+  if (length != NULL) {
+    *length = chunk_length;
+  }
+  return chunk;
+}
+
+const char* CnetResponseBodyFilePath(CnetResponse response) {
+  if (response != NULL) {
+    const base::FilePath& path =
+        static_cast<cnet::Response*>(response)->response_file_path();
+    if (!path.empty()) {
+      return path.value().c_str();
+    }
+  }
+  return NULL;
+}
+
+char* CnetResponseDetachBody(CnetResponse response, int* length) {
+  int body_length = 0;
+  char* body = NULL;
+  if (response != NULL) {
+    body = static_cast<cnet::Response*>(response)->DetachBody(&body_length);
+  }
+  if (length != NULL) {
+    *length = body_length;
+  }
+  return body;
+}
+
+void CnetResponseBodyFree(char* body) {
+  free(body);
+}
+
 int CnetResponseSucceeded(CnetResponse response) {
   if (response != NULL) {
     return static_cast<cnet::Response*>(response)->status().status() ==
@@ -16,6 +16,9 @@ extern "C" {
 #define CNET_EXPORT __attribute__((visibility("default")))
 #endif
 
+// A CnetEngine runs threads that several CnetPools may share.
+typedef void* CnetEngine;
+
 // A CnetPool tracks resources shared between HTTP requests.
 typedef void* CnetPool;
 
@@ -25,6 +28,12 @@ typedef void* CnetFetcher;
 // The HTTP response from a CnetFetcher;
 typedef void* CnetResponse;
 
+// A CnetSegmentedDownload fetches one file over several connections.
+typedef void* CnetSegmentedDownload;
+
+// A CnetParallelUpload sends one file as parts over several connections.
+typedef void* CnetParallelUpload;
+
 // A CnetMessageLopForUI represents the platform's UI message-dispatching loop.
 typedef void* CnetMessageLoopForUi;
 
@@ -65,6 +74,46 @@ typedef struct {
   // proxy settings that will be used are those set manually
   // via the Cnet API.
   int disable_system_proxy;
+  // The maximum number of bytes of idle read buffers to keep for reuse
+  // across fetchers.  If 0, read buffers are not recycled.
+  unsigned read_buffer_pool_max_bytes;
+  // Downloads to files collect this many bytes before writing them to the
+  // file in one operation.  If 0, each read is written as it arrives.
+  unsigned file_write_batch_bytes;
+  // Space out each fetcher's progress callbacks by at least this many
+  // milliseconds and bytes.  Progress is always coalesced, so at most one
+  // callback per fetcher is pending, and it reports the latest values.  The
+  // final progress is always reported.  If 0, there is no minimum.
+  int progress_interval_ms;
+  unsigned progress_min_bytes;
+  // The maximum number of bytes that in-flight requests may hold for bodies
+  // buffered in memory.  Requests wait to start, or to read more, once it
+  // is used up.  If 0, there is no limit.
+  unsigned body_memory_budget;
+  // When over the memory budget, move the largest buffered bodies to
+  // temporary files.
+  int spill_bodies_over_budget;
+  // The directory for bodies moved from memory to temporary files.  If
+  // NULL, the system's temporary directory is used.
+  const char* spill_path;
+  // The number of network threads to run requests on.  Requests for the
+  // same host always share a thread.  With more than one, each thread gets
+  // its own cache, in a subdirectory of the cache path.  If 0, one thread
+  // is used.
+  int network_threads;
+  // The number of threads that run callbacks.  Each fetcher's callbacks run
+  // in order on one thread, so a slow callback only delays the fetchers
+  // that share it.  If 0, one thread is used.
+  int work_threads;
+  // The maximum number of requests in flight at once, in all and to any
+  // one host.  The rest wait in priority order, and requests of the same
+  // priority take turns by tag.  If 0, there is no limit.
+  int max_requests;
+  int max_requests_per_host;
+  // Let cacheable GETs for the same URL, with the same headers and cache
+  // behavior, share one request while it's in flight.  Each fetcher gets its
+  // own response, sharing the body; detaching a shared body copies it.
+  int coalesce_requests;
   // Include more data in the log if greater than 0.
   //   1: include more error conditions.
   //   2: include telemetry.
@@ -73,6 +122,71 @@ typedef struct {
 
 CNET_EXPORT void CnetPoolDefaultConfigPrepare(CnetPoolConfig* config);
 
+typedef struct {
+  // The number of network threads, and of threads that run callbacks, for
+  // all pools on the engine.  If 0, one thread is used.
+  int network_threads;
+  int work_threads;
+  // Let the pools share one network session per network thread, and so
+  // share connections, host resolution and proxy settings.  Each pool keeps
+  // its own cache, which needs its own cache path.  The settings below
+  // apply to the shared sessions in place of the pools' own, and proxy
+  // rules set on any pool apply to all of them.  They are ignored unless
+  // the session is shared.
+  int share_network_session;
+  int enable_spdy;
+  int enable_quic;
+  int enable_ssl_false_start;
+  int disable_system_proxy;
+} CnetEngineConfig;
+
+CNET_EXPORT void CnetEngineDefaultConfigPrepare(CnetEngineConfig* config);
+
+// Create a CnetEngine.  It is returned with a retain count of 1.  Its
+// threads stop once it and all of its pools are released.
+//   ui_loop: the UI's message-dispatch loop, used for stopping the threads
+//       and for listening for changes to the proxy configuration.  If NULL,
+//       the threads are leaked.
+//   config: the engine's configuration.
+CNET_EXPORT CnetEngine CnetEngineCreate(CnetMessageLoopForUi ui_loop,
+    CnetEngineConfig config);
+
+// Increase the retain count on a CnetEngine.
+CNET_EXPORT CnetEngine CnetEngineRetain(CnetEngine engine);
+
+// Decrease the retain count on a CnetEngine.  Its pools keep it alive.
+CNET_EXPORT void CnetEngineRelease(CnetEngine engine);
+
+typedef struct {
+  // Reads that reused an idle buffer, and those that had to allocate one.
+  int64_t read_buffer_hits;
+  int64_t read_buffer_misses;
+  // The bytes currently held by idle read buffers.
+  int64_t read_buffer_idle_bytes;
+  // The bytes held by buffered bodies, against the memory budget.
+  int64_t body_memory_used_bytes;
+  // Requests waiting for memory to start or to read.
+  int64_t body_memory_waiters;
+  // Bodies moved from memory to disk, over budget or over their threshold.
+  int64_t body_spills;
+  // Requests waiting for the pool's request limits to start.
+  int64_t requests_queued;
+  // Coalescable requests that joined one in flight, and those that had to
+  // be sent.
+  int64_t coalesce_hits;
+  int64_t coalesce_misses;
+} CnetPoolStats;
+
+// A request's claim on sockets, and on bandwidth when it shares a
+// connection with other requests.
+typedef enum {
+  CNET_PRIORITY_IDLE,
+  CNET_PRIORITY_LOWEST,
+  CNET_PRIORITY_LOW,
+  CNET_PRIORITY_MEDIUM,
+  CNET_PRIORITY_HIGHEST,
+} CnetPriority;
+
 // Create a CnetPool.  It is returned with a retain count of 1.
 //   ui_loop: the UI's message-dispatch loop, used for listening for changes
 //       to the proxy configuration.  If NULL, the proxy changes may be
@@ -81,6 +195,12 @@ CNET_EXPORT void CnetPoolDefaultConfigPrepare(CnetPoolConfig* config);
 CNET_EXPORT CnetPool CnetPoolCreate(CnetMessageLoopForUi ui_loop,
     CnetPoolConfig config);
 
+// Create a CnetPool that runs on the threads of |engine|, sharing them with
+// the engine's other pools.  The config's thread counts are ignored.  It is
+// returned with a retain count of 1.
+CNET_EXPORT CnetPool CnetPoolCreateWithEngine(CnetEngine engine,
+    CnetPoolConfig config);
+
 // Increase the retain count on a CnetPool.
 CNET_EXPORT CnetPool CnetPoolRetain(CnetPool pool);
 
@@ -93,6 +213,7 @@ CNET_EXPORT void CnetPoolRelease(CnetPool pool);
 CNET_EXPORT void CnetPoolSetProxy(CnetPool pool, const char* rules);
 
 // Enable or disable SSL False Start for all future network connections.
+// Ignored if the pool's engine shares its network sessions.
 CNET_EXPORT void CnetPoolSetEnableSslFalseStart(CnetPool pool, int enabled);
 
 CNET_EXPORT void CnetPoolAddQuicHint(CnetPool pool, const char* host,
@@ -111,12 +232,41 @@ CNET_EXPORT void CnetPoolPreconnect(CnetPool pool, const char* url,
     int num_streams);
 
 // For mass request cancellation by tag, register a fetcher with a tag.
-// Multiple fetchers can be registered with the same tag.
+// Multiple fetchers can be registered with the same tag, and a fetcher can
+// have several tags.  A fetcher leaves its tags when it completes.
 CNET_EXPORT void CnetPoolTagFetcher(CnetPool pool, CnetFetcher fetcher, int tag);
 
+// Remove a fetcher from all of its tags.
+CNET_EXPORT void CnetPoolUntagFetcher(CnetPool pool, CnetFetcher fetcher);
+
 // Cancel all fetchers associated with a tag.
 CNET_EXPORT void CnetPoolCancelTag(CnetPool pool, int tag);
 
+// Change the priority of all fetchers associated with a tag, including
+// those that have started (e.g., when their content goes off screen).
+CNET_EXPORT void CnetPoolSetTagPriority(CnetPool pool, int tag,
+    CnetPriority priority);
+
+// Pause or resume all fetchers associated with a tag.
+CNET_EXPORT void CnetPoolPauseTag(CnetPool pool, int tag);
+CNET_EXPORT void CnetPoolResumeTag(CnetPool pool, int tag);
+
+// Fill |stats| with a snapshot of the pool's counters.
+CNET_EXPORT void CnetPoolGetStats(CnetPool pool, CnetPoolStats* stats);
+
+typedef struct {
+  // The fetchers with the tag, and those of them that have started.
+  int64_t fetchers;
+  int64_t in_flight;
+  // The body bytes received by the tag's fetchers.  The counts start over
+  // once the tag has no fetchers.
+  int64_t received_bytes;
+} CnetTagStats;
+
+// Fill |stats| with a snapshot of the counters of a tag.
+CNET_EXPORT void CnetPoolGetTagStats(CnetPool pool, int tag,
+    CnetTagStats* stats);
+
 
 typedef enum {
   CNET_ENCODE_URL,
@@ -148,6 +298,20 @@ typedef enum {
   CNET_CACHE_DISABLE,
 } CnetCacheBehavior;
 
+typedef enum {
+  CNET_UPLOAD_IDENTITY,
+  CNET_UPLOAD_GZIP,
+  CNET_UPLOAD_DEFLATE,
+} CnetUploadEncoding;
+
+typedef enum {
+  // Fail the request if the body doesn't fit in the output buffer.
+  CNET_OVERFLOW_FAIL,
+
+  // Keep the rest of the body in memory that the fetcher allocates.
+  CNET_OVERFLOW_FALLBACK,
+} CnetOverflowPolicy;
+
 typedef struct CnetLoadTiming {
   // Start time, as seconds since the Unix Epoch
   double start_s;
@@ -197,6 +361,14 @@ typedef void (*CnetFetcherCompletion)(CnetFetcher fetcher,
 typedef void (*CnetFetcherProgressCallback)(CnetFetcher fetcher, void* param,
     int64_t current, int64_t total);
 
+// The data callback for a request that streams its response body.  It is
+// invoked on a background thread, once for each chunk of the body, in order.
+//   param: the parameter for use by the callbacks.
+//   data: the chunk, which is valid only for the duration of the callback.
+//   length: the number of bytes in the chunk.
+typedef void (*CnetFetcherDataCallback)(CnetFetcher fetcher, void* param,
+    const char* data, int length);
+
 // Create an HTTP request: a CnetFetcher.  It is returned with a retain
 // count of 1.  It returns NULL in case of failure creating the request.
 // This doesn't start the request.
@@ -220,6 +392,12 @@ CNET_EXPORT void CnetFetcherStart(CnetFetcher fetcher);
 // Cancel an active HTTP request.  The completion callback will execute.
 CNET_EXPORT void CnetFetcherCancel(CnetFetcher fetcher);
 
+// Stop reading the response body, which lets flow control throttle the
+// server, and later continue where it left off.  A request paused before
+// its response arrives still receives the headers.
+CNET_EXPORT void CnetFetcherPause(CnetFetcher fetcher);
+CNET_EXPORT void CnetFetcherResume(CnetFetcher fetcher);
+
 // Retrieve the opaque user data from the Fetcher.
 CNET_EXPORT void* CnetFetcherGetCallbackParam(CnetFetcher fetcher);
 
@@ -231,11 +409,33 @@ CNET_EXPORT void* CnetFetcherGetCallbackParam(CnetFetcher fetcher);
 CNET_EXPORT void CnetFetcherSetMinSpeed(CnetFetcher fetcher,
   double min_speed_bytes_sec, double duration_secs);
 
+// Run the callbacks in order with those of every other fetcher given the
+// same tag.  By default, only the fetcher's own callbacks are ordered, and
+// with several work threads, different fetchers' callbacks may run
+// concurrently.
+CNET_EXPORT void CnetFetcherSetCallbackOrderTag(CnetFetcher fetcher, int tag);
+
+// Run the completion, progress and data callbacks, and the upload buffer's
+// release, directly on the network thread, rather than on a work thread.
+// They keep their order, so the completion still runs after the last chunk.
+// This saves a thread switch per callback, but the callbacks then delay
+// every other request: they must return quickly and never block or do I/O.
+// A cancel from within such a callback takes effect after it returns.
+// Debug builds log callbacks that run long.
+CNET_EXPORT void CnetFetcherSetInlineCallbacks(CnetFetcher fetcher,
+    int inline_callbacks);
+
 // Adjust the cache behavior of this HTTP request.  By default the
 // request obey's the protocol's defined caching behavior.
 CNET_EXPORT void CnetFetcherSetCacheBehavior(CnetFetcher fetcher,
     CnetCacheBehavior behavior);
 
+// Set the request's priority for sockets, and for bandwidth on connections
+// that it shares with other requests.  This may also be changed after the
+// request starts.
+CNET_EXPORT void CnetFetcherSetPriority(CnetFetcher fetcher,
+    CnetPriority priority);
+
 // Control whether the request stops when encountering a redirect.
 //   stop_on_redirect: if non-zero, than stop the request rather than
 //       follow a redirect.  If zero, then follow redirects.
@@ -266,7 +466,9 @@ CNET_EXPORT void CnetFetcherSetUrlParamDouble(CnetFetcher fetcher,
 
 // Upload a file with a multi-part form encoding (setting the value of a
 // a variable to the contents of the file).  If another encoding was set,
-// this will force the encoding to a multi-part encoding.
+// this will force the encoding to a multi-part encoding.  Each call adds
+// another part to the form, and the request's Content-Length accounts for
+// the files' sizes without reading them ahead.
 //   key: the name of the variable in the multi-part form that gets assigned
 //       the file's contents.
 //   filename: extra information encoded with the key/value pair.
@@ -279,6 +481,12 @@ CNET_EXPORT void CnetFetcherSetUrlParamFile(CnetFetcher fetcher,
     const char* key, const char* filename, const char* content_type,
     const char* file_path, uint64_t range_offset, uint64_t range_length);
 
+// Upload bytes with a multi-part form encoding, like
+// CnetFetcherSetUrlParamFile() but from memory.  The bytes are copied.
+CNET_EXPORT void CnetFetcherSetUrlParamBytes(CnetFetcher fetcher,
+    const char* key, const char* filename, const char* content_type,
+    const void* data, int length);
+
 // Set the request's OAuth v1 credentials.  If set, then the request
 // will be signed according to OAuth v1.
 CNET_EXPORT void CnetFetcherSetOauthCredentials(CnetFetcher fetcher,
@@ -290,6 +498,22 @@ CNET_EXPORT void CnetFetcherSetOauthCredentials(CnetFetcher fetcher,
 CNET_EXPORT void CnetFetcherSetUploadBody(CnetFetcher fetcher,
     const char* content_type, const char* content);
 
+// Releases the memory lent to CnetFetcherSetUploadBuffer().  It is invoked
+// on a background thread.
+//   param: the release_param given with the buffer.
+//   data: the buffer that the fetcher no longer needs.
+typedef void (*CnetFetcherUploadReleaseCallback)(void* param,
+    const void* data);
+
+// Send length bytes at data as the request's post body, without copying
+// them; unlike CnetFetcherSetUploadBody(), the body may be binary.  The
+// memory must stay valid until the release callback runs, once the fetcher
+// is finished with it (or is released without being started).  The release
+// callback may be NULL.
+CNET_EXPORT void CnetFetcherSetUploadBuffer(CnetFetcher fetcher,
+    const char* content_type, const void* data, int64_t length,
+    CnetFetcherUploadReleaseCallback release, void* release_param);
+
 // Use the contents of a file as the requests post body.
 //   range_offset: the starting byte in the file.
 //   range_length: the size of the region to send from the file; use the
@@ -298,11 +522,78 @@ CNET_EXPORT void CnetFetcherSetUploadFile(CnetFetcher fetcher,
     const char* content_type, const char* path, uint64_t range_offset,
     uint64_t range_length);
 
+// The callback that supplies a streamed upload body.  It is invoked on a
+// background thread, once for each piece of the body, in order.
+//   buffer: where to write the next piece of the body.
+//   length: the most bytes that buffer can hold.
+//   returns: the number of bytes written, 0 at the end of the body, or -1
+//       to fail the request.
+typedef int (*CnetFetcherUploadReadCallback)(CnetFetcher fetcher,
+    void* param, char* buffer, int length);
+
+// Generate the request's body on demand, rather than providing it up front
+// as a string or a file.  The body is read as the request sends it, so
+// producing the data overlaps with uploading it.  The body can't be resent,
+// so the request fails if it's redirected with a 307.
+//   length: the size of the body, or -1 if unknown, in which case it is
+//       sent with chunked transfer encoding.
+CNET_EXPORT void CnetFetcherSetUploadCallback(CnetFetcher fetcher,
+    const char* content_type, int64_t length,
+    CnetFetcherUploadReadCallback callback);
+
+// Compress the request's post body in the background as it's sent, and
+// label it with the Content-Encoding.  This applies to any kind of body.
+// The compressed body is sent with chunked transfer encoding, so the
+// server must accept that.
+CNET_EXPORT void CnetFetcherSetUploadEncoding(CnetFetcher fetcher,
+    CnetUploadEncoding encoding);
+
 // Save the response content to a file, and do not buffer in memory.
 // If the path is NULL, then it will instead buffer the response in memory.
 CNET_EXPORT void CnetFetcherSetOutputFile(CnetFetcher fetcher,
     const char* path);
 
+// Read the response body directly into caller-owned memory, rather than
+// into buffers that the fetcher allocates.  The memory must stay valid
+// until the response is released.  CnetResponseBody() then returns data
+// itself, unless the body is larger than capacity:
+//   CNET_OVERFLOW_FAIL: the request fails, and the contents of data are
+//       undefined.
+//   CNET_OVERFLOW_FALLBACK: the body is kept in memory that the fetcher
+//       allocates, as if no output buffer had been set.
+// If data is NULL, then it will instead buffer the response in memory.
+CNET_EXPORT void CnetFetcherSetOutputBuffer(CnetFetcher fetcher, void* data,
+    int capacity, CnetOverflowPolicy overflow_policy);
+
+// Make a download to the output file resumable.  If it fails, the partial
+// file is kept, with a sidecar file ("<path>.resume") that records the
+// response's ETag and Last-Modified date.  A later fetcher for the same
+// output file then requests only the remaining bytes, and starts over if
+// the server's file has changed.  If the server answers with an error
+// instead, that fetcher fails and the partial file is kept.
+CNET_EXPORT void CnetFetcherSetResumable(CnetFetcher fetcher, int resumable);
+
+// Buffer the response in memory until it grows beyond threshold_bytes (or
+// its content length does), and then move it to a temporary file in the
+// pool's spill_path.  Use CnetResponseBodyFilePath() to tell where the body
+// ended up.  If 0, the response stays in memory.
+CNET_EXPORT void CnetFetcherSetSpillThreshold(CnetFetcher fetcher,
+    int64_t threshold_bytes);
+
+// Stream the response body to a callback as it arrives, rather than
+// buffering it in memory or saving it to a file.  The response's body will
+// be empty.  The completion callback runs after the last chunk.
+//   max_unacked_chunks: if greater than 0, the fetcher stops reading from
+//       the network when this many chunks have been delivered and not yet
+//       acknowledged with CnetFetcherAckData().  If 0, then the chunks
+//       are delivered as fast as they arrive.
+CNET_EXPORT void CnetFetcherSetDataCallback(CnetFetcher fetcher,
+    CnetFetcherDataCallback callback, int max_unacked_chunks);
+
+// Acknowledge that a chunk from the data callback has been consumed.  This
+// may be called from any thread, including from within the data callback.
+CNET_EXPORT void CnetFetcherAckData(CnetFetcher fetcher);
+
 // Get the fetcher's pool.
 CNET_EXPORT CnetPool CnetFetcherPool(CnetFetcher fetcher);
 
@@ -310,6 +601,90 @@ CNET_EXPORT CnetPool CnetFetcherPool(CnetFetcher fetcher);
 // server will be canonical, and will include query parameters.
 CNET_EXPORT const char* CnetFetcherInitialUrl(CnetFetcher fetcher);
 
+// The completion callback for a segmented download.  It is invoked on a
+// background thread.
+//   response: the response of the last request if the download succeeded,
+//       whose body file path is the output path, else the response of the
+//       request that failed; it may be NULL if the download was cancelled
+//       before it started.
+//   succeeded: non-zero if the whole file was written to the output path.
+typedef void (*CnetSegmentedDownloadCompletion)(
+    CnetSegmentedDownload download, CnetResponse response, int succeeded,
+    void* param);
+
+// The progress callback for a segmented download, summed over all of its
+// segments.  It is invoked on a background thread.
+typedef void (*CnetSegmentedDownloadProgressCallback)(
+    CnetSegmentedDownload download, void* param, int64_t current,
+    int64_t total);
+
+// Create a download of a large file to output_path, over as many as
+// max_segments parallel connections.  A HEAD request first checks that the
+// server supports byte ranges and reports the file's size; otherwise, the
+// file is fetched over one connection.  Each segment is at least
+// min_segment_bytes (if 0, then a default of 1MB).  A failed download
+// removes the output file.  It is returned with a retain count of 1; it
+// doesn't start the download.
+CNET_EXPORT CnetSegmentedDownload CnetSegmentedDownloadCreate(CnetPool pool,
+    const char* url, const char* output_path, int max_segments,
+    int64_t min_segment_bytes, void* callback_param,
+    CnetSegmentedDownloadCompletion completion,
+    CnetSegmentedDownloadProgressCallback progress);
+
+CNET_EXPORT CnetSegmentedDownload CnetSegmentedDownloadRetain(
+    CnetSegmentedDownload download);
+CNET_EXPORT void CnetSegmentedDownloadRelease(CnetSegmentedDownload download);
+
+// Add a header to every request of the download.
+CNET_EXPORT void CnetSegmentedDownloadSetHeader(
+    CnetSegmentedDownload download, const char* key, const char* value);
+
+CNET_EXPORT void CnetSegmentedDownloadStart(CnetSegmentedDownload download);
+
+// Cancel the download.  The completion callback will execute.
+CNET_EXPORT void CnetSegmentedDownloadCancel(CnetSegmentedDownload download);
+
+// The completion callback for a parallel upload.  It is invoked on a
+// background thread.
+//   response: the response to the request that assembled the parts if the
+//       upload succeeded, else the response of the request that failed; it
+//       may be NULL if the file couldn't be read, or if the upload was
+//       cancelled before it started.
+//   succeeded: non-zero if the server assembled the whole file.
+typedef void (*CnetParallelUploadCompletion)(
+    CnetParallelUpload upload, CnetResponse response, int succeeded,
+    void* param);
+
+// The progress callback for a parallel upload, summed over all of its
+// parts.  It is invoked on a background thread.
+typedef void (*CnetParallelUploadProgressCallback)(
+    CnetParallelUpload upload, void* param, int64_t current, int64_t total);
+
+// Create an upload of the file at file_path to url with the S3 multi-part
+// upload protocol.  The file is split into parts of part_bytes (if 0, then
+// a default of 8MB), and as many as max_parallel_parts are sent at once.
+// A part that fails is retried on its own, up to 3 times.  A failed upload
+// is aborted on the server.  It is returned with a retain count of 1; it
+// doesn't start the upload.
+CNET_EXPORT CnetParallelUpload CnetParallelUploadCreateS3(CnetPool pool,
+    const char* url, const char* file_path, const char* content_type,
+    int max_parallel_parts, int64_t part_bytes, void* callback_param,
+    CnetParallelUploadCompletion completion,
+    CnetParallelUploadProgressCallback progress);
+
+CNET_EXPORT CnetParallelUpload CnetParallelUploadRetain(
+    CnetParallelUpload upload);
+CNET_EXPORT void CnetParallelUploadRelease(CnetParallelUpload upload);
+
+// Add a header to every request of the upload, such as its credentials.
+CNET_EXPORT void CnetParallelUploadSetHeader(CnetParallelUpload upload,
+    const char* key, const char* value);
+
+CNET_EXPORT void CnetParallelUploadStart(CnetParallelUpload upload);
+
+// Cancel the upload.  The completion callback will execute.
+CNET_EXPORT void CnetParallelUploadCancel(CnetParallelUpload upload);
+
 
 // Increment the retain count on a response.
 CNET_EXPORT CnetResponse CnetResponseRetain(CnetResponse response);
@@ -336,6 +711,28 @@ CNET_EXPORT const CnetLoadTiming* CnetResponseTiming(CnetResponse response);
 CNET_EXPORT const char* CnetResponseBody(CnetResponse response);
 // Get the size of the response body.
 CNET_EXPORT int CnetResponseLength(CnetResponse response);
+// Get the number of chunks in the response body.  Reading the body chunk
+// by chunk avoids the copy that CnetResponseBody() performs when the body
+// arrived in several chunks.
+CNET_EXPORT int CnetResponseBodyChunkCount(CnetResponse response);
+// Get a pointer to a chunk of the response body, and its length.  Returns
+// NULL if the index is out of range.  The pointer is invalidated by a
+// later call to CnetResponseBody().
+CNET_EXPORT const char* CnetResponseBodyChunk(CnetResponse response,
+    int index, int* length);
+// Get the path of the file that holds the response body, or NULL if the
+// body is in memory.  A body that was moved to a temporary file is deleted
+// when the response is released.
+CNET_EXPORT const char* CnetResponseBodyFilePath(CnetResponse response);
+// Take ownership of the response body without copying it, if it arrived in
+// a single chunk (otherwise the chunks are first joined).  The response's
+// body is then empty.  Release the body with CnetResponseBodyFree().
+// Returns NULL if the body is empty, or if it was read into the fetcher's
+// output buffer, which the caller already owns.  Don't call this while
+// another thread reads the response's body.
+CNET_EXPORT char* CnetResponseDetachBody(CnetResponse response, int* length);
+// Release a body from CnetResponseDetachBody().
+CNET_EXPORT void CnetResponseBodyFree(char* body);
 // Returns true if the request succeeded.
 CNET_EXPORT int CnetResponseSucceeded(CnetResponse response);
 // Returns true if the request failed.
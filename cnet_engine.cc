@@ -0,0 +1,281 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_engine.h"
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/strings/stringprintf.h"
+#include "net/cookies/cookie_monster.h"
+#include "net/http/http_cache.h"
+#include "net/http/http_network_layer.h"
+#include "net/http/http_network_session.h"
+#include "net/http/http_server_properties.h"
+#include "net/http/http_transaction_factory.h"
+#include "net/proxy/proxy_service.h"
+#include "net/url_request/static_http_user_agent_settings.h"
+#include "net/url_request/url_request_context.h"
+#include "net/url_request/url_request_context_builder.h"
+#include "net/url_request/url_request_context_storage.h"
+#include "yahoo/cnet/cnet_network_delegate.h"
+#include "yahoo/cnet/cnet_proxy_service.h"
+#include "yahoo/cnet/cnet_ssl_config_service.h"
+
+namespace cnet {
+
+namespace {
+
+const int kMaxNetworkThreads = 16;
+const int kMaxWorkThreads = 16;
+
+// A request context that sends its requests through the network session of
+// another context, and so shares its connections.  It has its own network
+// delegate, user agent, cookies and cache.
+class SharedSessionContext : public net::URLRequestContext {
+ public:
+  SharedSessionContext(const net::URLRequestContext* session_context,
+      const std::string& user_agent, const base::FilePath& cache_path,
+      unsigned cache_max_bytes,
+      scoped_refptr<base::SingleThreadTaskRunner> cache_runner);
+  virtual ~SharedSessionContext();
+
+ private:
+  net::URLRequestContextStorage storage_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedSessionContext);
+};
+
+SharedSessionContext::SharedSessionContext(
+    const net::URLRequestContext* session_context,
+    const std::string& user_agent, const base::FilePath& cache_path,
+    unsigned cache_max_bytes,
+    scoped_refptr<base::SingleThreadTaskRunner> cache_runner)
+    : storage_(this) {
+  CopyFrom(session_context);
+  storage_.set_network_delegate(new CnetNetworkDelegate());
+  storage_.set_cookie_store(new net::CookieMonster(NULL, NULL));
+  storage_.set_http_user_agent_settings(
+      new net::StaticHttpUserAgentSettings("", user_agent));
+
+  net::HttpNetworkSession* session =
+      session_context->http_transaction_factory()->GetSession();
+  if (cache_path.empty() || (cache_max_bytes == 0)) {
+    storage_.set_http_transaction_factory(new net::HttpNetworkLayer(session));
+  } else {
+    net::HttpCache::DefaultBackend* backend =
+        new net::HttpCache::DefaultBackend(net::DISK_CACHE,
+            net::CACHE_BACKEND_DEFAULT, cache_path, cache_max_bytes,
+            cache_runner);
+    storage_.set_http_transaction_factory(
+        new net::HttpCache(session, backend));
+  }
+}
+
+SharedSessionContext::~SharedSessionContext() {
+  AssertNoURLRequests();
+}
+
+} // namespace
+
+Engine::Config::Config()
+    : network_threads(1), work_threads(1), share_network_session(false),
+      enable_spdy(false), enable_quic(false), enable_ssl_false_start(false),
+      disable_system_proxy(false) {
+}
+
+Engine::Config::~Config() {
+}
+
+Engine::NetworkThread::NetworkThread()
+    : thread(NULL), context(NULL), proxy_config_service(NULL) {
+}
+
+Engine::NetworkThread::~NetworkThread() {
+}
+
+Engine::Engine(scoped_refptr<base::SingleThreadTaskRunner> ui_runner,
+    const Config& config)
+    : ui_runner_(ui_runner),
+      network_thread_count_(std::max(1, std::min(config.network_threads,
+          kMaxNetworkThreads))),
+      work_thread_count_(std::max(1, std::min(config.work_threads,
+          kMaxWorkThreads))),
+      file_thread_(NULL),
+      share_network_session_(config.share_network_session),
+      enable_spdy_(config.enable_spdy), enable_quic_(config.enable_quic),
+      enable_ssl_false_start_(config.enable_ssl_false_start),
+      disable_system_proxy_(config.disable_system_proxy) {
+}
+
+Engine::~Engine() {
+  // The pools' contexts were queued for deletion on the network threads
+  // before they released the engine, so the sessions outlive them.
+  std::vector<base::Thread*> network_threads;
+  for (size_t i = 0; i < network_threads_.size(); i++) {
+    if (network_threads_[i].context != NULL) {
+      network_threads_[i].thread->task_runner()->DeleteSoon(FROM_HERE,
+          network_threads_[i].context);
+    }
+    network_threads.push_back(network_threads_[i].thread);
+  }
+
+  if (ui_runner_.get() == NULL) {
+    LOG(WARNING) << "Leaking CnetEngine threads";
+  } else {
+    // Stopping the threads joins with them, so we have to do this from
+    // a different thread.
+    ui_runner_->PostTask(FROM_HERE, base::Bind(&Engine::DeleteThreads,
+        network_threads, work_threads_, file_thread_));
+  }
+}
+
+/* static */
+void Engine::DeleteThreads(std::vector<base::Thread*> network,
+    std::vector<base::Thread*> work, base::Thread *file) {
+  if (file != NULL) {
+    file->Stop();
+    delete file;
+  }
+  for (size_t i = 0; i < work.size(); i++) {
+    work[i]->Stop();
+    delete work[i];
+  }
+  for (size_t i = 0; i < network.size(); i++) {
+    network[i]->Stop();
+    delete network[i];
+  }
+}
+
+void Engine::Start() {
+  // Pools may attach from any thread.
+  base::AutoLock lock(start_lock_);
+  if (!network_threads_.empty()) {
+    return;
+  }
+
+  base::Thread::Options options;
+  options.message_loop_type = base::MessageLoop::TYPE_IO;
+  network_threads_.resize(network_thread_count_);
+  for (size_t i = 0; i < network_threads_.size(); i++) {
+    network_threads_[i].thread = new base::Thread((i == 0) ?
+        std::string("cnet") :
+        base::StringPrintf("cnet-%d", static_cast<int>(i)));
+    network_threads_[i].thread->StartWithOptions(options);
+  }
+  for (size_t i = 0; i < work_thread_count_; i++) {
+    base::Thread* work_thread = new base::Thread((i == 0) ?
+        std::string("cnet-work") :
+        base::StringPrintf("cnet-work-%d", static_cast<int>(i)));
+    work_thread->StartWithOptions(options);
+    work_threads_.push_back(work_thread);
+  }
+
+  if (share_network_session_) {
+    // Queued ahead of any pool's contexts, which are built on the sessions.
+    for (size_t i = 0; i < network_threads_.size(); i++) {
+      GetNetworkThreadTaskRunner(i)->PostTask(FROM_HERE,
+          base::Bind(&Engine::InitializeNetworkSession, this, i));
+    }
+    AllocSystemProxyOnUi();
+  }
+}
+
+void Engine::InitializeNetworkSession(size_t index) {
+  NetworkThread& t = network_threads_[index];
+  t.proxy_config_service = new cnet::ProxyConfigService();
+
+  // The context only holds the session and what it depends on.  Requests go
+  // through the pools' contexts.
+  net::URLRequestContextBuilder context_builder;
+  context_builder.set_proxy_config_service(t.proxy_config_service);
+  context_builder.SetSpdyAndQuicEnabled(enable_spdy_, enable_quic_);
+  context_builder.DisableHttpCache();
+
+  t.context = context_builder.Build();
+  t.context->set_ssl_config_service(
+      new SSLConfigService(enable_ssl_false_start_));
+  if (enable_quic_) {
+    // Set the alternate-protocol threshold, so that we can register
+    // QUIC as an alternate protocol for specific hosts.
+    t.context->http_server_properties()->
+        SetAlternateProtocolProbabilityThreshold(0.0f);
+  }
+}
+
+void Engine::AllocSystemProxyOnUi() {
+  if ((ui_runner_.get() == NULL) || disable_system_proxy_) {
+    for (size_t i = 0; i < network_threads_.size(); i++) {
+      ActivateSystemProxy(i, NULL);
+    }
+    return;
+  } else if (!ui_runner_->RunsTasksOnCurrentThread()) {
+    ui_runner_->PostTask(FROM_HERE,
+        base::Bind(&Engine::AllocSystemProxyOnUi, this));
+    return;
+  }
+
+  for (size_t i = 0; i < network_threads_.size(); i++) {
+    net::ProxyConfigService* system_proxy_service =
+        net::ProxyService::CreateSystemProxyConfigService(
+            GetNetworkThreadTaskRunner(i), NULL);
+    ActivateSystemProxy(i, system_proxy_service);
+  }
+}
+
+void Engine::ActivateSystemProxy(size_t index,
+    net::ProxyConfigService* system_proxy_service) {
+  if (!GetNetworkThreadTaskRunner(index)->RunsTasksOnCurrentThread()) {
+    GetNetworkThreadTaskRunner(index)->PostTask(FROM_HERE,
+        base::Bind(&Engine::ActivateSystemProxy, this, index,
+            system_proxy_service));
+    return;
+  }
+
+  cnet::ProxyConfigService* proxy_config_service =
+      network_threads_[index].proxy_config_service;
+  DCHECK(proxy_config_service != NULL);
+  if (proxy_config_service != NULL) {
+    proxy_config_service->ActivateSystemProxyService(system_proxy_service);
+  }
+}
+
+scoped_refptr<base::SingleThreadTaskRunner>
+Engine::GetNetworkThreadTaskRunner(size_t index) const {
+  return network_threads_[index].thread->task_runner();
+}
+
+scoped_refptr<base::SingleThreadTaskRunner>
+Engine::GetWorkThreadTaskRunner(size_t index) const {
+  return work_threads_[index]->task_runner();
+}
+
+scoped_refptr<base::SingleThreadTaskRunner> Engine::GetFileTaskRunner() {
+  // Callers on the work threads may race the network threads to create it.
+  base::AutoLock lock(file_thread_lock_);
+  if (file_thread_ == NULL) {
+    file_thread_ = new base::Thread("cnet-file");
+    base::Thread::Options options;
+    options.message_loop_type = base::MessageLoop::TYPE_IO;
+    file_thread_->StartWithOptions(options);
+  }
+
+  return file_thread_->task_runner();
+}
+
+net::URLRequestContext* Engine::CreateSharedSessionContext(size_t index,
+    const std::string& user_agent, const base::FilePath& cache_path,
+    unsigned cache_max_bytes) {
+  DCHECK(share_network_session_);
+  DCHECK(GetNetworkThreadTaskRunner(index)->RunsTasksOnCurrentThread());
+  // The cache's backend does its disk work on the file thread.
+  return new SharedSessionContext(network_threads_[index].context,
+      user_agent, cache_path, cache_max_bytes, GetFileTaskRunner());
+}
+
+cnet::ProxyConfigService* Engine::GetProxyConfigService(size_t index) {
+  DCHECK(GetNetworkThreadTaskRunner(index)->RunsTasksOnCurrentThread());
+  return network_threads_[index].proxy_config_service;
+}
+
+} // namespace cnet
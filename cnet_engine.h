@@ -0,0 +1,140 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_ENGINE_H_
+#define YAHOO_CNET_CNET_ENGINE_H_
+
+#include <string>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "base/single_thread_task_runner.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/thread.h"
+
+namespace net {
+class ProxyConfigService;
+class URLRequestContext;
+}
+
+namespace cnet {
+
+class ProxyConfigService;
+
+// The threads that pools run on.  A pool creates its own engine, unless it
+// is given one to share with other pools.  Pools on the same engine share
+// its network, work and file threads, and may also share a network session
+// on each network thread, and with it their connections.
+//
+// The threads stop once the engine and every pool on it are released, from
+// the UI thread.
+class Engine : public base::RefCountedThreadSafe<Engine> {
+ public:
+  struct Config {
+    Config();
+    ~Config();
+
+    // The number of network threads.  Every pool on the engine spreads its
+    // requests across all of them by host.
+    int network_threads;
+
+    // The number of threads that run the pools' callbacks.
+    int work_threads;
+
+    // Give every pool's request contexts on a network thread the same
+    // network session, so that the pools share connections, host resolution
+    // and proxy settings.  Each pool keeps its own cache, user agent and
+    // cookies.  The session uses the SPDY, QUIC, SSL false start and system
+    // proxy settings below, which replace those of the pools, and a pool's
+    // proxy rules apply to all of them.  Without a shared session, the
+    // pools' settings apply and these are ignored.
+    bool share_network_session;
+
+    bool enable_spdy;
+    bool enable_quic;
+    bool enable_ssl_false_start;
+    bool disable_system_proxy;
+  };
+
+  Engine(scoped_refptr<base::SingleThreadTaskRunner> ui_runner,
+      const Config& config);
+
+  // Start the threads.  This may be called again, such as by each pool that
+  // attaches.
+  void Start();
+
+  scoped_refptr<base::SingleThreadTaskRunner> ui_runner() const {
+    return ui_runner_;
+  }
+
+  size_t network_thread_count() const { return network_thread_count_; }
+  scoped_refptr<base::SingleThreadTaskRunner> GetNetworkThreadTaskRunner(
+      size_t index) const;
+
+  size_t work_thread_count() const { return work_thread_count_; }
+  scoped_refptr<base::SingleThreadTaskRunner> GetWorkThreadTaskRunner(
+      size_t index) const;
+
+  // The thread for file operations, which is created on first use.
+  scoped_refptr<base::SingleThreadTaskRunner> GetFileTaskRunner();
+
+  bool shares_network_session() const { return share_network_session_; }
+  bool enable_spdy() const { return enable_spdy_; }
+  bool enable_quic() const { return enable_quic_; }
+  bool enable_ssl_false_start() const { return enable_ssl_false_start_; }
+
+  // Create a request context that sends its requests through the session of
+  // network thread |index|.  It has a disk cache if |cache_path| isn't
+  // empty and |cache_max_bytes| isn't 0.  The caller owns it, and must
+  // destroy it on the thread.  Only valid on the thread, if the engine
+  // shares its network sessions.
+  net::URLRequestContext* CreateSharedSessionContext(size_t index,
+      const std::string& user_agent, const base::FilePath& cache_path,
+      unsigned cache_max_bytes);
+
+  // The proxy settings of the session of network thread |index|.  Only
+  // valid on the thread, if the engine shares its network sessions.
+  cnet::ProxyConfigService* GetProxyConfigService(size_t index);
+
+ private:
+  // A network thread, and the session context that lives on it.
+  struct NetworkThread {
+    NetworkThread();
+    ~NetworkThread();
+
+    base::Thread* thread;
+    net::URLRequestContext* context;
+    cnet::ProxyConfigService* proxy_config_service; // Owned by the context
+  };
+
+  void InitializeNetworkSession(size_t index);
+  void AllocSystemProxyOnUi();
+  void ActivateSystemProxy(size_t index,
+      net::ProxyConfigService* system_proxy_service);
+  static void DeleteThreads(std::vector<base::Thread*> network,
+      std::vector<base::Thread*> work, base::Thread* file);
+
+  scoped_refptr<base::SingleThreadTaskRunner> ui_runner_;
+  size_t network_thread_count_;
+  std::vector<NetworkThread> network_threads_;
+  size_t work_thread_count_;
+  std::vector<base::Thread*> work_threads_;
+  base::Lock start_lock_;
+  base::Thread* file_thread_;
+  base::Lock file_thread_lock_;
+
+  bool share_network_session_;
+  bool enable_spdy_;
+  bool enable_quic_;
+  bool enable_ssl_false_start_;
+  bool disable_system_proxy_;
+
+  virtual ~Engine();
+  friend class base::RefCountedThreadSafe<Engine>;
+  DISALLOW_COPY_AND_ASSIGN(Engine);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_ENGINE_H_
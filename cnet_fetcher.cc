@@ -9,10 +9,25 @@
 
 #include "yahoo/cnet/cnet_fetcher.h"
 
+#include <algorithm>
 #include <inttypes.h>
+#if defined(OS_POSIX)
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+#if defined(OS_LINUX)
+#include <fcntl.h>
+#include <linux/falloc.h>
+#endif
 
 #include "base/files/file.h"
 #include "base/files/file_util.h"
+#if defined(OS_POSIX)
+#include "base/posix/eintr_wrapper.h"
+#endif
+#include "base/rand_util.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/string_number_conversions.h"
 #include "net/base/elements_upload_data_stream.h"
@@ -28,7 +43,11 @@
 #include "yahoo/cnet/cnet_mime.h"
 #include "yahoo/cnet/cnet_oauth.h"
 #include "yahoo/cnet/cnet_pool.h"
+#include "yahoo/cnet/cnet_progress_coalescer.h"
+#include "yahoo/cnet/cnet_read_buffer_pool.h"
 #include "yahoo/cnet/cnet_response.h"
+#include "yahoo/cnet/cnet_rope_buffer.h"
+#include "yahoo/cnet/cnet_upload_stream.h"
 #include "yahoo/cnet/cnet_url_params.h"
 
 #if defined(OS_ANDROID)
@@ -38,7 +57,9 @@
 namespace {
 
 int kMaxBodyPrealloc = 5*1024*1024;
-int kBodyIncrement = 16*1024;
+
+// The size of each chunk of an in-memory body that exceeds its preallocation.
+int kBodyChunkSize = 32*1024;
 
 // URLRequestJob assumes constrained read sizes less than 1e6 bytes.
 int kReadIncrement = 64*1024;
@@ -46,6 +67,32 @@ int kReadIncrement = 64*1024;
 int kUploadProgressIntervalMs = 100;
 int kMinSpeedIntervalMs = 1000;
 
+#ifndef NDEBUG
+int kInlineCallbackBudgetMs = 2;
+#endif
+
+#if defined(OS_POSIX)
+// Write all of |iov|, resuming after partial writes.
+bool WriteVectorFully(int fd, struct iovec* iov, int count) {
+  while (count > 0) {
+    ssize_t written = HANDLE_EINTR(writev(fd, iov, std::min(count, IOV_MAX)));
+    if (written <= 0) {
+      return false;
+    }
+    while ((count > 0) && (written >= (ssize_t)iov->iov_len)) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (written > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+#endif
+
 } // namespace
 
 
@@ -60,15 +107,35 @@ void FetcherTraits::Destruct(const Fetcher* fetcher) {
 Fetcher::Fetcher(scoped_refptr<Pool> pool, const std::string& url,
     const std::string& method, CompletionCallback completion,
     ProgressCallback download, ProgressCallback upload)
-    : pool_(pool), initial_url_(url), gurl_(url), method_(method),
+    : pool_(pool), initial_url_(url), gurl_(url),
+      shard_(pool->GetShardForUrl(gurl_)),
+      work_thread_(pool->AssignWorkThread()), method_(method),
       cache_behavior_(CACHE_NORMAL), stop_on_redirect_(false),
+      priority_(net::DEFAULT_PRIORITY), scheduled_(false),
+      start_cancelled_(false), start_waiting_for_memory_(false),
+      claimed_pool_resources_(false),
       params_encoding_(ENCODE_URL),
       upload_range_offset_(0), upload_range_length_(kuint64max),
+      upload_buffer_data_(NULL), upload_buffer_length_(0),
+      upload_callback_length_(-1), upload_encoding_(UPLOAD_IDENTITY),
       completion_(completion), download_callback_(download),
       upload_callback_(upload),
+      download_progress_(new ProgressCoalescer(pool->progress_interval(),
+          pool->progress_min_bytes())),
+      upload_progress_(new ProgressCoalescer(pool->progress_interval(),
+          pool->progress_min_bytes())),
+      inline_callbacks_(false), in_inline_callback_(false),
       redirect_status_code_(-1), was_redirected_(false),
       expected_bytes_(-1), received_bytes_(0),
-      pending_files_ops_(0), output_failure_(false),
+      temporary_output_(false), output_offset_(-1),
+      resumable_(false), resume_offset_(0),
+      resume_finished_(false),
+      pending_files_ops_(0), output_failure_(false), write_batch_bytes_(0),
+      body_read_deferred_(false), spill_requested_(false),
+      spill_threshold_(0), output_buffer_data_(NULL),
+      output_buffer_capacity_(0), output_buffer_policy_(OVERFLOW_FAIL),
+      max_unacked_chunks_(0), unacked_chunks_(0),
+      stream_read_deferred_(false), paused_(false),
       min_speed_bytes_sec_(0), min_speed_coefficient_(0.4),
       last_progress_bytes_(0), last_bytes_sec_(0),
       user_data_(NULL) {
@@ -76,12 +143,15 @@ Fetcher::Fetcher(scoped_refptr<Pool> pool, const std::string& url,
 }
 
 Fetcher::~Fetcher() {
-  DCHECK(pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread());
+  DCHECK(GetNetworkTaskRunner()->RunsTasksOnCurrentThread());
+
+  // In case the fetcher never started.
+  ReleaseUploadBuffer();
 }
 
 void Fetcher::OnDestruct() const {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::OnDestruct, base::Unretained(this)));
     return;
   }
@@ -89,6 +159,16 @@ void Fetcher::OnDestruct() const {
   delete this;
 }
 
+scoped_refptr<base::SingleThreadTaskRunner>
+Fetcher::GetNetworkTaskRunner() const {
+  return pool_->GetShardTaskRunner(shard_);
+}
+
+scoped_refptr<base::SingleThreadTaskRunner>
+Fetcher::GetWorkTaskRunner() const {
+  return pool_->GetWorkThreadTaskRunner(work_thread_);
+}
+
 void Fetcher::SetHeader(const std::string& key, const std::string& value) {
   headers_[key] = value;
 }
@@ -106,12 +186,47 @@ void Fetcher::SetStopOnRedirect(bool stop_on_redirect) {
   stop_on_redirect_ = stop_on_redirect;
 }
 
+void Fetcher::SetPriority(Priority priority) {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::SetPriority, this, priority));
+    return;
+  }
+
+  switch (priority) {
+    case PRIORITY_IDLE:
+      priority_ = net::IDLE;
+      break;
+    case PRIORITY_LOWEST:
+      priority_ = net::LOWEST;
+      break;
+    case PRIORITY_LOW:
+      priority_ = net::LOW;
+      break;
+    case PRIORITY_MEDIUM:
+      priority_ = net::MEDIUM;
+      break;
+    case PRIORITY_HIGHEST:
+      priority_ = net::HIGHEST;
+      break;
+  }
+
+  if (request_ != NULL) {
+    request_->SetPriority(priority_);
+  } else if (scheduled_ && request_started_.is_null()) {
+    // Still waiting for the pool's scheduler.
+    pool_->RescheduleFetcher(this, priority_);
+  }
+}
+
 void Fetcher::SetUrlParamsEncoding(cnet::Fetcher::UrlParamsEncoding encoding) {
   params_encoding_ = encoding;
   if (params_encoding_ != ENCODE_URL) {
     upload_body_.clear();
     upload_content_type_.clear();
     upload_file_path_.clear();
+    upload_read_callback_.Reset();
+    ReleaseUploadBuffer();
   }
 }
 
@@ -123,17 +238,36 @@ void Fetcher::SetUrlParamFile(
     const std::string& key, const std::string& filename,
     const std::string& content_type, const base::FilePath& file_path,
     uint64 range_offset, uint64 range_length) {
+  mime::MultipartPart part;
+  part.name = key;
+  part.filename = filename;
+  part.content_type = content_type;
+  part.file_path = file_path;
+  part.range_offset = range_offset;
+  part.range_length = range_length;
+  AddMultipartPart(part);
+}
+
+void Fetcher::SetUrlParamBytes(
+    const std::string& key, const std::string& filename,
+    const std::string& content_type, const std::string& bytes) {
+  mime::MultipartPart part;
+  part.name = key;
+  part.filename = filename;
+  part.content_type = content_type;
+  part.bytes = bytes;
+  AddMultipartPart(part);
+}
+
+void Fetcher::AddMultipartPart(const mime::MultipartPart& part) {
   // Avoid contradictory parameter settings.
   params_encoding_ = ENCODE_BODY_MULTIPART;
   upload_body_.clear();
+  upload_file_path_.clear();
+  upload_read_callback_.Reset();
+  ReleaseUploadBuffer();
 
-  // Set the upload parameters.
-  upload_param_key_ = key;
-  upload_filename_ = filename;
-  upload_content_type_ = content_type;
-  upload_file_path_ = file_path;
-  upload_range_offset_ = range_offset;
-  upload_range_length_ = range_length;
+  multipart_parts_.push_back(part);
 }
 
 void Fetcher::SetUploadBody(const std::string &content_type,
@@ -141,8 +275,9 @@ void Fetcher::SetUploadBody(const std::string &content_type,
   // Avoid contradictory parameter settings.
   params_encoding_ = ENCODE_URL;
   upload_file_path_.clear();
-  upload_filename_.clear();
-  upload_param_key_.clear();
+  multipart_parts_.clear();
+  upload_read_callback_.Reset();
+  ReleaseUploadBuffer();
 
   // Set the upload parameters.
   upload_content_type_ = content_type;
@@ -157,8 +292,9 @@ void Fetcher::SetUploadFilePath(
   // Avoid contradictory parameter settings.
   params_encoding_ = ENCODE_URL;
   upload_body_.clear();
-  upload_filename_.clear();
-  upload_param_key_.clear();
+  multipart_parts_.clear();
+  upload_read_callback_.Reset();
+  ReleaseUploadBuffer();
 
   // Set the upload parameters.
   upload_content_type_ = content_type;
@@ -167,10 +303,128 @@ void Fetcher::SetUploadFilePath(
   upload_range_length_ = range_length;
 }
 
+void Fetcher::SetUploadBuffer(const std::string& content_type,
+    const char* data, int64 length, const base::Closure& release) {
+  // Avoid contradictory parameter settings.
+  params_encoding_ = ENCODE_URL;
+  upload_body_.clear();
+  upload_file_path_.clear();
+  multipart_parts_.clear();
+  upload_read_callback_.Reset();
+  ReleaseUploadBuffer();
+
+  // Set the upload parameters.
+  upload_content_type_ = content_type;
+  upload_buffer_data_ = data;
+  upload_buffer_length_ = (length > 0) ? length:0;
+  upload_buffer_release_ = release;
+}
+
+void Fetcher::ReleaseUploadBuffer() {
+  upload_buffer_data_ = NULL;
+  upload_buffer_length_ = 0;
+  if (!upload_buffer_release_.is_null()) {
+    if (GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+      // In order with the completion, which may run inline.
+      RunCallback(upload_buffer_release_);
+    } else {
+      GetWorkTaskRunner()->PostTask(FROM_HERE, upload_buffer_release_);
+    }
+    upload_buffer_release_.Reset();
+  }
+}
+
+void Fetcher::SetUploadCallback(const std::string& content_type,
+    int64 length, UploadReadCallback callback) {
+  // Avoid contradictory parameter settings.
+  params_encoding_ = ENCODE_URL;
+  upload_body_.clear();
+  upload_file_path_.clear();
+  multipart_parts_.clear();
+  ReleaseUploadBuffer();
+
+  // Set the upload parameters.
+  upload_content_type_ = content_type;
+  upload_read_callback_ = callback;
+  upload_callback_length_ = (length < 0) ? -1:length;
+}
+
+void Fetcher::SetUploadEncoding(UploadEncoding encoding) {
+  upload_encoding_ = encoding;
+}
+
 void Fetcher::SetOutputFilePath(const base::FilePath &file_path) {
+  // Avoid contradictory output settings.
+  data_callback_.Reset();
+  spill_threshold_ = 0;
+  output_buffer_data_ = NULL;
+  output_offset_ = -1;
+
   output_path_ = file_path;
 }
 
+void Fetcher::SetOutputFileRegion(const base::FilePath& file_path,
+    int64 offset) {
+  SetOutputFilePath(file_path);
+
+  // Avoid contradictory output settings.
+  resumable_ = false;
+
+  output_offset_ = (offset > 0) ? offset:0;
+}
+
+void Fetcher::SetOutputBuffer(char* data, int capacity,
+    OverflowPolicy policy) {
+  // Avoid contradictory output settings.
+  output_path_.clear();
+  data_callback_.Reset();
+  spill_threshold_ = 0;
+
+  output_buffer_data_ = (capacity > 0) ? data:NULL;
+  output_buffer_capacity_ = (data != NULL) ? capacity:0;
+  output_buffer_policy_ = policy;
+}
+
+void Fetcher::SetDataCallback(DataCallback callback, int max_unacked_chunks) {
+  // Avoid contradictory output settings.
+  output_path_.clear();
+  spill_threshold_ = 0;
+  output_buffer_data_ = NULL;
+
+  data_callback_ = callback;
+  max_unacked_chunks_ = (max_unacked_chunks > 0) ? max_unacked_chunks:0;
+}
+
+void Fetcher::SetResumable(bool resumable) {
+  resumable_ = resumable;
+}
+
+void Fetcher::SetSpillThreshold(int64 bytes) {
+  // Avoid contradictory output settings.
+  output_path_.clear();
+  data_callback_.Reset();
+  output_buffer_data_ = NULL;
+
+  spill_threshold_ = (bytes > 0) ? bytes:0;
+}
+
+void Fetcher::AckData() {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::AckData, this));
+    return;
+  }
+
+  if (unacked_chunks_ > 0) {
+    unacked_chunks_--;
+  }
+  if (stream_read_deferred_ && receive_completed_.is_null() &&
+      (request_ != NULL)) {
+    stream_read_deferred_ = false;
+    ReadIntoStreamStart();
+  }
+}
+
 void Fetcher::SetMinSpeed(double bytes_sec, double duration_secs) {
   if (duration_secs == 0) {
     min_speed_bytes_sec_ = 0;
@@ -184,6 +438,43 @@ void Fetcher::SetMinSpeed(double bytes_sec, double duration_secs) {
   }
 }
 
+void Fetcher::SetCallbackOrderTag(int tag) {
+  work_thread_ = pool_->GetWorkThreadForTag(tag);
+}
+
+void Fetcher::SetWorkThread(size_t index) {
+  if (index < pool_->work_thread_count()) {
+    work_thread_ = index;
+  }
+}
+
+void Fetcher::SetInlineCallbacks(bool inline_callbacks) {
+  inline_callbacks_ = inline_callbacks;
+}
+
+void Fetcher::RunCallback(const base::Closure& callback) {
+  if (!inline_callbacks_) {
+    GetWorkTaskRunner()->PostTask(FROM_HERE, callback);
+    return;
+  }
+
+#ifndef NDEBUG
+  base::TimeTicks started = base::TimeTicks::Now();
+#endif
+
+  in_inline_callback_ = true;
+  callback.Run();
+  in_inline_callback_ = false;
+
+#ifndef NDEBUG
+  base::TimeDelta elapsed = base::TimeTicks::Now() - started;
+  if (elapsed.InMilliseconds() > kInlineCallbackBudgetMs) {
+    LOG(WARNING) << "Inline callback for " << initial_url_ << " took "
+        << elapsed.InMilliseconds() << "ms on the network thread";
+  }
+#endif
+}
+
 bool Fetcher::BuildRequest() {
   DCHECK(request_ == NULL);
 
@@ -211,8 +502,8 @@ bool Fetcher::BuildRequest() {
   }
 
   // Create the request.
-  request_ = pool_->GetURLRequestContext()->CreateRequest(gurl_,
-      net::DEFAULT_PRIORITY, this, NULL);
+  request_ = pool_->GetURLRequestContext(shard_)->CreateRequest(gurl_,
+      priority_, this, NULL);
   if (request_ != NULL) {
     // Configure load flags.
     int flags = net::LOAD_DO_NOT_SAVE_COOKIES | net::LOAD_DO_NOT_SEND_COOKIES;
@@ -238,100 +529,76 @@ bool Fetcher::BuildRequest() {
       request_->SetExtraRequestHeaderByName(it->first, it->second, true);
     }
 
+    if (resume_offset_ > 0) {
+      // Ask for the rest of the partial download, unless it has changed.
+      request_->SetExtraRequestHeaderByName(net::HttpRequestHeaders::kRange,
+          base::StringPrintf("bytes=%" PRId64 "-", resume_offset_), true);
+      request_->SetExtraRequestHeaderByName("If-Range",
+          resume_etag_.empty() ? resume_last_modified_:resume_etag_, true);
+    }
+
     // Configure the POST body.
-    if ((url_params_.size() > 0) && (params_encoding_ != ENCODE_URL)) {
-      if (params_encoding_ == ENCODE_BODY_URL) {
-        // Send URL-encoded parameters as the body.
-        upload_body_ = OauthCompatibleEncodeParams(url_params_);
-        request_->SetExtraRequestHeaderByName(
-            net::HttpRequestHeaders::kContentType,
-                "application/x-www-form-urlencoded", true);
-        request_->SetExtraRequestHeaderByName(
-            net::HttpRequestHeaders::kContentLength,
-            base::IntToString(upload_body_.size()), true);
-      } else if (params_encoding_ == ENCODE_BODY_MULTIPART) {
-        // Send a multi-part form as the body.
-        std::string mime_boundary = mime::GenerateMimeBoundary();
-
-        upload_body_.clear();
-        for (UrlParams::const_iterator it = url_params_.begin();
-             it != url_params_.end(); ++it) {
-          mime::AddMultipartValueForPost(it->first, it->second,
-              mime_boundary, &upload_body_);
-        }
+    if ((params_encoding_ == ENCODE_BODY_URL) && (url_params_.size() > 0)) {
+      // Send URL-encoded parameters as the body.
+      upload_body_ = OauthCompatibleEncodeParams(url_params_);
+      upload_content_type_ = "application/x-www-form-urlencoded";
+    }
 
-        if (upload_file_path_.empty()) {
-          mime::AddMultipartFinalDelimiterForPost(mime_boundary, &upload_body_);
-
-          scoped_ptr<net::UploadElementReader> reader(
-              new net::UploadBytesElementReader(
-                  upload_body_.data(), upload_body_.size()));
-          scoped_ptr<net::UploadDataStream> stream(
-              net::ElementsUploadDataStream::CreateWithReader(reader.Pass(), 0));
-          request_->set_upload(stream.Pass());
-
-          request_->SetExtraRequestHeaderByName(
-              net::HttpRequestHeaders::kContentType,
-              "multipart/form-data; boundary=" + mime_boundary, true);
-          request_->SetExtraRequestHeaderByName(
-              net::HttpRequestHeaders::kContentLength,
-              base::IntToString(upload_body_.size()), true);
-        } else {
-          // Add a file upload to the multi-part form.
-          mime::StartMultipartValueForPost(upload_param_key_, "filename",
-              upload_filename_, upload_content_type_,
-              mime_boundary, &upload_body_);
-
-          upload_body_terminator_.clear();
-          mime::FinishMultipartValueForPost(&upload_body_terminator_);
-          mime::AddMultipartFinalDelimiterForPost(mime_boundary,
-              &upload_body_terminator_);
-
-          ScopedVector<net::UploadElementReader> readers;
-          readers.push_back(
-              new net::UploadBytesElementReader(
-                  upload_body_.data(), upload_body_.size()));
-          readers.push_back(
-              new net::UploadFileElementReader(pool_->GetFileTaskRunner().get(),
-                  upload_file_path_, upload_range_offset_,
-                  upload_range_length_, base::Time()));
-          readers.push_back(
-              new net::UploadBytesElementReader( upload_body_terminator_.data(),
-                  upload_body_terminator_.size()));
-          scoped_ptr<net::UploadDataStream> stream(
-              new net::ElementsUploadDataStream(readers.Pass(), 0));
-          request_->set_upload(stream.Pass());
-
-          request_->SetExtraRequestHeaderByName(
-              net::HttpRequestHeaders::kContentType,
-              "multipart/form-data; boundary=" + mime_boundary, true);
-        }
-      }
+    scoped_ptr<net::UploadDataStream> upload;
+    int64 upload_length = -1;
+    if ((params_encoding_ == ENCODE_BODY_MULTIPART) &&
+        ((url_params_.size() > 0) || !multipart_parts_.empty())) {
+      // Send a multi-part form as the body.
+      std::string mime_boundary = mime::GenerateMimeBoundary();
+      upload = mime::CreateMultipartUploadStream(url_params_,
+          multipart_parts_, mime_boundary, pool_->GetFileTaskRunner().get());
+
+      request_->SetExtraRequestHeaderByName(
+          net::HttpRequestHeaders::kContentType,
+          "multipart/form-data; boundary=" + mime_boundary, true);
     } else if (!upload_body_.empty()) {
       // Send a raw POST body.
       scoped_ptr<net::UploadElementReader> reader(
           new net::UploadBytesElementReader(
               upload_body_.data(), upload_body_.size()));
-      scoped_ptr<net::UploadDataStream> stream(
-          net::ElementsUploadDataStream::CreateWithReader(reader.Pass(), 0));
-      request_->set_upload(stream.Pass());
+      upload = net::ElementsUploadDataStream::CreateWithReader(
+          reader.Pass(), 0);
+      upload_length = upload_body_.size();
+
+      if (!upload_content_type_.empty()) {
+        request_->SetExtraRequestHeaderByName(
+            net::HttpRequestHeaders::kContentType, upload_content_type_, true);
+      }
+    } else if (upload_buffer_data_ != NULL) {
+      // Send the caller's memory as the POST body, without copying it.
+      scoped_ptr<net::UploadElementReader> reader(
+          new net::UploadBytesElementReader(
+              upload_buffer_data_, upload_buffer_length_));
+      upload = net::ElementsUploadDataStream::CreateWithReader(
+          reader.Pass(), 0);
+      upload_length = upload_buffer_length_;
+
+      if (!upload_content_type_.empty()) {
+        request_->SetExtraRequestHeaderByName(
+            net::HttpRequestHeaders::kContentType, upload_content_type_, true);
+      }
+    } else if (!upload_read_callback_.is_null()) {
+      // Pull the POST body from the callback as it's sent.
+      upload.reset(new UploadCallbackStream(upload_callback_length_,
+          base::Bind(&Fetcher::ReadUploadCallback, base::Unretained(this))));
 
       if (!upload_content_type_.empty()) {
         request_->SetExtraRequestHeaderByName(
             net::HttpRequestHeaders::kContentType, upload_content_type_, true);
       }
-      request_->SetExtraRequestHeaderByName(
-          net::HttpRequestHeaders::kContentLength,
-          base::IntToString(upload_body_.size()), true);
     } else if (!upload_file_path_.empty()) {
       // Send a file as the POST body.
       scoped_ptr<net::UploadElementReader> reader(
           new net::UploadFileElementReader(pool_->GetFileTaskRunner().get(),
               upload_file_path_, upload_range_offset_,
               upload_range_length_, base::Time()));
-      scoped_ptr<net::UploadDataStream> stream(
-          net::ElementsUploadDataStream::CreateWithReader(reader.Pass(), 0));
-      request_->set_upload(stream.Pass());
+      upload = net::ElementsUploadDataStream::CreateWithReader(
+          reader.Pass(), 0);
 
       if (!upload_content_type_.empty()) {
         request_->SetExtraRequestHeaderByName(
@@ -339,6 +606,25 @@ bool Fetcher::BuildRequest() {
       }
     }
 
+    if ((upload != NULL) && (upload_encoding_ != UPLOAD_IDENTITY)) {
+      // Compress the body on the file thread as it's sent.  Its compressed
+      // length isn't known, so it's sent with chunked encoding.
+      bool gzip = (upload_encoding_ == UPLOAD_GZIP);
+      upload.reset(new UploadCompressionStream(upload.Pass(),
+          gzip ? UploadCompressionStream::FORMAT_GZIP:
+              UploadCompressionStream::FORMAT_DEFLATE,
+          pool_->GetFileTaskRunner()));
+      request_->SetExtraRequestHeaderByName("Content-Encoding",
+          gzip ? "gzip":"deflate", true);
+    } else if (upload_length >= 0) {
+      request_->SetExtraRequestHeaderByName(
+          net::HttpRequestHeaders::kContentLength,
+          base::Int64ToString(upload_length), true);
+    }
+    if (upload != NULL) {
+      request_->set_upload(upload.Pass());
+    }
+
     return true;
   } else {
     return false;
@@ -346,32 +632,217 @@ bool Fetcher::BuildRequest() {
 }
 
 void Fetcher::Start() {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::Start, this));
     return;
   }
 
   DCHECK(request_started_.is_null());
-  if (!request_started_.is_null()) {
+  if (!request_started_.is_null() || start_cancelled_) {
+    return;
+  }
+  start_waiting_for_memory_ = false;
+  if (queued_.is_null()) {
+    queued_ = base::TimeTicks::Now();
+  }
+  // A fetcher that took over a coalesced request already leads it.
+  if (coalescing_key_.empty() && FollowInFlightFetcher()) {
+    return;
+  }
+  if (!scheduled_ && pool_->IsSchedulingRequests()) {
+    // Wait for the pool to admit the request, which starts it again.
+    scheduled_ = true;
+    pool_->ScheduleFetcher(this, gurl_.host(), priority_);
+    return;
+  }
+  if (output_path_.empty() && data_callback_.is_null() &&
+      (output_buffer_data_ == NULL) &&
+      !pool_->IsBodyMemoryAvailable(this, base::Bind(&Fetcher::Start, this))) {
+    // Don't add another buffered body until the pool has room for it.
+    start_waiting_for_memory_ = true;
     return;
   }
   request_started_ = base::TimeTicks::Now();
+  ClaimPoolResources();
 
-  this->AddRef(); // Stay alive until the request completes.
-  pool_->FetcherStarting(this); // Claim pool resources.
+  if (coalescing_key_.empty() && pool_->coalesce_requests() &&
+      IsCoalescable()) {
+    // Let identical requests follow this one.
+    coalescing_key_ = GetCoalescingKey();
+    pool_->AddInFlightFetcher(shard_, coalescing_key_, this);
+  }
 
+  if (resumable_ && !output_path_.empty()) {
+    // Look for a partial download before building the request.
+    FileReadResumeState();
+  } else {
+    StartRequest();
+  }
+}
+
+void Fetcher::StartRequest() {
   if (BuildRequest()) {
     request_->Start();
   } else {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::OnRequestComplete, this));
   }
 }
 
+void Fetcher::ClaimPoolResources() {
+  if (claimed_pool_resources_) {
+    return;
+  }
+  claimed_pool_resources_ = true;
+
+  this->AddRef(); // Stay alive until the request completes.
+  pool_->FetcherStarting(this); // Claim pool resources.
+}
+
+void Fetcher::CancelUnstarted() {
+  start_cancelled_ = true;
+  receive_completed_ = base::TimeTicks::Now();
+
+  ClaimPoolResources(); // FinishRequest() gives them back.
+  FinishRequest();
+}
+
+void Fetcher::Pause() {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::Pause, this));
+    return;
+  }
+
+  // The reads stop at the next one; the transfer isn't slow meanwhile.
+  paused_ = true;
+  min_speed_timer_.reset();
+}
+
+void Fetcher::Resume() {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::Resume, this));
+    return;
+  }
+
+  if (!paused_) {
+    return;
+  }
+  paused_ = false;
+
+  if (!network_started_.is_null() && receive_completed_.is_null() &&
+      (request_ != NULL)) {
+    StartMinSpeedTimer();
+  }
+  ResumeRead();
+}
+
+void Fetcher::ResumeRead() {
+  if (paused_read_.is_null()) {
+    return;
+  }
+
+  base::Closure read = paused_read_;
+  paused_read_.Reset();
+  if (receive_completed_.is_null() && (request_ != NULL)) {
+    read.Run();
+  }
+}
+
+bool Fetcher::IsCoalescable() const {
+  // Only a GET whose body is buffered in memory, and whose response doesn't
+  // depend on anything other than its URL, headers, cache behavior and
+  // spill threshold, which make up its key.
+  return (method_ == "GET") && (cache_behavior_ != CACHE_BYPASS) &&
+      (cache_behavior_ != CACHE_DISABLE) && !stop_on_redirect_ &&
+      (oauth_credentials_ == NULL) && url_params_.empty() &&
+      upload_body_.empty() && multipart_parts_.empty() &&
+      upload_file_path_.empty() && (upload_buffer_data_ == NULL) &&
+      upload_read_callback_.is_null() && output_path_.empty() &&
+      data_callback_.is_null() && (output_buffer_data_ == NULL) &&
+      !resumable_ && (min_speed_bytes_sec_ == 0);
+}
+
+std::string Fetcher::GetCoalescingKey() const {
+  std::string key = base::StringPrintf("%d %" PRId64 " %s", cache_behavior_,
+      spill_threshold_, gurl_.spec().c_str());
+  for (Headers::const_iterator it = headers_.begin(); it != headers_.end();
+       ++it) {
+    key.append("\n");
+    key.append(it->first);
+    key.append(": ");
+    key.append(it->second);
+  }
+  return key;
+}
+
+bool Fetcher::FollowInFlightFetcher() {
+  if (!pool_->coalesce_requests() || !IsCoalescable()) {
+    return false;
+  }
+  scoped_refptr<Fetcher> leader = pool_->FindInFlightFetcher(shard_,
+      GetCoalescingKey());
+  if (leader.get() == NULL) {
+    return false;
+  }
+
+  // Wait for the leader's response instead of sending the request again,
+  // and give back any slot that the scheduler granted.
+  if (scheduled_) {
+    pool_->UnscheduleFetcher(this);
+    scheduled_ = false;
+  }
+  request_started_ = base::TimeTicks::Now();
+  ClaimPoolResources(); // Until the leader completes.
+
+  leader_ = leader;
+  leader->followers_.push_back(this);
+  // A paused leader reads on for its followers.
+  leader->ResumeRead();
+  return true;
+}
+
+void Fetcher::RemoveFollower(scoped_refptr<Fetcher> follower) {
+  std::vector<scoped_refptr<Fetcher> >::iterator it =
+      std::find(followers_.begin(), followers_.end(), follower);
+  if (it != followers_.end()) {
+    followers_.erase(it);
+  }
+}
+
+void Fetcher::HandOffFollowers() {
+  // The first follower runs the request again for the others, so that
+  // cancelling this fetcher doesn't cancel them.
+  scoped_refptr<Fetcher> leader = followers_.front();
+  leader->leader_ = NULL;
+  leader->followers_.assign(followers_.begin() + 1, followers_.end());
+  for (size_t i = 0; i < leader->followers_.size(); i++) {
+    leader->followers_[i]->leader_ = leader;
+  }
+  followers_.clear();
+
+  // Fetchers that start meanwhile follow the new leader, which waits for
+  // the scheduler and for body memory like any other request.
+  leader->coalescing_key_.swap(coalescing_key_);
+  pool_->AddInFlightFetcher(shard_, leader->coalescing_key_, leader);
+  leader->request_started_ = base::TimeTicks();
+  leader->Start();
+}
+
+void Fetcher::OnLeaderCompleted(scoped_refptr<Response> response) {
+  leader_ = NULL;
+  leader_response_ = response;
+  receive_completed_ = base::TimeTicks::Now();
+  FinishRequest();
+}
+
 void Fetcher::Cancel() {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  // Don't tear down the request underneath an inline callback.
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread() ||
+      in_inline_callback_) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::Cancel, this));
     return;
   }
@@ -379,11 +850,29 @@ void Fetcher::Cancel() {
   if (!network_started_.is_null()) {
     // TODO: implement cancel suppression.
   }
+  if (leader_.get() != NULL) {
+    leader_->RemoveFollower(this);
+    leader_ = NULL;
+    // We never sent a request of our own to report on.
+    start_cancelled_ = true;
+  }
+  if (!followers_.empty()) {
+    HandOffFollowers();
+  }
   if (!request_started_.is_null()) {
     if (request_ != NULL) {
       request_->Cancel();
     }
     OnRequestComplete();
+  } else if (!queued_.is_null() && !start_cancelled_) {
+    // Still waiting for the scheduler or for body memory.  Completing gives
+    // back any slot that the scheduler holds for us, and the tags.
+    if (start_waiting_for_memory_) {
+      // The retry would start the request anyway, so drop it.
+      start_waiting_for_memory_ = false;
+      pool_->CancelBodyMemoryWait(this);
+    }
+    CancelUnstarted();
   }
 }
 
@@ -396,6 +885,12 @@ void Fetcher::OnBeforeNetworkStart(net::URLRequest* request, bool* defer) {
         base::TimeDelta::FromMilliseconds(kUploadProgressIntervalMs),
         this, &Fetcher::OnUploadProgressTimer);
   }
+  if (!paused_) {
+    StartMinSpeedTimer();
+  }
+}
+
+void Fetcher::StartMinSpeedTimer() {
   if (min_speed_bytes_sec_ > 0) {
     min_speed_timer_.reset(new base::RepeatingTimer<Fetcher>());
     min_speed_timer_->Start(FROM_HERE,
@@ -410,9 +905,10 @@ void Fetcher::OnUploadProgressTimer() {
     if (!upload_callback_.is_null()) {
       uint64 position = progress.position();
       uint64 total = progress.size();
-      pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
-          base::Bind(upload_callback_, make_scoped_refptr(this),
-                     position, total));
+      if (upload_progress_->Update(position, total, base::TimeTicks::Now())) {
+        RunCallback(base::Bind(&Fetcher::DeliverProgress, upload_callback_,
+            make_scoped_refptr(this), upload_progress_));
+      }
       if ((total > 0) && (position >= total)) {
         // We don't need the upload timer firing once we've finished
         // the upload.
@@ -423,6 +919,12 @@ void Fetcher::OnUploadProgressTimer() {
 }
 
 void Fetcher::OnMinSpeedTimer() {
+  if (stream_read_deferred_ || body_read_deferred_ ||
+      !paused_read_.is_null()) {
+    // We are waiting on a slow consumer, on memory or on a pause, not on a
+    // slow network.
+    return;
+  }
   if ((request_ != NULL) && request_->is_pending()) {
     // Compute a very rough estimate of our bandwidth.
     net::UploadProgress progress = request_->GetUploadProgress();
@@ -471,25 +973,51 @@ void Fetcher::OnResponseStarted(net::URLRequest* request) {
     receive_started_ = base::TimeTicks::Now();
     expected_bytes_ = request->GetExpectedContentSize();
 
-    if (output_path_.empty()) {
-      if (read_buffer_.get() == NULL) {
-        read_buffer_ = new net::GrowableIOBuffer();
+    if (!data_callback_.is_null()) {
+      ReadIntoStreamStart();
+    } else if (output_path_.empty()) {
+      if (body_buffer_.get() == NULL) {
+        body_buffer_ = new RopeBuffer(kBodyChunkSize);
       }
 
-      if (expected_bytes_ > 0) {
-        int prealloc = (expected_bytes_ < kMaxBodyPrealloc) ?
-            expected_bytes_:kMaxBodyPrealloc;
-        read_buffer_->SetCapacity(prealloc);
-      }
+      if ((output_buffer_data_ != NULL) &&
+          (expected_bytes_ > output_buffer_capacity_) &&
+          (output_buffer_policy_ == OVERFLOW_FAIL)) {
+        request_->CancelWithError(net::ERR_FILE_TOO_BIG);
+        OnRequestComplete();
+      } else if ((output_buffer_data_ != NULL) &&
+          (expected_bytes_ <= output_buffer_capacity_)) {
+        // Read straight into the caller's memory.
+        body_buffer_->SetExternalBuffer(output_buffer_data_,
+            output_buffer_capacity_);
+        ReadIntoBufferStart();
+      } else if ((spill_threshold_ > 0) &&
+          (expected_bytes_ > spill_threshold_) &&
+          !pool_->spill_path().empty()) {
+        // Too large to keep in memory, so go straight to the file.
+        SpillBodyToFile();
+        ReadIntoFileStart();
+      } else {
+        if (expected_bytes_ > 0) {
+          int prealloc = (expected_bytes_ < kMaxBodyPrealloc) ?
+              expected_bytes_:kMaxBodyPrealloc;
+          if (pool_->ReserveBodyMemory(this, prealloc, base::Closure())) {
+            body_buffer_->Reserve(prealloc);
+          }
+        }
 
-      ReadIntoBufferStart();
+        ReadIntoBufferStart();
+      }
+    } else if (resumable_ && !PrepareResume()) {
+      request_->CancelWithError(net::ERR_INVALID_RESPONSE);
+      OnRequestComplete();
     } else {
       // Add a pending op for starting the request.  It will be matched
       // in OnRequestComplete() by a decrement.
       pending_files_ops_++;
 
       pending_files_ops_++; // For the file open.
-      FileOpen();
+      FileOpen(expected_bytes_);
 
       ReadIntoFileStart();
     }
@@ -498,7 +1026,12 @@ void Fetcher::OnResponseStarted(net::URLRequest* request) {
 
 void Fetcher::OnReadCompleted(net::URLRequest* request, int bytes_read) {
   if (bytes_read <= 0) {
+    RecycleReadBuffer(&stream_buffer_);
+    RecycleReadBuffer(&read_buffer_);
     OnRequestComplete();
+  } else if (!data_callback_.is_null()) {
+    ReadIntoStreamComplete(bytes_read);
+    ReadIntoStreamStart();
   } else if (output_path_.empty()) {
     ReadIntoBufferComplete(bytes_read);
     ReadIntoBufferStart();
@@ -516,41 +1049,95 @@ void Fetcher::OnRequestComplete() {
 
   upload_progress_timer_.reset();
   min_speed_timer_.reset();
+  paused_read_.Reset();
 
-  if (output_path_.empty()) {
+  if (output_path_.empty() || (pending_files_ops_ == 0)) {
+    // Nothing was written to a file if the request failed before the
+    // response started.
     FinishRequest();
   } else {
+    FlushWriteBatch();
     FileCompleteOp();
   }
 }
 
+void Fetcher::DidReceiveBytes(int bytes_read) {
+  received_bytes_ += bytes_read;
+  pool_->AddTagReceivedBytes(this, bytes_read);
+  OnDownloadProgress(received_bytes_, expected_bytes_);
+}
+
 void Fetcher::OnDownloadProgress(int64 progress, int64 expected) {
-  if (!download_callback_.is_null()) {
-    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(download_callback_, make_scoped_refptr(this),
-                   progress, expected));
+  // While an event is pending, it picks up the new values when it runs.
+  if (!download_callback_.is_null() &&
+      download_progress_->Update(progress, expected, base::TimeTicks::Now())) {
+    RunCallback(base::Bind(&Fetcher::DeliverProgress, download_callback_,
+        make_scoped_refptr(this), download_progress_));
   }
 }
 
+/* static */
+void Fetcher::DeliverProgress(ProgressCallback callback,
+    scoped_refptr<Fetcher> fetcher,
+    scoped_refptr<ProgressCoalescer> progress) {
+  int64 current;
+  int64 total;
+  progress->Take(&current, &total, base::TimeTicks::Now());
+  callback.Run(fetcher, current, total);
+}
+
 // LICENSE: modeled after URLRequestAdapter::Read() from
 //     components/cronet/android/url_request_adapter.cc
 void Fetcher::ReadIntoBufferStart() {
-  CHECK(read_buffer_.get() != NULL);
+  CHECK(body_buffer_.get() != NULL);
   while (true) {
-    if (read_buffer_->RemainingCapacity() == 0) {
-      int64 new_capacity = read_buffer_->capacity() + kBodyIncrement;
-      if (new_capacity > kint32max) {
-        // The fetcher is not designed to handle large responses.
-        request_->Cancel();
-        OnRequestComplete();
-        break;
-      }
-      read_buffer_->SetCapacity((int)new_capacity);
+    if (body_buffer_->size() > kint32max - kReadIncrement) {
+      // The fetcher is not designed to handle large responses.
+      request_->Cancel();
+      OnRequestComplete();
+      break;
+    }
+    if ((output_buffer_data_ != NULL) &&
+        (output_buffer_policy_ == OVERFLOW_FAIL) &&
+        (body_buffer_->size() > body_buffer_->external_size())) {
+      // The body didn't fit in the caller's buffer.
+      request_->CancelWithError(net::ERR_FILE_TOO_BIG);
+      OnRequestComplete();
+      break;
+    }
+
+    if ((spill_threshold_ > 0) && (body_buffer_->size() > spill_threshold_) &&
+        !pool_->spill_path().empty()) {
+      spill_requested_ = true;
+    }
+    if (spill_requested_) {
+      // Nothing is reading into the body, so it's safe to move it.
+      SpillBodyToFile();
+      ReadIntoFileStart();
+      break;
+    }
+
+    if (IsPaused()) {
+      // Resume() continues the reads.
+      paused_read_ = base::Bind(&Fetcher::ReadIntoBufferStart, this);
+      break;
+    }
+
+    int chunk_size = body_buffer_->NextChunkSize();
+    if ((chunk_size > 0) && !pool_->ReserveBodyMemory(this, chunk_size,
+            base::Bind(&Fetcher::OnBodyMemoryAvailable, this))) {
+      // Let the other fetchers release some memory.
+      body_read_deferred_ = true;
+      break;
     }
 
+    // The rope appends a chunk when its tail is full, so the bytes that we
+    // have already received are never moved.
     int bytes_read;
-    int to_read = std::min(kReadIncrement, read_buffer_->RemainingCapacity());
-    if (request_->Read(read_buffer_.get(), to_read, &bytes_read)) {
+    int available = 0;
+    net::IOBuffer* buffer = body_buffer_->GetWriteBuffer(&available);
+    int to_read = std::min(kReadIncrement, available);
+    if (request_->Read(buffer, to_read, &bytes_read)) {
       // We completed a synchronous read.
       if (bytes_read == 0) {
         OnRequestComplete();
@@ -569,22 +1156,167 @@ void Fetcher::ReadIntoBufferStart() {
 }
 
 void Fetcher::ReadIntoBufferComplete(int bytes_read) {
-  CHECK(read_buffer_.get() != NULL);
-  read_buffer_->set_offset(read_buffer_->offset() + bytes_read);
+  CHECK(body_buffer_.get() != NULL);
+  body_buffer_->DidWrite(bytes_read);
 
-  received_bytes_ += bytes_read;
-  OnDownloadProgress(received_bytes_, expected_bytes_);
+  DidReceiveBytes(bytes_read);
+}
+
+void Fetcher::OnBodyMemoryAvailable() {
+  // The pool runs its waiters on its own network thread.
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::OnBodyMemoryAvailable, this));
+    return;
+  }
+
+  if (body_read_deferred_ && receive_completed_.is_null() &&
+      (request_ != NULL)) {
+    body_read_deferred_ = false;
+    ReadIntoBufferStart();
+  }
+}
+
+void Fetcher::SpillBody() {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::SpillBody, this));
+    return;
+  }
+
+  if ((body_buffer_.get() == NULL) || !receive_completed_.is_null() ||
+      spill_requested_) {
+    return;
+  }
+
+  // A read may be in progress into the body, so the next read moves it.
+  spill_requested_ = true;
+  OnBodyMemoryAvailable();
+}
+
+void Fetcher::SpillBodyToFile() {
+  spill_requested_ = false;
+  scoped_refptr<RopeBuffer> spilled = body_buffer_;
+  body_buffer_ = NULL;
+  pool_->ReleaseBodyMemory(this, true);
+
+  output_path_ = pool_->spill_path().AppendASCII(
+      base::StringPrintf("cnet-%016" PRIx64 ".tmp", base::RandUint64()));
+  temporary_output_ = true;
+
+  // Add a pending op for the rest of the request.  It will be matched
+  // in OnRequestComplete() by a decrement.
+  pending_files_ops_++;
+
+  pending_files_ops_++; // For the file open.
+  FileOpen(expected_bytes_);
+
+  pending_files_ops_++; // For what we have received so far.
+  FileRopeWrite(spilled);
+}
+
+void Fetcher::ReadUploadCallback(scoped_refptr<net::IOBuffer> buffer,
+    int length, const base::Callback<void(int)>& done) {
+  // The stream belongs to our request, so we outlive it.  Generating the
+  // body may block, so keep it off the network thread.
+  GetWorkTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&Fetcher::RunUploadCallback, upload_read_callback_,
+                 make_scoped_refptr(this), buffer, length, done));
+}
+
+void Fetcher::RunUploadCallback(UploadReadCallback callback,
+    scoped_refptr<Fetcher> fetcher, scoped_refptr<net::IOBuffer> buffer,
+    int length, const base::Callback<void(int)>& done) {
+  int result = callback.Run(fetcher, buffer, length);
+  if (result > length) {
+    result = net::ERR_FAILED;
+  }
+  fetcher->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(done, result));
+}
+
+void Fetcher::RecycleReadBuffer(
+    scoped_refptr<net::IOBufferWithSize>* buffer) {
+  if (buffer->get() != NULL) {
+    pool_->read_buffers()->Recycle(*buffer);
+    *buffer = NULL;
+  }
+}
+
+void Fetcher::ReadIntoStreamStart() {
+  while (true) {
+    if ((max_unacked_chunks_ > 0) &&
+        (unacked_chunks_ >= max_unacked_chunks_)) {
+      // Let the consumer catch up; AckData() resumes the reads.
+      stream_read_deferred_ = true;
+      break;
+    }
+    if (IsPaused()) {
+      // Resume() continues the reads.
+      paused_read_ = base::Bind(&Fetcher::ReadIntoStreamStart, this);
+      break;
+    }
+
+    stream_buffer_ = pool_->read_buffers()->Acquire();
+
+    int bytes_read;
+    if (request_->Read(stream_buffer_.get(), stream_buffer_->size(),
+                       &bytes_read)) {
+      if (bytes_read == 0) {
+        RecycleReadBuffer(&stream_buffer_);
+        OnRequestComplete();
+        break;
+      }
+      ReadIntoStreamComplete(bytes_read);
+    } else if (request_->status().status() ==
+               net::URLRequestStatus::IO_PENDING) {
+      // We've started an asynchronous read.
+      break;
+    } else {
+      RecycleReadBuffer(&stream_buffer_);
+      OnRequestComplete();
+      break;
+    }
+  }
+}
+
+void Fetcher::ReadIntoStreamComplete(int bytes_read) {
+  CHECK(stream_buffer_.get() != NULL);
+  scoped_refptr<net::IOBufferWithSize> buffer = stream_buffer_;
+  stream_buffer_ = NULL;
+
+  if (max_unacked_chunks_ > 0) {
+    unacked_chunks_++;
+  }
+  RunCallback(base::Bind(&Fetcher::DeliverData, data_callback_,
+      make_scoped_refptr(this), buffer, bytes_read));
+
+  DidReceiveBytes(bytes_read);
+}
+
+/* static */
+void Fetcher::DeliverData(DataCallback callback,
+    scoped_refptr<Fetcher> fetcher,
+    scoped_refptr<net::IOBufferWithSize> buffer, int length) {
+  callback.Run(fetcher, buffer, length);
+  fetcher->pool()->read_buffers()->Recycle(buffer);
 }
 
 void Fetcher::ReadIntoFileStart() {
   while (true) {
-    read_buffer_ = new net::GrowableIOBuffer();
-    read_buffer_->SetCapacity(kReadIncrement);
+    if (IsPaused()) {
+      // Resume() continues the reads.
+      paused_read_ = base::Bind(&Fetcher::ReadIntoFileStart, this);
+      break;
+    }
+
+    read_buffer_ = pool_->read_buffers()->Acquire();
 
     int bytes_read;
-    if (request_->Read(read_buffer_.get(), read_buffer_->RemainingCapacity(),
+    if (request_->Read(read_buffer_.get(), read_buffer_->size(),
                         &bytes_read)) {
       if (bytes_read == 0) {
+        RecycleReadBuffer(&read_buffer_);
         OnRequestComplete();
         break;
       }
@@ -594,6 +1326,7 @@ void Fetcher::ReadIntoFileStart() {
       // We've started an asynchronous read.
       break;
     } else {
+      RecycleReadBuffer(&read_buffer_);
       OnRequestComplete();
       break;
     }
@@ -602,39 +1335,92 @@ void Fetcher::ReadIntoFileStart() {
 
 void Fetcher::ReadIntoFileComplete(int bytes_read) {
   CHECK(read_buffer_.get() != NULL);
-  scoped_refptr<net::IOBuffer> buffer = read_buffer_;
+  scoped_refptr<net::IOBufferWithSize> buffer = read_buffer_;
   read_buffer_ = NULL;
 
-  pending_files_ops_++;
-  FileChunkWrite(buffer, bytes_read);
+  // Hand the file thread larger batches, so that we pay for fewer thread
+  // hops and system calls.
+  write_batch_.push_back(std::make_pair(buffer, bytes_read));
+  write_batch_bytes_ += bytes_read;
+  if (write_batch_bytes_ >= pool_->file_write_batch_bytes()) {
+    FlushWriteBatch();
+  }
 
-  received_bytes_ += bytes_read;
-  OnDownloadProgress(received_bytes_, expected_bytes_);
+  DidReceiveBytes(bytes_read);
+}
+
+void Fetcher::FlushWriteBatch() {
+  if (write_batch_.empty()) {
+    return;
+  }
+
+  scoped_ptr<WriteBatch> batch(new WriteBatch());
+  batch->swap(write_batch_);
+  write_batch_bytes_ = 0;
+
+  pending_files_ops_++;
+  FileBatchWrite(batch.Pass());
 }
 
-void Fetcher::FileOpen() {
+void Fetcher::FileOpen(int64 expected_bytes) {
   if (!pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread()) {
     pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Fetcher::FileOpen, this));
+        base::Bind(&Fetcher::FileOpen, this, expected_bytes));
     return;
   }
 
   DCHECK(output_file_ == NULL);
   if (output_file_ == NULL) {
     output_file_.reset(new base::File());
-    output_file_->InitializeUnsafe(output_path_,
-        base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+    if (output_offset_ >= 0) {
+      // Write into a region of a file that someone else owns.
+      output_file_->InitializeUnsafe(output_path_,
+          base::File::FLAG_OPEN | base::File::FLAG_WRITE);
+      if (output_file_->IsValid() &&
+          (output_file_->Seek(base::File::FROM_BEGIN, output_offset_) !=
+           output_offset_)) {
+        output_file_->Close();
+      }
+    } else if (resume_offset_ > 0) {
+      // Append to the partial download, dropping anything past the offset.
+      output_file_->InitializeUnsafe(output_path_,
+          base::File::FLAG_OPEN | base::File::FLAG_WRITE);
+      if (output_file_->IsValid() &&
+          (!output_file_->SetLength(resume_offset_) ||
+           (output_file_->Seek(base::File::FROM_BEGIN, resume_offset_) !=
+            resume_offset_))) {
+        output_file_->Close();
+      }
+    } else {
+      output_file_->InitializeUnsafe(output_path_,
+          base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+    }
+    if (resumable_ && output_file_->IsValid()) {
+      FileWriteResumeState(resume_offset_);
+    }
     if (!output_file_->IsValid()) {
       LOG(ERROR) << "Error creating: " << output_path_.value() << " : "
                  << output_file_->ErrorToString(output_file_->error_details());
     }
+#if defined(OS_LINUX)
+    if (output_file_->IsValid() && (expected_bytes > 0) &&
+        (output_offset_ < 0)) {
+      // Reserve the blocks up front, to limit fragmentation.  The file keeps
+      // its size, in case the body is shorter than expected.
+      if ((HANDLE_EINTR(fallocate(output_file_->GetPlatformFile(),
+              FALLOC_FL_KEEP_SIZE, 0, expected_bytes)) != 0) &&
+          (pool_->log_level() > 0)) {
+        PLOG(WARNING) << "Failed to preallocate: " << output_path_.value();
+      }
+    }
+#endif
   }
   OnFileOpened(output_file_->IsValid());
 }
 
 void Fetcher::OnFileOpened(bool success) {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::OnFileOpened, this, success));
     return;
   }
@@ -646,30 +1432,77 @@ void Fetcher::OnFileOpened(bool success) {
   FileCompleteOp();
 }
 
-void Fetcher::FileChunkWrite(scoped_refptr<net::IOBuffer> buffer,
-    int length) {
+void Fetcher::FileBatchWrite(scoped_ptr<WriteBatch> batch) {
   if (!pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread()) {
     pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Fetcher::FileChunkWrite, this, buffer, length));
+        base::Bind(&Fetcher::FileBatchWrite, this, base::Passed(&batch)));
     return;
   }
 
+  int length = 0;
+  for (WriteBatch::const_iterator it = batch->begin(); it != batch->end();
+       ++it) {
+    length += it->second;
+  }
+
   int bytes_written = -1;
   if ((output_file_ != NULL) && output_file_->IsValid()) {
-    bytes_written = output_file_->WriteAtCurrentPos(buffer->data(), length);
-    if (bytes_written >= 0) {
-      DCHECK(bytes_written == length);
-      if (bytes_written != length) {
+#if defined(OS_POSIX)
+    std::vector<struct iovec> iov(batch->size());
+    for (size_t i = 0; i < batch->size(); i++) {
+      iov[i].iov_base = (*batch)[i].first->data();
+      iov[i].iov_len = (*batch)[i].second;
+    }
+    if (WriteVectorFully(output_file_->GetPlatformFile(), &iov[0],
+                         static_cast<int>(iov.size()))) {
+      bytes_written = length;
+    }
+#else
+    bytes_written = 0;
+    for (WriteBatch::const_iterator it = batch->begin();
+         (it != batch->end()) && (bytes_written >= 0); ++it) {
+      if (output_file_->WriteAtCurrentPos(it->first->data(), it->second) ==
+          it->second) {
+        bytes_written += it->second;
+      } else {
         bytes_written = -1;
       }
     }
+#endif
+  }
+
+  for (WriteBatch::iterator it = batch->begin(); it != batch->end(); ++it) {
+    pool_->read_buffers()->Recycle(it->first);
+    it->first = NULL;
+  }
+  OnFileChunkWritten(bytes_written);
+}
+
+void Fetcher::FileRopeWrite(scoped_refptr<RopeBuffer> rope) {
+  if (!pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::FileRopeWrite, this, rope));
+    return;
+  }
+
+  int bytes_written = 0;
+  size_t chunk_count = rope->chunk_count();
+  for (size_t i = 0; (i < chunk_count) && (bytes_written >= 0); i++) {
+    int length = 0;
+    const char* data = rope->chunk_data(i, &length);
+    if ((output_file_ != NULL) && output_file_->IsValid() &&
+        (output_file_->WriteAtCurrentPos(data, length) == length)) {
+      bytes_written += length;
+    } else {
+      bytes_written = -1;
+    }
   }
   OnFileChunkWritten(bytes_written);
 }
 
 void Fetcher::OnFileChunkWritten(int bytes_written) {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::OnFileChunkWritten, this, bytes_written));
     return;
   }
@@ -687,6 +1520,12 @@ void Fetcher::FileCompleteOp() {
     pending_files_ops_--;
     if (pending_files_ops_ == 0) {
 // TODO: delete the file if the HTTP connection failed too!
+      if (resumable_) {
+        // Only an incomplete download is worth resuming.
+        resume_finished_ = (request_ != NULL) &&
+            request_->status().is_success() &&
+            ((expected_bytes_ <= 0) || (received_bytes_ == expected_bytes_));
+      }
       FileClose(output_failure_);
     }
   }
@@ -700,21 +1539,160 @@ void Fetcher::FileClose(bool remove) {
   }
 
   if ((output_file_ != NULL) && output_file_->IsValid()) {
+    int64 length = output_file_->GetLength();
     output_file_->Close();
 
-    if (remove && !output_path_.empty()) {
+    if (remove && !output_path_.empty() && (output_offset_ < 0)) {
       if (!base::DeleteFile(output_path_, false)) {
         LOG(ERROR) << "Failed to cleanup file: " << output_path_.value();
       }
     }
+
+    if (resumable_) {
+      if (remove || resume_finished_ || (length < 0)) {
+        base::DeleteFile(GetResumeStatePath(), false);
+      } else {
+        FileWriteResumeState(length);
+      }
+    }
   }
 
   OnFileClosed();
 }
 
+base::FilePath Fetcher::GetResumeStatePath() const {
+  return output_path_.AddExtension(FILE_PATH_LITERAL("resume"));
+}
+
+// The resume state is a sidecar next to the output file, with one value
+// per line: the bytes in the partial file, the ETag and the Last-Modified
+// date of the response.
+void Fetcher::FileReadResumeState() {
+  if (!pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::FileReadResumeState, this));
+    return;
+  }
+
+  int64 offset = 0;
+  std::string etag;
+  std::string last_modified;
+
+  std::string contents;
+  std::vector<std::string> lines;
+  int64 file_size = 0;
+  if (base::ReadFileToString(GetResumeStatePath(), &contents) &&
+      base::GetFileSize(output_path_, &file_size)) {
+    base::SplitString(contents, '\n', &lines);
+    int64 bytes = 0;
+    if ((lines.size() >= 3) && base::StringToInt64(lines[0], &bytes) &&
+        (bytes > 0) && (file_size >= bytes)) {
+      // Bytes past the recorded count were also written in order, so the
+      // whole file is usable.
+      offset = file_size;
+      etag = lines[1];
+      last_modified = lines[2];
+    }
+  }
+
+  OnResumeStateRead(offset, etag, last_modified);
+}
+
+void Fetcher::OnResumeStateRead(int64 offset, const std::string& etag,
+    const std::string& last_modified) {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Fetcher::OnResumeStateRead, this, offset, etag,
+                   last_modified));
+    return;
+  }
+
+  if (!receive_completed_.is_null()) {
+    // We were cancelled.
+    return;
+  }
+
+  if (!etag.empty() || !last_modified.empty()) {
+    resume_offset_ = offset;
+    resume_etag_ = etag;
+    resume_last_modified_ = last_modified;
+  }
+  StartRequest();
+}
+
+bool Fetcher::PrepareResume() {
+  scoped_refptr<net::HttpResponseHeaders> headers =
+      request_->response_headers();
+  int response_code = request_->GetResponseCode();
+  if ((resume_offset_ > 0) && (response_code != 206) &&
+      (response_code != 200)) {
+    // Not a body that we can use, such as an error page, so leave the
+    // partial file and its state for a later attempt.
+    if (pool_->log_level() > 0) {
+      LOG(ERROR) << "Can't resume <" << request_->url() << ">: "
+                 << response_code;
+    }
+    return false;
+  }
+
+  if ((resume_offset_ > 0) && (response_code == 206)) {
+    int64 first_byte = -1;
+    int64 last_byte = -1;
+    int64 length = -1;
+    if ((headers.get() == NULL) ||
+        !headers->GetContentRange(&first_byte, &last_byte, &length) ||
+        (first_byte != resume_offset_)) {
+      // We can't append this range, so the next attempt starts over.
+      LOG(ERROR) << "Unexpected range for <" << request_->url() << ">";
+      pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+          base::Bind(base::IgnoreResult(&base::DeleteFile),
+                     GetResumeStatePath(), false));
+      return false;
+    }
+
+    // Report the progress of the whole file.
+    received_bytes_ = resume_offset_;
+    if (expected_bytes_ > 0) {
+      expected_bytes_ += resume_offset_;
+    }
+  } else {
+    // The server sent everything, such as when the file has changed.
+    resume_offset_ = 0;
+  }
+
+  // Remember the validators, for resuming a later attempt.  A weak ETag
+  // can't be used with If-Range.
+  resume_etag_.clear();
+  resume_last_modified_.clear();
+  if (headers.get() != NULL) {
+    headers->EnumerateHeader(NULL, "ETag", &resume_etag_);
+    headers->EnumerateHeader(NULL, "Last-Modified", &resume_last_modified_);
+    if (StartsWithASCII(resume_etag_, "W/", true)) {
+      resume_etag_.clear();
+    }
+  }
+  return true;
+}
+
+void Fetcher::FileWriteResumeState(int64 bytes) {
+  DCHECK(pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread());
+  if (resume_etag_.empty() && resume_last_modified_.empty()) {
+    // The server gave us nothing to validate a partial file with.
+    base::DeleteFile(GetResumeStatePath(), false);
+    return;
+  }
+
+  std::string contents = base::StringPrintf("%" PRId64 "\n%s\n%s\n", bytes,
+      resume_etag_.c_str(), resume_last_modified_.c_str());
+  if (base::WriteFile(GetResumeStatePath(), contents.data(),
+                      contents.size()) != (int)contents.size()) {
+    LOG(ERROR) << "Failed to save: " << GetResumeStatePath().value();
+  }
+}
+
 void Fetcher::OnFileClosed() {
-  if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Fetcher::OnFileClosed, this));
     return;
   }
@@ -730,6 +1708,14 @@ void Fetcher::ConvertTiming(CnetLoadTiming *cnet_timing,
   cnet_timing->socket_reused = net_timing.socket_reused;
   cnet_timing->socket_log_id = net_timing.socket_log_id;
 
+  // The time between Start() and the request actually starting, waiting
+  // for the pool's scheduler or for body memory.
+  unsigned waited_ms = 0;
+  if (!queued_.is_null() && request_started_ > queued_) {
+    base::TimeDelta delta = request_started_ - queued_;
+    waited_ms = delta.InMilliseconds();
+  }
+
   if (!request_started_.is_null() && receive_completed_ > request_started_) {
     base::TimeDelta delta = receive_completed_ - request_started_;
     cnet_timing->total_ms = delta.InMilliseconds();
@@ -810,6 +1796,8 @@ void Fetcher::ConvertTiming(CnetLoadTiming *cnet_timing,
   } else {
     cnet_timing->queued_ms = 0;
   }
+  cnet_timing->queued_ms += waited_ms;
+  cnet_timing->total_ms += waited_ms;
 
   cnet_timing->from_cache = request_->was_cached();
   cnet_timing->total_recv_bytes = request_->GetTotalReceivedBytes();
@@ -841,10 +1829,21 @@ void Fetcher::ConvertTiming(CnetLoadTiming *cnet_timing,
 }
 
 void Fetcher::FinishRequest() {
+  // Fetchers that start from now on send their own request.
+  if (!coalescing_key_.empty()) {
+    pool_->RemoveInFlightFetcher(shard_, coalescing_key_);
+    coalescing_key_.clear();
+  }
+
   scoped_ptr<net::HttpResponseInfo> response_info;
   scoped_refptr<net::HttpResponseHeaders> response_headers;
   scoped_ptr<CnetLoadTiming> cnet_timing(new CnetLoadTiming);
   net::URLRequestStatus status(net::URLRequestStatus::FAILED, net::ERR_FAILED);
+  if (start_cancelled_) {
+    // As though the request had been sent and cancelled.
+    status = net::URLRequestStatus(net::URLRequestStatus::CANCELED,
+        net::ERR_ABORTED);
+  }
   int http_response_code = -1;
   if (request_ != NULL) {
     if (!output_failure_) {
@@ -871,20 +1870,69 @@ void Fetcher::FinishRequest() {
     ConvertTiming(cnet_timing.get(), http_response_code, received_bytes_);
   }
 
+  // Report the progress that coalescing held back, ahead of the completion.
+  if (!upload_callback_.is_null()) {
+    bool report = false;
+    if ((request_ != NULL) && (request_->get_upload() != NULL)) {
+      net::UploadProgress progress = request_->GetUploadProgress();
+      report = upload_progress_->Update(progress.position(), progress.size(),
+          base::TimeTicks::Now());
+    }
+    if (report || upload_progress_->Flush()) {
+      RunCallback(base::Bind(&Fetcher::DeliverProgress, upload_callback_,
+          make_scoped_refptr(this), upload_progress_));
+    }
+  }
+  if (!download_callback_.is_null() && download_progress_->Flush()) {
+    RunCallback(base::Bind(&Fetcher::DeliverProgress, download_callback_,
+        make_scoped_refptr(this), download_progress_));
+  }
+
   // Ensure that we never invoke the completion again.
   CompletionCallback completion = completion_;
   completion_.Reset();
   download_callback_.Reset();
   upload_callback_.Reset();
+  data_callback_.Reset();
+
+  // The request is done with the upload body.
+  ReleaseUploadBuffer();
+
+  // A temporary file belongs to the response, even if it is incomplete.
+  base::FilePath body_file_path;
+  scoped_refptr<base::TaskRunner> temp_file_runner;
+  if (temporary_output_) {
+    body_file_path = output_path_;
+    temp_file_runner = pool_->GetFileTaskRunner();
+  } else if (!output_failure_) {
+    body_file_path = output_path_;
+  }
 
-  scoped_refptr<Response> response(new Response(initial_url_, gurl_,
-      request_ != NULL ? request_->url():gurl_, read_buffer_,
-      url_params_, cnet_timing.Pass(), status, http_response_code,
-      response_headers, response_info.Pass()));
+  scoped_refptr<Response> response;
+  if (leader_response_.get() != NULL) {
+    // Share the body of the leader's response.
+    response = new Response(initial_url_, gurl_, leader_response_);
+    leader_response_ = NULL;
+  } else {
+    if (!followers_.empty() && (body_buffer_.get() != NULL)) {
+      // Several responses read the body from now on.
+      body_buffer_->Share();
+    }
+    response = new Response(initial_url_, gurl_,
+        request_ != NULL ? request_->url():gurl_, body_buffer_,
+        body_file_path, temp_file_runner, url_params_, cnet_timing.Pass(),
+        status, http_response_code, response_headers, response_info.Pass());
+  }
   
   if (!completion.is_null()) {
-    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(completion, make_scoped_refptr(this), response));
+    RunCallback(base::Bind(completion, make_scoped_refptr(this), response));
+  }
+
+  // Complete the fetchers that waited for this request.
+  std::vector<scoped_refptr<Fetcher> > followers;
+  followers.swap(followers_);
+  for (size_t i = 0; i < followers.size(); i++) {
+    followers[i]->OnLeaderCompleted(response);
   }
 
   // Release pool resources.
@@ -4,6 +4,9 @@
 #ifndef YAHOO_CNET_CNET_FETCHER_H_
 #define YAHOO_CNET_CNET_FETCHER_H_
 
+#include <utility>
+#include <vector>
+
 #include "base/callback.h"
 #include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
@@ -12,15 +15,17 @@
 #include "net/url_request/url_request.h"
 #include "yahoo/cnet/cnet.h"
 #include "yahoo/cnet/cnet_headers.h"
+#include "yahoo/cnet/cnet_mime.h"
 #include "yahoo/cnet/cnet_url_params.h"
 
 namespace base {
 class File;
+class SingleThreadTaskRunner;
 }
 
 namespace net {
 class IOBuffer;
-class GrowableIOBuffer;
+class IOBufferWithSize;
 }
 
 
@@ -29,7 +34,9 @@ namespace cnet {
 class Fetcher;
 class OauthCredentials;
 class Pool;
+class ProgressCoalescer;
 class Response;
+class RopeBuffer;
 
 struct FetcherTraits {
   static void Destruct(const Fetcher* fetcher);
@@ -42,6 +49,10 @@ class Fetcher : public net::URLRequest::Delegate,
       scoped_refptr<Response> response)> CompletionCallback;
   typedef base::Callback<void(scoped_refptr<Fetcher> fetcher,
       int64_t current, int64_t total)> ProgressCallback;
+  typedef base::Callback<void(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<net::IOBuffer> buffer, int length)> DataCallback;
+  typedef base::Callback<int(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<net::IOBuffer> buffer, int length)> UploadReadCallback;
 
   Fetcher(scoped_refptr<Pool> pool, const std::string& url,
       const std::string& method, CompletionCallback completion,
@@ -77,18 +88,52 @@ class Fetcher : public net::URLRequest::Delegate,
     CACHE_DISABLE,
   };
 
+  enum UploadEncoding {
+    UPLOAD_IDENTITY = 0,
+    UPLOAD_GZIP,
+    UPLOAD_DEFLATE,
+  };
+
+  // The request's claim on sockets, and on bandwidth when it shares a
+  // connection with other requests.
+  enum Priority {
+    PRIORITY_IDLE = 0,
+    PRIORITY_LOWEST,
+    PRIORITY_LOW,
+    PRIORITY_MEDIUM,
+    PRIORITY_HIGHEST,
+  };
+
+  enum OverflowPolicy {
+    // Fail the request with ERR_FILE_TOO_BIG.
+    OVERFLOW_FAIL = 0,
+
+    // Keep the rest of the body in buffers that the fetcher allocates.
+    OVERFLOW_FALLBACK,
+  };
+
   void SetCacheBehavior(CacheBehavior behavior);
   void SetStopOnRedirect(bool stop_on_redirect);
 
+  // This may also change the priority of a request that has started.
+  void SetPriority(Priority priority);
+
   void SetHeader(const std::string& key, const std::string& value);
 
   void SetOauthCredentials(const OauthCredentials& credentials);
   void SetUrlParamsEncoding(UrlParamsEncoding encoding);
   void SetUrlParam(const std::string& key, const std::string& value);
+
+  // Add a file, or a range of it, to the multi-part form.  Each call adds
+  // another part.
   void SetUrlParamFile(
       const std::string& key, const std::string& filename,
       const std::string& content_type, const base::FilePath& file_path,
       uint64 range_offset, uint64 range_length);
+  // Add bytes to the multi-part form, as if they were the contents of a file.
+  void SetUrlParamBytes(
+      const std::string& key, const std::string& filename,
+      const std::string& content_type, const std::string& bytes);
 
   void SetUploadBody(const std::string& content_type, const std::string& body);
 
@@ -96,16 +141,94 @@ class Fetcher : public net::URLRequest::Delegate,
       const base::FilePath& file_path,
       uint64 range_offset, uint64 range_length);
 
+  // Upload |length| bytes at |data| without copying them.  The caller keeps
+  // the memory valid until |release| runs on the work thread, once the
+  // fetcher no longer needs it.
+  void SetUploadBuffer(const std::string& content_type, const char* data,
+      int64 length, const base::Closure& release);
+
+  // Pull the upload body from |callback| on the work thread as the request
+  // sends it.  The callback fills the buffer with up to |length| bytes, and
+  // returns the number of bytes, 0 at the end of the body, or a negative net
+  // error.  If |length| is negative, then it is sent with chunked encoding.
+  void SetUploadCallback(const std::string& content_type, int64 length,
+      UploadReadCallback callback);
+
+  // Compress the upload body as it's sent, and label it with the
+  // Content-Encoding.  The compressed body is sent with chunked encoding,
+  // so the server must accept it.
+  void SetUploadEncoding(UploadEncoding encoding);
+
   void SetOutputFilePath(const base::FilePath& file_path);
 
+  // Write the body into an existing file at |offset|, without truncating or
+  // removing the file, such as for one range of a segmented download.
+  void SetOutputFileRegion(const base::FilePath& file_path, int64 offset);
+
+  // Read the body directly into |data|, which the caller owns and must keep
+  // valid until the response is released.  The response's body then points
+  // into |data|, unless the body exceeds |capacity|, which |policy| handles.
+  void SetOutputBuffer(char* data, int capacity, OverflowPolicy policy);
+
+  // Make a download to the output file resumable.  A failed download keeps
+  // its partial file, plus a sidecar file with the response's validators,
+  // and the next attempt asks the server for only the remaining bytes.  If
+  // the server answers that attempt with neither the range nor the whole
+  // file, the attempt fails and the partial file is kept.
+  void SetResumable(bool resumable);
+
+  // Buffer the body in memory until it exceeds |bytes| (or its content
+  // length does), and then move it to a temporary file, which the response
+  // reports.  If 0, the body is never moved.
+  void SetSpillThreshold(int64 bytes);
+
+  // Deliver the body to |callback| on the work thread as it arrives, instead
+  // of retaining it in the response or a file.  If |max_unacked_chunks| is
+  // positive, then the fetcher stops reading from the network once that many
+  // chunks are delivered but not yet acknowledged with AckData().
+  void SetDataCallback(DataCallback callback, int max_unacked_chunks);
+  void AckData();
+
   void SetMinSpeed(double bytes_sec, double duration_secs);
 
+  // Move a body that is buffered in memory to a temporary file, and write
+  // the rest of it there.  The pool uses this when it is over its memory
+  // budget.
+  void SpillBody();
+
+  // Run the callbacks on the same work thread as those of every other
+  // fetcher with the same |tag|, so that they also run in order with each
+  // other.  By default, only this fetcher's own callbacks are ordered.
+  void SetCallbackOrderTag(int tag);
+
+  // Run the callbacks on the pool's work thread |index|.  Objects that own
+  // several fetchers keep all of their callbacks on one thread with this.
+  void SetWorkThread(size_t index);
+
+  // Run the completion, progress and data callbacks, and the upload buffer's
+  // release, directly on the network thread, instead of posting them to a
+  // work thread.  They keep their order, so the completion still runs
+  // after the last chunk and after the release.  This saves a thread hop
+  // per callback, but the callbacks then hold up every request on the
+  // thread: they must be quick and must never block, such as by waiting on
+  // a lock that another thread holds for long, or doing any I/O.  A
+  // Cancel() from an inline callback takes effect after it returns.  Debug
+  // builds warn about inline callbacks that run over a small time budget.
+  void SetInlineCallbacks(bool inline_callbacks);
+
   void set_user_data(void* user_data) { user_data_ = user_data; }
   void* get_user_data() { return user_data_; }
 
   void Start();
   void Cancel();
 
+  // Stop reading the body, so that flow control throttles the server, and
+  // later continue where it left off.  A fetcher paused before its response
+  // arrives still receives the headers.  One that other fetchers follow
+  // keeps reading for them.
+  void Pause();
+  void Resume();
+
   scoped_refptr<Pool> pool() { return pool_; }
   const std::string& initial_url() { return initial_url_; }
 
@@ -121,19 +244,77 @@ class Fetcher : public net::URLRequest::Delegate,
       int bytes_read) override;
 
  private:
+  // The network thread of the pool's shard for the URL's host.
+  scoped_refptr<base::SingleThreadTaskRunner> GetNetworkTaskRunner() const;
+  // The pool's work thread that runs all of this fetcher's callbacks.
+  scoped_refptr<base::SingleThreadTaskRunner> GetWorkTaskRunner() const;
+  // Run a callback on the work thread, or inline.
+  void RunCallback(const base::Closure& callback);
+
   bool BuildRequest();
+  void StartRequest();
+  // Stay alive, and hold the pool's resources, until FinishRequest().
+  void ClaimPoolResources();
+  // Complete as cancelled, without sending the request.
+  void CancelUnstarted();
+
+  // Coalescing with identical requests in flight.  The fetcher that runs the
+  // request leads the others, which follow it to its response.
+  bool IsCoalescable() const;
+  std::string GetCoalescingKey() const;
+  bool FollowInFlightFetcher();
+  void RemoveFollower(scoped_refptr<Fetcher> follower);
+  void HandOffFollowers();
+  void OnLeaderCompleted(scoped_refptr<Response> response);
+
+  void FileReadResumeState();
+  void OnResumeStateRead(int64 offset, const std::string& etag,
+      const std::string& last_modified);
+  bool PrepareResume();
+  void FileWriteResumeState(int64 bytes);
+  base::FilePath GetResumeStatePath() const;
 
   void OnUploadProgressTimer();
+  void StartMinSpeedTimer();
   void OnMinSpeedTimer();
 
+  bool IsPaused() const { return paused_ && followers_.empty(); }
+  void ResumeRead();
+
   void ReadIntoBufferStart();
   void ReadIntoBufferComplete(int bytes_read);
+  void OnBodyMemoryAvailable();
+  void SpillBodyToFile();
 
-  void FileOpen();
+  void AddMultipartPart(const mime::MultipartPart& part);
+  void ReleaseUploadBuffer();
+
+  void ReadUploadCallback(scoped_refptr<net::IOBuffer> buffer, int length,
+      const base::Callback<void(int)>& done);
+  static void RunUploadCallback(UploadReadCallback callback,
+      scoped_refptr<Fetcher> fetcher, scoped_refptr<net::IOBuffer> buffer,
+      int length, const base::Callback<void(int)>& done);
+
+  // Give back a read buffer that no data was read into.
+  void RecycleReadBuffer(scoped_refptr<net::IOBufferWithSize>* buffer);
+
+  void ReadIntoStreamStart();
+  void ReadIntoStreamComplete(int bytes_read);
+  static void DeliverData(DataCallback callback,
+      scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<net::IOBufferWithSize> buffer, int length);
+
+  // Reads waiting to be written to the output file, with their lengths.
+  typedef std::vector<std::pair<scoped_refptr<net::IOBufferWithSize>, int> >
+      WriteBatch;
+
+  void FileOpen(int64 expected_bytes);
   void OnFileOpened(bool success);
   void ReadIntoFileStart();
   void ReadIntoFileComplete(int bytes_read);
-  void FileChunkWrite(scoped_refptr<net::IOBuffer> buffer, int length);
+  void FlushWriteBatch();
+  void FileBatchWrite(scoped_ptr<WriteBatch> batch);
+  void FileRopeWrite(scoped_refptr<RopeBuffer> rope);
   void OnFileChunkWritten(int bytes_written);
   void FileCompleteOp();
   void FileClose(bool remove);
@@ -142,7 +323,11 @@ class Fetcher : public net::URLRequest::Delegate,
   void ConvertTiming(CnetLoadTiming *cnet_timing,
       int http_response_code, int64 content_len);
 
+  void DidReceiveBytes(int bytes_read);
   void OnDownloadProgress(int64 progress, int64 expected);
+  static void DeliverProgress(ProgressCallback callback,
+      scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<ProgressCoalescer> progress);
   void OnRequestComplete();
   void FinishRequest();
 
@@ -153,28 +338,48 @@ class Fetcher : public net::URLRequest::Delegate,
 
   std::string initial_url_;
   GURL gurl_;
+  size_t shard_;
+  size_t work_thread_;
   std::string method_;
   CacheBehavior cache_behavior_;
   bool stop_on_redirect_;
+  net::RequestPriority priority_;
+  // Whether Start() has asked the pool's scheduler for a slot.
+  bool scheduled_;
+  // Cancelled before it sent a request of its own.
+  bool start_cancelled_;
+  // Whether Start() is waiting for the pool to have room for the body.
+  bool start_waiting_for_memory_;
+  bool claimed_pool_resources_;
   Headers headers_;
   UrlParamsEncoding params_encoding_;
   scoped_ptr<OauthCredentials> oauth_credentials_;
   UrlParams url_params_;
   std::string upload_body_;
-  std::string upload_body_terminator_;
   std::string upload_content_type_;
 
-  std::string upload_filename_;
-  std::string upload_param_key_;
+  mime::MultipartParts multipart_parts_;
   base::FilePath upload_file_path_;
   uint64 upload_range_offset_;
   uint64 upload_range_length_;
+  const char* upload_buffer_data_;
+  int64 upload_buffer_length_;
+  base::Closure upload_buffer_release_;
+  UploadReadCallback upload_read_callback_;
+  int64 upload_callback_length_;
+  UploadEncoding upload_encoding_;
 
   CompletionCallback completion_;
   ProgressCallback download_callback_;
   ProgressCallback upload_callback_;
+  DataCallback data_callback_;
+  scoped_refptr<ProgressCoalescer> download_progress_;
+  scoped_refptr<ProgressCoalescer> upload_progress_;
+  bool inline_callbacks_;
+  bool in_inline_callback_;
 
   scoped_ptr<base::RepeatingTimer<Fetcher> > upload_progress_timer_;
+  base::TimeTicks queued_;
   base::TimeTicks request_started_;
   base::TimeTicks receive_started_;
   base::TimeTicks receive_completed_;
@@ -184,10 +389,34 @@ class Fetcher : public net::URLRequest::Delegate,
   int64 expected_bytes_;
   int64 received_bytes_;
   base::FilePath output_path_;
+  bool temporary_output_;
+  int64 output_offset_;
+  bool resumable_;
+  int64 resume_offset_;
+  std::string resume_etag_;
+  std::string resume_last_modified_;
+  bool resume_finished_;
   scoped_ptr<base::File> output_file_;
   int pending_files_ops_;
   bool output_failure_;
-  scoped_refptr<net::GrowableIOBuffer> read_buffer_;
+  scoped_refptr<net::IOBufferWithSize> read_buffer_;
+  WriteBatch write_batch_;
+  int write_batch_bytes_;
+  scoped_refptr<RopeBuffer> body_buffer_;
+  bool body_read_deferred_;
+  bool spill_requested_;
+  int64 spill_threshold_;
+  char* output_buffer_data_;
+  int output_buffer_capacity_;
+  OverflowPolicy output_buffer_policy_;
+  scoped_refptr<net::IOBufferWithSize> stream_buffer_;
+  int max_unacked_chunks_;
+  int unacked_chunks_;
+  bool stream_read_deferred_;
+
+  bool paused_;
+  // The read to continue with once resumed.
+  base::Closure paused_read_;
 
   scoped_ptr<base::RepeatingTimer<Fetcher> > min_speed_timer_;
   double min_speed_bytes_sec_;
@@ -195,6 +424,13 @@ class Fetcher : public net::URLRequest::Delegate,
   int64 last_progress_bytes_;
   double last_bytes_sec_;
 
+  // Set while leading a coalesced request.
+  std::string coalescing_key_;
+  std::vector<scoped_refptr<Fetcher> > followers_;
+  // Set while following another fetcher's request.
+  scoped_refptr<Fetcher> leader_;
+  scoped_refptr<Response> leader_response_;
+
   void* user_data_;
 
   virtual ~Fetcher();
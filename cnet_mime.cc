@@ -5,12 +5,37 @@
 #include "yahoo/cnet/cnet_mime.h"
 
 #include "base/logging.h"
+#include "base/memory/scoped_vector.h"
 #include "base/rand_util.h"
 #include "base/strings/stringprintf.h"
+#include "base/time/time.h"
+#include "net/base/elements_upload_data_stream.h"
+#include "net/base/upload_bytes_element_reader.h"
+#include "net/base/upload_file_element_reader.h"
+
+namespace {
+
+void AppendOwnedBytesReader(std::string* bytes,
+    ScopedVector<net::UploadElementReader>* readers) {
+  if (!bytes->empty()) {
+    std::vector<char> owned(bytes->begin(), bytes->end());
+    readers->push_back(new net::UploadOwnedBytesElementReader(&owned));
+    bytes->clear();
+  }
+}
+
+} // namespace
 
 namespace cnet {
 namespace mime {
 
+MultipartPart::MultipartPart()
+    : range_offset(0), range_length(kuint64max) {
+}
+
+MultipartPart::~MultipartPart() {
+}
+
 std::string GenerateMimeBoundary() {
   std::string mime_boundary;
   int r1 = base::RandInt(0, kint32max);
@@ -61,6 +86,41 @@ void AddMultipartFinalDelimiterForPost(const std::string& mime_boundary,
   post_data->append("--" + mime_boundary + "--\r\n");
 }
 
+scoped_ptr<net::UploadDataStream> CreateMultipartUploadStream(
+    const UrlParams& values, const MultipartParts& parts,
+    const std::string& mime_boundary, base::TaskRunner* file_task_runner) {
+  ScopedVector<net::UploadElementReader> readers;
+
+  // Coalesce the framing between the parts' contents into single readers.
+  std::string framing;
+  for (UrlParams::const_iterator it = values.begin(); it != values.end();
+       ++it) {
+    AddMultipartValueForPost(it->first, it->second, mime_boundary, &framing);
+  }
+  for (MultipartParts::const_iterator it = parts.begin(); it != parts.end();
+       ++it) {
+    StartMultipartValueForPost(it->name, "filename", it->filename,
+        it->content_type, mime_boundary, &framing);
+    if (it->file_path.empty()) {
+      if (!it->bytes.empty()) {
+        AppendOwnedBytesReader(&framing, &readers);
+        readers.push_back(new net::UploadBytesElementReader(
+            it->bytes.data(), it->bytes.size()));
+      }
+    } else {
+      AppendOwnedBytesReader(&framing, &readers);
+      readers.push_back(new net::UploadFileElementReader(file_task_runner,
+          it->file_path, it->range_offset, it->range_length, base::Time()));
+    }
+    FinishMultipartValueForPost(&framing);
+  }
+  AddMultipartFinalDelimiterForPost(mime_boundary, &framing);
+  AppendOwnedBytesReader(&framing, &readers);
+
+  return scoped_ptr<net::UploadDataStream>(
+      new net::ElementsUploadDataStream(readers.Pass(), 0));
+}
+
 } // namespace mime
 } // namespace cnet
 
@@ -6,10 +6,40 @@
 #define YAHOO_CNET_CNET_MIME_H_
 
 #include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/files/file_path.h"
+#include "base/memory/scoped_ptr.h"
+#include "yahoo/cnet/cnet_url_params.h"
+
+namespace base {
+class TaskRunner;
+}
+
+namespace net {
+class UploadDataStream;
+}
 
 namespace cnet {
 namespace mime {
 
+// A part of a multi-part form, beyond the simple values: its content is
+// either bytes in memory, or a range of a file.
+struct MultipartPart {
+  MultipartPart();
+  ~MultipartPart();
+
+  std::string name;
+  std::string filename;
+  std::string content_type;
+  std::string bytes;
+  base::FilePath file_path;
+  uint64 range_offset;
+  uint64 range_length;
+};
+typedef std::vector<MultipartPart> MultipartParts;
+
 std::string GenerateMimeBoundary();
 void AddMultipartValueForPost(const std::string& value_name,
     const std::string& value, const std::string& mime_boundary,
@@ -22,6 +52,15 @@ void FinishMultipartValueForPost(std::string* post_data);
 void AddMultipartFinalDelimiterForPost(const std::string& mime_boundary,
     std::string* post_data);
 
+// Create the body of a multi-part form with |values| followed by |parts|,
+// which the stream reads in place, so they must outlive it.  Files are read
+// on |file_task_runner|.  The stream's size (and thus the Content-Length)
+// comes from the sizes of the files when it's initialized, without reading
+// them ahead of sending.
+scoped_ptr<net::UploadDataStream> CreateMultipartUploadStream(
+    const UrlParams& values, const MultipartParts& parts,
+    const std::string& mime_boundary, base::TaskRunner* file_task_runner);
+
 } // namespace mime
 } // namespace cnet
 
@@ -0,0 +1,496 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_parallel_upload.h"
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
+#include "net/base/escape.h"
+#include "net/http/http_response_headers.h"
+#include "url/gurl.h"
+#include "yahoo/cnet/cnet_pool.h"
+#include "yahoo/cnet/cnet_response.h"
+
+namespace {
+
+const int64 kDefaultPartSize = 8 * 1024 * 1024;
+const int kDefaultMaxPartRetries = 3;
+
+// S3 allows at most 10000 parts; the part size grows to stay within that.
+const int64 kMaxParts = 10000;
+
+// The pause before resending a part grows with each attempt.
+const int kPartRetryDelayMs = 1000;
+
+bool IsHttpSuccess(scoped_refptr<cnet::Response> response) {
+  int code = response->http_response_code();
+  return response->status().is_success() && (code >= 200) && (code < 300);
+}
+
+std::string ResponseBody(scoped_refptr<cnet::Response> response) {
+  if (response->response_body() == NULL) {
+    return std::string();
+  }
+  return std::string(response->response_body(), response->response_length());
+}
+
+// Extract the text of the first |tag| element in |xml|.
+bool FindXmlElement(const std::string& xml, const std::string& tag,
+    std::string* value) {
+  std::string open_tag = "<" + tag + ">";
+  size_t start = xml.find(open_tag);
+  if (start == std::string::npos) {
+    return false;
+  }
+  start += open_tag.size();
+  size_t end = xml.find("</" + tag + ">", start);
+  if (end == std::string::npos) {
+    return false;
+  }
+  value->assign(xml, start, end - start);
+  return true;
+}
+
+} // namespace
+
+namespace cnet {
+
+ParallelUpload::Part::Part() : number(0), offset(0), length(0) {
+}
+
+ParallelUpload::Part::~Part() {
+}
+
+ParallelUpload::Request::Request() {
+}
+
+ParallelUpload::Request::~Request() {
+}
+
+ParallelUpload::PartState::PartState()
+    : attempts(0), sent_bytes(0), done(false) {
+}
+
+ParallelUpload::PartState::~PartState() {
+}
+
+ParallelUpload::ParallelUpload(scoped_refptr<Pool> pool,
+    scoped_refptr<Protocol> protocol, const base::FilePath& file_path,
+    const std::string& content_type, int max_parallel_parts,
+    CompletionCallback completion, ProgressCallback progress)
+    : pool_(pool), protocol_(protocol), file_path_(file_path),
+      content_type_(content_type), max_parallel_parts_(max_parallel_parts),
+      part_size_(kDefaultPartSize), max_part_retries_(kDefaultMaxPartRetries),
+      completion_(completion), progress_(progress), started_(false),
+      cancelled_(false), succeeded_(false), total_bytes_(0), next_part_(0),
+      active_parts_(0), finished_parts_(0), user_data_(NULL) {
+  if (max_parallel_parts_ < 1) {
+    max_parallel_parts_ = 1;
+  }
+}
+
+ParallelUpload::~ParallelUpload() {
+}
+
+void ParallelUpload::SetHeader(const std::string& key,
+    const std::string& value) {
+  headers_[key] = value;
+}
+
+void ParallelUpload::SetPartSize(int64 bytes) {
+  part_size_ = (bytes > 0) ? bytes:kDefaultPartSize;
+}
+
+void ParallelUpload::SetMaxPartRetries(int retries) {
+  max_part_retries_ = (retries > 0) ? retries:0;
+}
+
+scoped_refptr<Fetcher> ParallelUpload::CreateFetcher(const Request& request,
+    Fetcher::CompletionCallback completion, Fetcher::ProgressCallback upload) {
+  scoped_refptr<Fetcher> fetcher(new Fetcher(pool_, request.url,
+      request.method, completion, Fetcher::ProgressCallback(), upload));
+  // Our state lives on the first work thread.
+  fetcher->SetWorkThread(0);
+  fetcher->SetCacheBehavior(Fetcher::CACHE_DISABLE);
+  for (Headers::const_iterator it = headers_.begin(); it != headers_.end();
+       ++it) {
+    fetcher->SetHeader(it->first, it->second);
+  }
+  for (Headers::const_iterator it = request.headers.begin();
+       it != request.headers.end(); ++it) {
+    fetcher->SetHeader(it->first, it->second);
+  }
+  if (!request.body.empty()) {
+    fetcher->SetUploadBody(request.content_type, request.body);
+  }
+  fetcher->set_user_data(user_data_);
+  return fetcher;
+}
+
+void ParallelUpload::Start() {
+  if (!pool_->GetWorkTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&ParallelUpload::Start, this));
+    return;
+  }
+
+  if (started_) {
+    return;
+  }
+  started_ = true;
+
+  if (cancelled_) {
+    Finish(NULL);
+    return;
+  }
+
+  pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&ParallelUpload::FileGetSize, this));
+}
+
+void ParallelUpload::Cancel() {
+  if (!pool_->GetWorkTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&ParallelUpload::Cancel, this));
+    return;
+  }
+
+  if (cancelled_) {
+    return;
+  }
+  cancelled_ = true;
+
+  // Each fetcher still runs its completion, which finishes the upload.  A
+  // part waiting to be retried gives up instead.
+  if (control_fetcher_.get() != NULL) {
+    control_fetcher_->Cancel();
+  }
+  for (size_t i = 0; i < part_states_.size(); i++) {
+    if (part_states_[i].fetcher.get() != NULL) {
+      part_states_[i].fetcher->Cancel();
+    }
+  }
+}
+
+void ParallelUpload::FileGetSize() {
+  int64 size = 0;
+  bool success = base::GetFileSize(file_path_, &size);
+  if (!success && (pool_->log_level() > 0)) {
+    LOG(ERROR) << "Failed to read upload file: " << file_path_.value();
+  }
+
+  pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&ParallelUpload::OnFileSize, this, success, size));
+}
+
+void ParallelUpload::OnFileSize(bool success, int64 size) {
+  if (cancelled_ || !success) {
+    Finish(NULL);
+    return;
+  }
+
+  total_bytes_ = size;
+  int64 part_size = part_size_;
+  if ((size + part_size - 1) / part_size > kMaxParts) {
+    part_size = (size + kMaxParts - 1) / kMaxParts;
+  }
+
+  // An empty file is still sent as one (empty) part.
+  int64 offset = 0;
+  do {
+    Part part;
+    part.number = static_cast<int>(parts_.size()) + 1;
+    part.offset = offset;
+    part.length = std::min(part_size, size - offset);
+    parts_.push_back(part);
+    offset += part.length;
+  } while (offset < size);
+  part_states_.resize(parts_.size());
+
+  Request request;
+  if (protocol_->GetInitiateRequest(&request)) {
+    control_fetcher_ = CreateFetcher(request,
+        base::Bind(&ParallelUpload::OnInitiateComplete, this),
+        Fetcher::ProgressCallback());
+    control_fetcher_->Start();
+  } else {
+    StartParts();
+  }
+}
+
+void ParallelUpload::OnInitiateComplete(scoped_refptr<Fetcher> fetcher,
+    scoped_refptr<Response> response) {
+  control_fetcher_ = NULL;
+
+  bool initiated = protocol_->OnInitiated(response);
+  if (!initiated && (pool_->log_level() > 0)) {
+    LOG(ERROR) << "Failed to start upload of " << file_path_.value();
+  }
+  if (cancelled_ && initiated) {
+    // The server started the upload anyway, so have it discard the upload.
+    Abort(response);
+    return;
+  }
+  if (!initiated) {
+    Finish(response);
+    return;
+  }
+
+  StartParts();
+}
+
+void ParallelUpload::StartParts() {
+  while ((next_part_ < parts_.size()) &&
+         (active_parts_ < max_parallel_parts_)) {
+    active_parts_++;
+    StartPart(next_part_++);
+  }
+}
+
+void ParallelUpload::StartPart(size_t index) {
+  const Part& part = parts_[index];
+  PartState& state = part_states_[index];
+  state.attempts++;
+  state.sent_bytes = 0;
+
+  Request request;
+  protocol_->GetPartRequest(part, &request);
+  state.fetcher = CreateFetcher(request,
+      base::Bind(&ParallelUpload::OnPartComplete, this, index),
+      base::Bind(&ParallelUpload::OnPartProgress, this, index));
+  state.fetcher->SetUploadFilePath(
+      request.content_type.empty() ? content_type_:request.content_type,
+      file_path_, part.offset, part.length);
+  state.fetcher->Start();
+}
+
+void ParallelUpload::OnPartProgress(size_t index,
+    scoped_refptr<Fetcher> fetcher, int64_t current, int64_t total) {
+  PartState& state = part_states_[index];
+  if (fetcher.get() != state.fetcher.get()) {
+    // Left over from an attempt that failed.
+    return;
+  }
+  state.sent_bytes = current;
+  ReportProgress();
+}
+
+void ParallelUpload::OnPartComplete(size_t index,
+    scoped_refptr<Fetcher> fetcher, scoped_refptr<Response> response) {
+  PartState& state = part_states_[index];
+  state.fetcher = NULL;
+
+  if (cancelled_ || (failed_response_.get() != NULL)) {
+    if (failed_response_.get() == NULL) {
+      failed_response_ = response;
+    }
+  } else if (protocol_->OnPartUploaded(response, &parts_[index])) {
+    state.done = true;
+    state.sent_bytes = parts_[index].length;
+    finished_parts_++;
+    ReportProgress();
+  } else if (state.attempts <= max_part_retries_) {
+    if (pool_->log_level() > 0) {
+      LOG(ERROR) << "Retrying part " << parts_[index].number << " of "
+                 << file_path_.value();
+    }
+    state.sent_bytes = 0;
+    ReportProgress();
+
+    // The part keeps its slot while it waits.
+    pool_->GetWorkTaskRunner()->PostDelayedTask(FROM_HERE,
+        base::Bind(&ParallelUpload::RetryPart, this, index),
+        base::TimeDelta::FromMilliseconds(kPartRetryDelayMs * state.attempts));
+    return;
+  } else {
+    if (pool_->log_level() > 0) {
+      LOG(ERROR) << "Part " << parts_[index].number << " of "
+                 << file_path_.value() << " failed";
+    }
+    failed_response_ = response;
+
+    // Stop the rest of the parts.
+    for (size_t i = 0; i < part_states_.size(); i++) {
+      if (part_states_[i].fetcher.get() != NULL) {
+        part_states_[i].fetcher->Cancel();
+      }
+    }
+  }
+
+  active_parts_--;
+  if (!cancelled_ && (failed_response_.get() == NULL)) {
+    StartParts();
+  }
+  if (active_parts_ == 0) {
+    OnPartsFinished();
+  }
+}
+
+void ParallelUpload::RetryPart(size_t index) {
+  if (!cancelled_ && (failed_response_.get() == NULL)) {
+    StartPart(index);
+    return;
+  }
+
+  active_parts_--;
+  if (active_parts_ == 0) {
+    OnPartsFinished();
+  }
+}
+
+void ParallelUpload::ReportProgress() {
+  if (progress_.is_null()) {
+    return;
+  }
+
+  int64 sent = 0;
+  for (size_t i = 0; i < part_states_.size(); i++) {
+    sent += part_states_[i].sent_bytes;
+  }
+  progress_.Run(this, sent, total_bytes_);
+}
+
+void ParallelUpload::OnPartsFinished() {
+  // Wait for every part before discarding the upload.
+  if (cancelled_ || (failed_response_.get() != NULL)) {
+    Abort(failed_response_);
+    return;
+  }
+
+  DCHECK_EQ(static_cast<size_t>(finished_parts_), parts_.size());
+  Request request;
+  protocol_->GetCompleteRequest(parts_, &request);
+  control_fetcher_ = CreateFetcher(request,
+      base::Bind(&ParallelUpload::OnCompleteRequestComplete, this),
+      Fetcher::ProgressCallback());
+  control_fetcher_->Start();
+}
+
+void ParallelUpload::OnCompleteRequestComplete(
+    scoped_refptr<Fetcher> fetcher, scoped_refptr<Response> response) {
+  control_fetcher_ = NULL;
+
+  if (!cancelled_ && protocol_->OnCompleted(response)) {
+    succeeded_ = true;
+    Finish(response);
+  } else {
+    Abort(response);
+  }
+}
+
+void ParallelUpload::Abort(scoped_refptr<Response> response) {
+  Request request;
+  if (!protocol_->GetAbortRequest(&request)) {
+    Finish(response);
+    return;
+  }
+
+  // Report the failure itself, rather than the abort's response.
+  control_fetcher_ = CreateFetcher(request,
+      base::Bind(&ParallelUpload::OnAbortComplete, this, response),
+      Fetcher::ProgressCallback());
+  control_fetcher_->Start();
+}
+
+void ParallelUpload::OnAbortComplete(scoped_refptr<Response> failed_response,
+    scoped_refptr<Fetcher> fetcher, scoped_refptr<Response> response) {
+  control_fetcher_ = NULL;
+  Finish(failed_response);
+}
+
+void ParallelUpload::Finish(scoped_refptr<Response> response) {
+  // Ensure that we never invoke the completion again.
+  CompletionCallback completion = completion_;
+  completion_.Reset();
+  progress_.Reset();
+
+  part_states_.clear();
+  failed_response_ = NULL;
+
+  if (!completion.is_null()) {
+    completion.Run(this, response);
+  }
+}
+
+S3MultipartProtocol::S3MultipartProtocol(const std::string& url)
+    : url_(url) {
+}
+
+S3MultipartProtocol::~S3MultipartProtocol() {
+}
+
+std::string S3MultipartProtocol::UrlWithQuery(
+    const std::string& query) const {
+  GURL gurl(url_);
+  std::string full_query = gurl.has_query() ?
+      (gurl.query() + "&" + query):query;
+  GURL::Replacements replacements;
+  replacements.SetQueryStr(full_query);
+  return gurl.ReplaceComponents(replacements).spec();
+}
+
+bool S3MultipartProtocol::GetInitiateRequest(
+    ParallelUpload::Request* request) {
+  request->url = UrlWithQuery("uploads");
+  request->method = "POST";
+  return true;
+}
+
+bool S3MultipartProtocol::OnInitiated(scoped_refptr<Response> response) {
+  return IsHttpSuccess(response) &&
+      FindXmlElement(ResponseBody(response), "UploadId", &upload_id_) &&
+      !upload_id_.empty();
+}
+
+void S3MultipartProtocol::GetPartRequest(const ParallelUpload::Part& part,
+    ParallelUpload::Request* request) {
+  request->url = UrlWithQuery("partNumber=" + base::IntToString(part.number) +
+      "&uploadId=" + net::EscapeQueryParamValue(upload_id_, true));
+  request->method = "PUT";
+}
+
+bool S3MultipartProtocol::OnPartUploaded(scoped_refptr<Response> response,
+    ParallelUpload::Part* part) {
+  scoped_refptr<net::HttpResponseHeaders> headers =
+      response->response_headers();
+  return IsHttpSuccess(response) && (headers.get() != NULL) &&
+      headers->EnumerateHeader(NULL, "ETag", &part->receipt);
+}
+
+void S3MultipartProtocol::GetCompleteRequest(
+    const ParallelUpload::Parts& parts, ParallelUpload::Request* request) {
+  request->url = UrlWithQuery(
+      "uploadId=" + net::EscapeQueryParamValue(upload_id_, true));
+  request->method = "POST";
+  request->content_type = "application/xml";
+  request->body = "<CompleteMultipartUpload>";
+  for (size_t i = 0; i < parts.size(); i++) {
+    request->body += "<Part><PartNumber>" +
+        base::IntToString(parts[i].number) + "</PartNumber><ETag>" +
+        parts[i].receipt + "</ETag></Part>";
+  }
+  request->body += "</CompleteMultipartUpload>";
+}
+
+bool S3MultipartProtocol::OnCompleted(scoped_refptr<Response> response) {
+  // S3 may report a failure in the body of a 200 response.
+  return IsHttpSuccess(response) &&
+      (ResponseBody(response).find("<Error>") == std::string::npos);
+}
+
+bool S3MultipartProtocol::GetAbortRequest(ParallelUpload::Request* request) {
+  if (upload_id_.empty()) {
+    return false;
+  }
+  request->url = UrlWithQuery(
+      "uploadId=" + net::EscapeQueryParamValue(upload_id_, true));
+  request->method = "DELETE";
+  return true;
+}
+
+} // namespace cnet
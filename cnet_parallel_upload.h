@@ -0,0 +1,227 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_PARALLEL_UPLOAD_H_
+#define YAHOO_CNET_CNET_PARALLEL_UPLOAD_H_
+
+#include <string>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+#include "yahoo/cnet/cnet_headers.h"
+
+namespace cnet {
+
+class Pool;
+class Response;
+
+// Uploads a large file as parts over several connections at once.  It
+// starts the upload with one request, sends contiguous ranges of the file
+// in parallel, each with its own fetcher, and assembles them with a final
+// request.  A part that fails is retried on its own, so a network failure
+// doesn't restart the whole transfer.  If the upload fails, it is aborted,
+// which lets the server discard the parts.
+//
+// The requests are described by a Protocol, such as S3MultipartProtocol.
+// The callbacks run on the pool's work thread.  The completion receives the
+// response to the final request on success, or else the response of the
+// request that failed.
+class ParallelUpload : public base::RefCountedThreadSafe<ParallelUpload> {
+ public:
+  typedef base::Callback<void(scoped_refptr<ParallelUpload> upload,
+      scoped_refptr<Response> response)> CompletionCallback;
+  typedef base::Callback<void(scoped_refptr<ParallelUpload> upload,
+      int64_t current, int64_t total)> ProgressCallback;
+
+  struct Part {
+    Part();
+    ~Part();
+
+    // Numbered from 1.
+    int number;
+    int64 offset;
+    int64 length;
+
+    // What the server returned for the part, which the final request needs,
+    // such as its ETag.
+    std::string receipt;
+  };
+  typedef std::vector<Part> Parts;
+
+  struct Request {
+    Request();
+    ~Request();
+
+    std::string url;
+    std::string method;
+    Headers headers;
+    std::string content_type;
+    std::string body;
+  };
+
+  // Describes the requests of a multi-part upload, and interprets their
+  // responses.  It is only used on the work thread.
+  class Protocol : public base::RefCountedThreadSafe<Protocol> {
+   public:
+    // Describe the request that starts the upload.  Return false if the
+    // protocol doesn't need one.
+    virtual bool GetInitiateRequest(Request* request) = 0;
+    // Return false if the upload couldn't be started.
+    virtual bool OnInitiated(scoped_refptr<Response> response) = 0;
+
+    // Describe the request that sends |part|; the upload attaches the
+    // part's range of the file as the body.
+    virtual void GetPartRequest(const Part& part, Request* request) = 0;
+    // Return false if the part must be sent again, or else fill in its
+    // receipt.
+    virtual bool OnPartUploaded(scoped_refptr<Response> response,
+        Part* part) = 0;
+
+    // Describe the request that assembles the parts.
+    virtual void GetCompleteRequest(const Parts& parts,
+        Request* request) = 0;
+    virtual bool OnCompleted(scoped_refptr<Response> response) = 0;
+
+    // Describe the request that discards the parts of a failed upload.
+    // Return false if the protocol doesn't need one.
+    virtual bool GetAbortRequest(Request* request) = 0;
+
+   protected:
+    virtual ~Protocol() {}
+
+   private:
+    friend class base::RefCountedThreadSafe<Protocol>;
+  };
+
+  ParallelUpload(scoped_refptr<Pool> pool, scoped_refptr<Protocol> protocol,
+      const base::FilePath& file_path, const std::string& content_type,
+      int max_parallel_parts, CompletionCallback completion,
+      ProgressCallback progress);
+
+  // Add a header to every request of the upload.
+  void SetHeader(const std::string& key, const std::string& value);
+
+  // Split the file into parts of |bytes| each.  The protocol may need a
+  // minimum size for every part except the last.
+  void SetPartSize(int64 bytes);
+
+  // Send a failed part at most |retries| more times.
+  void SetMaxPartRetries(int retries);
+
+  void set_user_data(void* user_data) { user_data_ = user_data; }
+  void* get_user_data() { return user_data_; }
+
+  void Start();
+  void Cancel();
+
+  // Valid once the completion runs.
+  bool succeeded() const { return succeeded_; }
+  int part_count() const { return static_cast<int>(parts_.size()); }
+
+ private:
+  struct PartState {
+    PartState();
+    ~PartState();
+
+    scoped_refptr<Fetcher> fetcher;
+    int attempts;
+    int64 sent_bytes;
+    bool done;
+  };
+
+  scoped_refptr<Fetcher> CreateFetcher(const Request& request,
+      Fetcher::CompletionCallback completion,
+      Fetcher::ProgressCallback upload);
+
+  void FileGetSize();
+  void OnFileSize(bool success, int64 size);
+  void OnInitiateComplete(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+
+  void StartParts();
+  void StartPart(size_t index);
+  void OnPartProgress(size_t index, scoped_refptr<Fetcher> fetcher,
+      int64_t current, int64_t total);
+  void OnPartComplete(size_t index, scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+  void RetryPart(size_t index);
+  void ReportProgress();
+  void OnPartsFinished();
+
+  void OnCompleteRequestComplete(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+  void Abort(scoped_refptr<Response> response);
+  void OnAbortComplete(scoped_refptr<Response> failed_response,
+      scoped_refptr<Fetcher> fetcher, scoped_refptr<Response> response);
+  void Finish(scoped_refptr<Response> response);
+
+  scoped_refptr<Pool> pool_;
+  scoped_refptr<Protocol> protocol_;
+  base::FilePath file_path_;
+  std::string content_type_;
+  int max_parallel_parts_;
+  int64 part_size_;
+  int max_part_retries_;
+  Headers headers_;
+  CompletionCallback completion_;
+  ProgressCallback progress_;
+
+  // Only accessed on the work thread, once started.
+  bool started_;
+  bool cancelled_;
+  bool succeeded_;
+  scoped_refptr<Fetcher> control_fetcher_;
+  scoped_refptr<Response> failed_response_;
+  int64 total_bytes_;
+  Parts parts_;
+  std::vector<PartState> part_states_;
+  size_t next_part_;
+  int active_parts_;
+  int finished_parts_;
+
+  void* user_data_;
+
+  ~ParallelUpload();
+  friend class base::RefCountedThreadSafe<ParallelUpload>;
+  DISALLOW_COPY_AND_ASSIGN(ParallelUpload);
+};
+
+// The multi-part upload protocol of Amazon S3 and compatible services, for
+// the object at |url|.  Any signing of the requests is left to the caller's
+// headers.
+class S3MultipartProtocol : public ParallelUpload::Protocol {
+ public:
+  explicit S3MultipartProtocol(const std::string& url);
+
+  // Overrides for ParallelUpload::Protocol.
+  virtual bool GetInitiateRequest(ParallelUpload::Request* request) override;
+  virtual bool OnInitiated(scoped_refptr<Response> response) override;
+  virtual void GetPartRequest(const ParallelUpload::Part& part,
+      ParallelUpload::Request* request) override;
+  virtual bool OnPartUploaded(scoped_refptr<Response> response,
+      ParallelUpload::Part* part) override;
+  virtual void GetCompleteRequest(const ParallelUpload::Parts& parts,
+      ParallelUpload::Request* request) override;
+  virtual bool OnCompleted(scoped_refptr<Response> response) override;
+  virtual bool GetAbortRequest(ParallelUpload::Request* request) override;
+
+  const std::string& upload_id() const { return upload_id_; }
+
+ protected:
+  virtual ~S3MultipartProtocol();
+
+ private:
+  std::string UrlWithQuery(const std::string& query) const;
+
+  std::string url_;
+  std::string upload_id_;
+
+  DISALLOW_COPY_AND_ASSIGN(S3MultipartProtocol);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_PARALLEL_UPLOAD_H_
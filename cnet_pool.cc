@@ -11,13 +11,16 @@
 
 #include <algorithm>
 
+#include "base/files/file_util.h"
+#include "base/hash.h"
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
 #include "net/base/network_change_notifier.h"
 #include "net/http/http_network_session.h"
 #include "net/http/http_stream_factory.h"
 #include "net/http/http_transaction_factory.h"
 #include "net/proxy/proxy_service.h"
 #include "net/ssl/ssl_config.h"
-#include "net/ssl/ssl_config_service.h"
 #include "net/url_request/http_user_agent_settings.h"
 #include "net/url_request/url_request.h"
 #include "net/url_request/url_request_context.h"
@@ -25,74 +28,119 @@
 #include "yahoo/cnet/cnet_fetcher.h"
 #include "yahoo/cnet/cnet_network_delegate.h"
 #include "yahoo/cnet/cnet_proxy_service.h"
+#include "yahoo/cnet/cnet_read_buffer_pool.h"
+#include "yahoo/cnet/cnet_ssl_config_service.h"
 
 namespace cnet {
 
-class SSLConfigService : public net::SSLConfigService {
- public:
-  SSLConfigService(bool enable_ssl_false_start);
+namespace {
 
-  // Overrides from net::SSLConfigService:
-  virtual void GetSSLConfig(net::SSLConfig* config) override;
+// The size of the buffers that fetchers borrow for their reads.
+const int kReadBufferSize = 64*1024;
 
- private:
-  virtual ~SSLConfigService();
+const int64 kDefaultReadBufferPoolMaxBytes = 1024*1024;
 
-  net::SSLConfig config_;
+const int kDefaultFileWriteBatchBytes = 1024*1024;
+const int kMaxFileWriteBatchBytes = 64*1024*1024;
 
-  DISALLOW_COPY_AND_ASSIGN(SSLConfigService);
-};
-
-SSLConfigService::SSLConfigService(bool enable_ssl_false_start) {
-  config_.false_start_enabled = enable_ssl_false_start;
-  config_.require_forward_secrecy = true;
-
-  config_.version_min = std::max(
-      static_cast<uint16>(net::SSL_PROTOCOL_VERSION_TLS1),
-      net::kDefaultSSLVersionMin);
-  config_.version_max = net::kDefaultSSLVersionMax;
-}
-
-SSLConfigService::~SSLConfigService() {
-}
+scoped_refptr<Engine> GetOrCreateEngine(
+    scoped_refptr<base::SingleThreadTaskRunner> ui_runner,
+    const Pool::Config& config) {
+  if (config.engine.get() != NULL) {
+    return config.engine;
+  }
 
-void SSLConfigService::GetSSLConfig(net::SSLConfig *config) {
-  *config = config_;
+  Engine::Config engine_config;
+  engine_config.network_threads = config.network_threads;
+  engine_config.work_threads = config.work_threads;
+  return new Engine(ui_runner, engine_config);
 }
 
-
+} // namespace
 
 Pool::Config::Config()
-    : enable_spdy(false), enable_quic(false),
+    : network_threads(1), work_threads(1),
+      enable_spdy(false), enable_quic(false),
       enable_ssl_false_start(false), trust_all_cert_authorities(false),
       disable_system_proxy(false), cache_max_bytes(0),
+      read_buffer_pool_max_bytes(kDefaultReadBufferPoolMaxBytes),
+      file_write_batch_bytes(kDefaultFileWriteBatchBytes),
+      progress_interval_ms(0), progress_min_bytes(0),
+      max_requests(0), max_requests_per_host(0), coalesce_requests(false),
+      body_memory_budget(0), spill_bodies_over_budget(false),
       log_level(0) {
 }
 
 Pool::Config::~Config() {
 }
 
+Pool::Stats::Stats()
+    : read_buffer_hits(0), read_buffer_misses(0), read_buffer_idle_bytes(0),
+      body_memory_used_bytes(0), body_memory_waiters(0), body_spills(0),
+      requests_queued(0), coalesce_hits(0), coalesce_misses(0) {
+}
+
 void PoolTraits::Destruct(const Pool* pool) {
   pool->OnDestruct();
 }
 
+Pool::Shard::Shard()
+    : context(NULL), proxy_config_service(NULL) {
+}
+
+Pool::Shard::~Shard() {
+}
+
 Pool::Pool(scoped_refptr<base::SingleThreadTaskRunner> ui_runner,
     const Config& config)
-    : proxy_config_service_(NULL), ui_runner_(ui_runner),
-      network_thread_(NULL), work_thread_(NULL), file_thread_(NULL),
+    : ui_runner_(ui_runner),
+      engine_(GetOrCreateEngine(ui_runner, config)),
+      shard_count_(engine_->network_thread_count()),
+      work_thread_count_(engine_->work_thread_count()),
+      next_work_thread_(0),
       outstanding_requests_(0),
+      scheduler_(config.max_requests, config.max_requests_per_host),
+      coalesce_requests_(config.coalesce_requests),
       user_agent_(config.user_agent), enable_spdy_(config.enable_spdy),
       enable_quic_(config.enable_quic),
       enable_ssl_false_start_(config.enable_ssl_false_start),
       disable_system_proxy_(config.disable_system_proxy),
       cache_path_(config.cache_path),
       cache_max_bytes_(config.cache_max_bytes),
-      log_level_(config.log_level) {
+      log_level_(config.log_level),
+      read_buffers_(new ReadBufferPool(kReadBufferSize,
+          config.read_buffer_pool_max_bytes)),
+      file_write_batch_bytes_(std::max(0, std::min(
+          config.file_write_batch_bytes, kMaxFileWriteBatchBytes))),
+      progress_interval_(base::TimeDelta::FromMilliseconds(
+          std::max(0, config.progress_interval_ms))),
+      progress_min_bytes_(std::max(static_cast<int64>(0),
+          config.progress_min_bytes)),
+      body_memory_budget_(config.body_memory_budget),
+      spill_bodies_over_budget_(config.spill_bodies_over_budget),
+      spill_path_(config.spill_path),
+      body_memory_waiters_scheduled_(false),
+      body_memory_used_(0), body_spills_(0), requests_queued_(0),
+      coalesce_hits_(0), coalesce_misses_(0) {
 #ifdef NDEBUG
   trust_all_cert_authorities_ = false;
 #else
   trust_all_cert_authorities_ = config.trust_all_cert_authorities;
 #endif
+
+  if (engine_->shares_network_session()) {
+    // The engine's sessions make the connections, with its settings.
+    enable_spdy_ = engine_->enable_spdy();
+    enable_quic_ = engine_->enable_quic();
+    enable_ssl_false_start_ = engine_->enable_ssl_false_start();
+  }
+
+  // Resolve the directory now, since on some platforms that needs the
+  // thread that creates the pool.
+  if (spill_path_.empty() && !base::GetTempDir(&spill_path_)) {
+    LOG(WARNING) << "No temporary directory; bodies won't be spilled";
+    spill_bodies_over_budget_ = false;
+  }
 }
 
 Pool::~Pool() {
@@ -106,46 +154,28 @@ void Pool::OnDestruct() const {
     return;
   }
 
-  if (ui_runner_.get() == NULL) {
-    LOG(WARNING) << "Leaking CnetPool threads";
-  } else {
-    // Stopping the threads joins with them, so we have to do this from
-    // a different thread.
-    ui_runner_->PostTask(FROM_HERE, base::Bind(&Pool::DeleteThreads,
-        network_thread_, work_thread_, file_thread_));
+  // Each context has to be destroyed on its own thread, before the thread
+  // stops.  The engine stops the threads once every pool releases it.
+  for (size_t i = 0; i < shards_.size(); i++) {
+    GetShardTaskRunner(i)->DeleteSoon(FROM_HERE, shards_[i].context);
   }
 
   delete this;
 }
 
-/* static */
-void Pool::DeleteThreads(base::Thread *network, base::Thread *work,
-    base::Thread *file) {
-  if (file != NULL) {
-    file->Stop();
-    delete file;
-  }
-  if (work != NULL) {
-    work->Stop();
-    delete work;
-  }
-  if (network != NULL) {
-    network->Stop();
-    delete network;
-  }
-}
-
 void Pool::Start() {
-  if (network_thread_ == NULL) {
-    base::Thread::Options options;
-    options.message_loop_type = base::MessageLoop::TYPE_IO;
-    network_thread_ = new base::Thread("cnet");
-    network_thread_->StartWithOptions(options);
-    work_thread_ = new base::Thread("cnet-work");
-    work_thread_->StartWithOptions(options);
+  if (shards_.empty()) {
+    engine_->Start();
+    shards_.resize(shard_count_);
+    for (size_t i = 0; i < shards_.size(); i++) {
+      GetShardTaskRunner(i)->PostTask(FROM_HERE,
+          base::Bind(&Pool::InitializeURLRequestContext, this, i));
+    }
 
-    GetNetworkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Pool::InitializeURLRequestContext, this));
+    if (engine_->shares_network_session()) {
+      // The engine watches the system proxy settings for its sessions.
+      return;
+    }
 
     // For Android, the proxy needs a JNI thread (which is our UI thread).  If
     // we are being allocated from that thread, then we can immediately
@@ -158,41 +188,62 @@ void Pool::Start() {
 // LICENSE: modeled after
 //    URLRequestContextAdapter::InitializeURLRequestContext() from
 //    components/cronet/android/url_request_context_adapter.cc
-void Pool::InitializeURLRequestContext() {
-  proxy_config_service_ = new cnet::ProxyConfigService();
-
-  net::URLRequestContextBuilder context_builder;
-  context_builder.set_network_delegate(new CnetNetworkDelegate());
-  context_builder.set_proxy_config_service(proxy_config_service_);
-  context_builder.SetSpdyAndQuicEnabled(enable_spdy_, enable_quic_);
-  if (!user_agent_.empty()) {
-    context_builder.set_user_agent(user_agent_);
+void Pool::InitializeURLRequestContext(size_t shard) {
+  Shard& s = shards_[shard];
+
+  base::FilePath cache_path = cache_path_;
+  unsigned cache_max_bytes = cache_max_bytes_;
+  if (!cache_path_.empty() && (shard_count_ > 1)) {
+    // A disk cache can't be shared between threads.
+    cache_max_bytes /= shard_count_;
+    cache_path = cache_path_.AppendASCII(
+        base::StringPrintf("shard-%d", static_cast<int>(shard)));
   }
 
-  if (cache_path_.empty() || (cache_max_bytes_ == 0)) {
-    context_builder.DisableHttpCache();
+  if (engine_->shares_network_session()) {
+    // The proxy settings belong to the session, which the engine set up
+    // before any pool got here.
+    s.proxy_config_service = engine_->GetProxyConfigService(shard);
+    s.context = engine_->CreateSharedSessionContext(shard, user_agent_,
+        cache_path, cache_max_bytes);
   } else {
-    net::URLRequestContextBuilder::HttpCacheParams cache_params;
-    cache_params.type = net::URLRequestContextBuilder::HttpCacheParams::DISK;
-    cache_params.max_size = cache_max_bytes_;
-    cache_params.path = cache_path_;
-    context_builder.EnableHttpCache(cache_params);
-  }
+    s.proxy_config_service = new cnet::ProxyConfigService();
+
+    net::URLRequestContextBuilder context_builder;
+    context_builder.set_network_delegate(new CnetNetworkDelegate());
+    context_builder.set_proxy_config_service(s.proxy_config_service);
+    context_builder.SetSpdyAndQuicEnabled(enable_spdy_, enable_quic_);
+    if (!user_agent_.empty()) {
+      context_builder.set_user_agent(user_agent_);
+    }
 
-  context_.reset(context_builder.Build());
-  context_->set_ssl_config_service(
-      new SSLConfigService(enable_ssl_false_start_));
-  if (enable_quic_) {
-    // Set the alternate-protocol threshold, so that we can register
-    // QUIC as an alternate protocol for specific hosts.
-    context_->http_server_properties()->
-        SetAlternateProtocolProbabilityThreshold(0.0f);
+    if (cache_path.empty() || (cache_max_bytes == 0)) {
+      context_builder.DisableHttpCache();
+    } else {
+      net::URLRequestContextBuilder::HttpCacheParams cache_params;
+      cache_params.type = net::URLRequestContextBuilder::HttpCacheParams::DISK;
+      cache_params.max_size = cache_max_bytes;
+      cache_params.path = cache_path;
+      context_builder.EnableHttpCache(cache_params);
+    }
+
+    s.context = context_builder.Build();
+    s.context->set_ssl_config_service(
+        new SSLConfigService(enable_ssl_false_start_));
+    if (enable_quic_) {
+      // Set the alternate-protocol threshold, so that we can register
+      // QUIC as an alternate protocol for specific hosts.
+      s.context->http_server_properties()->
+          SetAlternateProtocolProbabilityThreshold(0.0f);
+    }
   }
 }
 
 void Pool::AllocSystemProxyOnUi() {
   if ((ui_runner_.get() == NULL) || disable_system_proxy_) {
-    ActivateSystemProxy(NULL);
+    for (size_t i = 0; i < shards_.size(); i++) {
+      ActivateSystemProxy(i, NULL);
+    }
     return;
   } else if (!ui_runner_->RunsTasksOnCurrentThread()) {
     ui_runner_->PostTask(FROM_HERE,
@@ -200,33 +251,46 @@ void Pool::AllocSystemProxyOnUi() {
     return;
   }
 
-  net::ProxyConfigService* system_proxy_service = 
-      net::ProxyService::CreateSystemProxyConfigService(
-          GetNetworkTaskRunner(), NULL);
-  ActivateSystemProxy(system_proxy_service);
+  // Each network thread watches the system settings for its own context.
+  for (size_t i = 0; i < shards_.size(); i++) {
+    net::ProxyConfigService* system_proxy_service =
+        net::ProxyService::CreateSystemProxyConfigService(
+            GetShardTaskRunner(i), NULL);
+    ActivateSystemProxy(i, system_proxy_service);
+  }
 }
 
-void Pool::ActivateSystemProxy(net::ProxyConfigService *system_proxy_service) {
-  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    GetNetworkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Pool::ActivateSystemProxy, this, system_proxy_service));
+void Pool::ActivateSystemProxy(size_t shard,
+    net::ProxyConfigService *system_proxy_service) {
+  if (!GetShardTaskRunner(shard)->RunsTasksOnCurrentThread()) {
+    GetShardTaskRunner(shard)->PostTask(FROM_HERE,
+        base::Bind(&Pool::ActivateSystemProxy, this, shard,
+            system_proxy_service));
     return;
   }
 
-  DCHECK(proxy_config_service_ != NULL);
-  if (proxy_config_service_ != NULL) {
-    proxy_config_service_->ActivateSystemProxyService(system_proxy_service);
+  cnet::ProxyConfigService* proxy_config_service =
+      shards_[shard].proxy_config_service;
+  DCHECK(proxy_config_service != NULL);
+  if (proxy_config_service != NULL) {
+    proxy_config_service->ActivateSystemProxyService(system_proxy_service);
   }
 }
 
 void Pool::SetProxyConfig(const std::string& rules) {
-  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    GetNetworkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Pool::SetProxyConfig, this, rules));
+  for (size_t i = 0; i < shards_.size(); i++) {
+    SetShardProxyConfig(i, rules);
+  }
+}
+
+void Pool::SetShardProxyConfig(size_t shard, const std::string& rules) {
+  if (!GetShardTaskRunner(shard)->RunsTasksOnCurrentThread()) {
+    GetShardTaskRunner(shard)->PostTask(FROM_HERE,
+        base::Bind(&Pool::SetShardProxyConfig, this, shard, rules));
     return;
   }
 
-  proxy_config_service_->SetProxyConfig(rules);
+  shards_[shard].proxy_config_service->SetProxyConfig(rules);
 }
 
 void Pool::SetTrustAllCertAuthorities(bool value) {
@@ -243,6 +307,11 @@ void Pool::SetTrustAllCertAuthorities(bool value) {
 }
 
 void Pool::SetEnableSslFalseStart(bool value) {
+  if (engine_->shares_network_session()) {
+    LOG(WARNING) << "SSL false start is set on the engine's shared sessions";
+    return;
+  }
+
   if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
     GetNetworkTaskRunner()->PostTask(FROM_HERE,
         base::Bind(&Pool::SetEnableSslFalseStart, this, value));
@@ -250,15 +319,29 @@ void Pool::SetEnableSslFalseStart(bool value) {
   }
 
   enable_ssl_false_start_ = value;
-  context_->set_ssl_config_service(
-      new SSLConfigService(enable_ssl_false_start_));
+  for (size_t i = 0; i < shards_.size(); i++) {
+    SetShardSslFalseStart(i, value);
+  }
+}
+
+void Pool::SetShardSslFalseStart(size_t shard, bool value) {
+  if (!GetShardTaskRunner(shard)->RunsTasksOnCurrentThread()) {
+    GetShardTaskRunner(shard)->PostTask(FROM_HERE,
+        base::Bind(&Pool::SetShardSslFalseStart, this, shard, value));
+    return;
+  }
+
+  shards_[shard].context->set_ssl_config_service(
+      new SSLConfigService(value));
 }
 
 // Inspired by URLRequestContextAdapter::InitRequestContextOnNetworkThread()
 void Pool::AddQuicHint(const std::string& host, uint16 port,
     uint16 alternate_port) {
-  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  // Only the thread that the host's requests run on needs the hint.
+  size_t shard = GetShardForHost(host);
+  if (!GetShardTaskRunner(shard)->RunsTasksOnCurrentThread()) {
+    GetShardTaskRunner(shard)->PostTask(FROM_HERE,
         base::Bind(&Pool::AddQuicHint, this, host, port, alternate_port));
     return;
   }
@@ -268,7 +351,7 @@ void Pool::AddQuicHint(const std::string& host, uint16 port,
   if (host_info.IsIPAddress() ||
       net::IsCanonicalizedHostCompliant(canon_host)) {
     net::HostPortPair host_port(host, port);
-    context_->http_server_properties()->
+    shards_[shard].context->http_server_properties()->
         SetAlternateProtocol(host_port, alternate_port,
             net::AlternateProtocol::QUIC, 1.0f);
   } else {
@@ -277,22 +360,169 @@ void Pool::AddQuicHint(const std::string& host, uint16 port,
 }
 
 scoped_refptr<base::SingleThreadTaskRunner> Pool::GetNetworkTaskRunner() const {
-  return network_thread_->task_runner();
+  return GetShardTaskRunner(0);
+}
+
+scoped_refptr<base::SingleThreadTaskRunner> Pool::GetShardTaskRunner(
+    size_t shard) const {
+  return engine_->GetNetworkThreadTaskRunner(shard);
+}
+
+size_t Pool::GetShardForUrl(const GURL& url) const {
+  return GetShardForHost(url.host());
+}
+
+size_t Pool::GetShardForHost(const std::string& host) const {
+  if (shard_count_ == 1) {
+    return 0;
+  }
+  return base::Hash(base::StringToLowerASCII(host)) % shard_count_;
+}
+
+net::URLRequestContext* Pool::GetURLRequestContext(size_t shard) {
+  DCHECK(GetShardTaskRunner(shard)->RunsTasksOnCurrentThread());
+  return shards_[shard].context;
 }
 
 scoped_refptr<base::SingleThreadTaskRunner> Pool::GetWorkTaskRunner() const {
-  return work_thread_->task_runner();
+  return GetWorkThreadTaskRunner(0);
+}
+
+size_t Pool::AssignWorkThread() {
+  // Fetchers may be created on any thread.
+  base::subtle::Atomic32 next =
+      base::subtle::NoBarrier_AtomicIncrement(&next_work_thread_, 1);
+  return static_cast<uint32>(next) % work_thread_count_;
+}
+
+size_t Pool::GetWorkThreadForTag(int tag) const {
+  return static_cast<uint32>(tag) % work_thread_count_;
+}
+
+scoped_refptr<base::SingleThreadTaskRunner> Pool::GetWorkThreadTaskRunner(
+    size_t index) const {
+  return engine_->GetWorkThreadTaskRunner(index);
 }
 
 scoped_refptr<base::SingleThreadTaskRunner> Pool::GetFileTaskRunner() {
-  if (file_thread_ == NULL) {
-    file_thread_ = new base::Thread("cnet-file");
-    base::Thread::Options options;
-    options.message_loop_type = base::MessageLoop::TYPE_IO;
-    file_thread_->StartWithOptions(options);
+  return engine_->GetFileTaskRunner();
+}
+
+void Pool::GetStats(Stats* stats) {
+  read_buffers_->GetStats(&stats->read_buffer_hits,
+      &stats->read_buffer_misses, &stats->read_buffer_idle_bytes);
+
+  base::AutoLock lock(stats_lock_);
+  stats->body_memory_used_bytes = body_memory_used_;
+  stats->body_memory_waiters = body_memory_waiters_.size();
+  stats->body_spills = body_spills_;
+  stats->requests_queued = requests_queued_;
+  stats->coalesce_hits = coalesce_hits_;
+  stats->coalesce_misses = coalesce_misses_;
+}
+
+bool Pool::IsBodyMemoryAvailable(scoped_refptr<Fetcher> fetcher,
+    const base::Closure& retry) {
+  base::AutoLock lock(stats_lock_);
+  if ((body_memory_budget_ > 0) && (body_memory_used_ >= body_memory_budget_)) {
+    if (!retry.is_null()) {
+      body_memory_waiters_.push_back(std::make_pair(fetcher, retry));
+    }
+    return false;
   }
+  return true;
+}
+
+bool Pool::ReserveBodyMemory(scoped_refptr<Fetcher> fetcher, int64 bytes,
+    const base::Closure& retry) {
+  base::AutoLock lock(stats_lock_);
+
+  int64& reserved = body_reservations_[fetcher];
+  // With nothing else held, no release would ever retry a refusal, so a
+  // body larger than the whole budget gets the memory anyway.
+  bool granted = (body_memory_budget_ == 0) || (body_memory_used_ == 0) ||
+      (body_memory_used_ + bytes <= body_memory_budget_);
+  if (!granted) {
+    // The largest body always makes progress, so that the fetchers can't
+    // all end up waiting on each other.
+    scoped_refptr<Fetcher> largest;
+    int64 largest_bytes = 0;
+    for (FetcherToBytes::const_iterator it = body_reservations_.begin();
+         it != body_reservations_.end(); ++it) {
+      if (it->second > largest_bytes) {
+        largest = it->first;
+        largest_bytes = it->second;
+      }
+    }
 
-  return file_thread_->task_runner();
+    if ((reserved > 0) && (reserved >= largest_bytes)) {
+      granted = true;
+    } else if (spill_bodies_over_budget_ && (largest.get() != NULL)) {
+      // The largest body releases its memory once it moves to disk.
+      GetNetworkTaskRunner()->PostTask(FROM_HERE,
+          base::Bind(&Fetcher::SpillBody, largest));
+    }
+  }
+
+  if (granted) {
+    reserved += bytes;
+    body_memory_used_ += bytes;
+  } else if (!retry.is_null()) {
+    body_memory_waiters_.push_back(std::make_pair(fetcher, retry));
+  }
+  return granted;
+}
+
+void Pool::ReleaseBodyMemory(scoped_refptr<Fetcher> fetcher, bool spilled) {
+  base::AutoLock lock(stats_lock_);
+
+  FetcherToBytes::iterator it = body_reservations_.find(fetcher);
+  if (it == body_reservations_.end()) {
+    return;
+  }
+  int64 bytes = it->second;
+  body_reservations_.erase(it);
+
+  if (bytes > 0) {
+    body_memory_used_ -= bytes;
+    if (spilled) {
+      body_spills_++;
+    }
+
+    if (!body_memory_waiters_.empty() && !body_memory_waiters_scheduled_) {
+      // Don't re-enter the fetcher that is releasing.
+      body_memory_waiters_scheduled_ = true;
+      GetNetworkTaskRunner()->PostTask(FROM_HERE,
+          base::Bind(&Pool::RunBodyMemoryWaiters, this));
+    }
+  }
+}
+
+void Pool::CancelBodyMemoryWait(scoped_refptr<Fetcher> fetcher) {
+  base::AutoLock lock(stats_lock_);
+  BodyMemoryWaiters::iterator it = body_memory_waiters_.begin();
+  while (it != body_memory_waiters_.end()) {
+    if (it->first.get() == fetcher.get()) {
+      it = body_memory_waiters_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Pool::RunBodyMemoryWaiters() {
+  // Each waiter tries again, and waits again if it is still refused.  The
+  // waiters hop to their own network threads.
+  BodyMemoryWaiters waiters;
+  {
+    base::AutoLock lock(stats_lock_);
+    body_memory_waiters_scheduled_ = false;
+    waiters.swap(body_memory_waiters_);
+  }
+  for (BodyMemoryWaiters::const_iterator it = waiters.begin();
+       it != waiters.end(); ++it) {
+    it->second.Run();
+  }
 }
 
 void Pool::AddObserver(Observer* observer) {
@@ -325,21 +555,25 @@ void Pool::RemoveObserver(Observer *observer) {
 // LICENSE: modeled after PreconnectOnIOThread() from
 //          chrome/browser/net/preconnect.cc
 void Pool::Preconnect(const std::string& url, int num_streams) {
-  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
-    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+  // The connections are only useful to the thread that runs the requests.
+  GURL gurl(url);
+  size_t shard = GetShardForUrl(gurl);
+  if (!GetShardTaskRunner(shard)->RunsTasksOnCurrentThread()) {
+    GetShardTaskRunner(shard)->PostTask(FROM_HERE,
         base::Bind(&Pool::Preconnect, this, url, num_streams));
     return;
   }
 
-  net::HttpTransactionFactory* factory = context_->http_transaction_factory();
+  net::URLRequestContext* context = shards_[shard].context;
+  net::HttpTransactionFactory* factory = context->http_transaction_factory();
   net::HttpNetworkSession* session = factory->GetSession();
 
   std::string user_agent;
-  if (context_->http_user_agent_settings()) {
-    user_agent = context_->http_user_agent_settings()->GetUserAgent();
+  if (context->http_user_agent_settings()) {
+    user_agent = context->http_user_agent_settings()->GetUserAgent();
   }
   net::HttpRequestInfo request_info;
-  request_info.url = GURL(url);
+  request_info.url = gurl;
   request_info.method = "GET";
   request_info.extra_headers.SetHeader(net::HttpRequestHeaders::kUserAgent,
       user_agent);
@@ -356,32 +590,147 @@ void Pool::Preconnect(const std::string& url, int num_streams) {
 }
 
 void Pool::TagFetcher(scoped_refptr<Fetcher> fetcher, int tag) {
+  tags_.Add(fetcher, tag);
+}
+
+void Pool::UntagFetcher(scoped_refptr<Fetcher> fetcher) {
+  tags_.Remove(fetcher);
+}
+
+void Pool::CancelTag(int tag) {
+  TagRegistry::Fetchers fetchers;
+  tags_.GetFetchers(tag, &fetchers);
+
+  for (TagRegistry::Fetchers::const_iterator it = fetchers.begin();
+       it != fetchers.end(); ++it) {
+    tags_.Remove(*it);
+    (*it)->Cancel();
+  }
+}
+
+void Pool::SetTagPriority(int tag, Fetcher::Priority priority) {
+  TagRegistry::Fetchers fetchers;
+  tags_.GetFetchers(tag, &fetchers);
+
+  for (TagRegistry::Fetchers::const_iterator it = fetchers.begin();
+       it != fetchers.end(); ++it) {
+    (*it)->SetPriority(priority);
+  }
+}
+
+void Pool::PauseTag(int tag) {
+  TagRegistry::Fetchers fetchers;
+  tags_.GetFetchers(tag, &fetchers);
+
+  for (TagRegistry::Fetchers::const_iterator it = fetchers.begin();
+       it != fetchers.end(); ++it) {
+    (*it)->Pause();
+  }
+}
+
+void Pool::ResumeTag(int tag) {
+  TagRegistry::Fetchers fetchers;
+  tags_.GetFetchers(tag, &fetchers);
+
+  for (TagRegistry::Fetchers::const_iterator it = fetchers.begin();
+       it != fetchers.end(); ++it) {
+    (*it)->Resume();
+  }
+}
+
+void Pool::GetTagStats(int tag, TagRegistry::TagStats* stats) {
+  tags_.GetTagStats(tag, stats);
+}
+
+void Pool::AddTagReceivedBytes(Fetcher* fetcher, int64 bytes) {
+  tags_.FetcherReceivedBytes(fetcher, bytes);
+}
+
+void Pool::ScheduleFetcher(scoped_refptr<Fetcher> fetcher,
+    const std::string& host, net::RequestPriority priority) {
   if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
     GetNetworkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Pool::TagFetcher, this, fetcher, tag));
+        base::Bind(&Pool::ScheduleFetcher, this, fetcher, host, priority));
     return;
   }
 
-  tag_to_fetcher_list_[tag].insert(fetcher);
-  fetcher_to_tag_[fetcher] = tag;
+  // Untagged fetchers take their turns together, apart from every tag.
+  // Those with several tags take turns with their first.
+  int64 group = kint64min;
+  int tag;
+  if (tags_.GetFirstTag(fetcher, &tag)) {
+    group = tag;
+  }
+
+  if (scheduler_.Add(fetcher, host, priority, group)) {
+    fetcher->Start();
+  }
+  base::AutoLock lock(stats_lock_);
+  requests_queued_ = scheduler_.waiting_count();
 }
 
-void Pool::CancelTag(int tag) {
+void Pool::RescheduleFetcher(scoped_refptr<Fetcher> fetcher,
+    net::RequestPriority priority) {
   if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
     GetNetworkTaskRunner()->PostTask(FROM_HERE,
-        base::Bind(&Pool::CancelTag, this, tag));
+        base::Bind(&Pool::RescheduleFetcher, this, fetcher, priority));
     return;
   }
 
-  FetcherList fetchers = tag_to_fetcher_list_[tag];
-  tag_to_fetcher_list_.erase(tag);
+  scheduler_.SetPriority(fetcher, priority);
+}
 
-  for (FetcherList::const_iterator it = fetchers.begin(); it != fetchers.end();
-       ++it) {
-    scoped_refptr<Fetcher> fetcher = *it;
-    fetcher->Cancel();
-    fetcher_to_tag_.erase(fetcher);
+void Pool::UnscheduleFetcher(scoped_refptr<Fetcher> fetcher) {
+  if (!GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
+    GetNetworkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&Pool::UnscheduleFetcher, this, fetcher));
+    return;
   }
+
+  RequestScheduler::Fetchers ready;
+  scheduler_.Remove(fetcher, &ready);
+  StartScheduledFetchers(ready);
+}
+
+void Pool::StartScheduledFetchers(const RequestScheduler::Fetchers& ready) {
+  // The fetchers hop to their own network threads.
+  for (RequestScheduler::Fetchers::const_iterator it = ready.begin();
+       it != ready.end(); ++it) {
+    (*it)->Start();
+  }
+
+  base::AutoLock lock(stats_lock_);
+  requests_queued_ = scheduler_.waiting_count();
+}
+
+scoped_refptr<Fetcher> Pool::FindInFlightFetcher(size_t shard,
+    const std::string& key) {
+  DCHECK(GetShardTaskRunner(shard)->RunsTasksOnCurrentThread());
+  InFlightFetchers::const_iterator it = shards_[shard].in_flight.find(key);
+  if (it == shards_[shard].in_flight.end()) {
+    return NULL;
+  }
+
+  base::AutoLock lock(stats_lock_);
+  coalesce_hits_++;
+  return it->second;
+}
+
+void Pool::AddInFlightFetcher(size_t shard, const std::string& key,
+    scoped_refptr<Fetcher> fetcher) {
+  DCHECK(GetShardTaskRunner(shard)->RunsTasksOnCurrentThread());
+  // Handing a request to another of its fetchers isn't a miss.
+  scoped_refptr<Fetcher>& entry = shards_[shard].in_flight[key];
+  if (entry.get() == NULL) {
+    base::AutoLock lock(stats_lock_);
+    coalesce_misses_++;
+  }
+  entry = fetcher;
+}
+
+void Pool::RemoveInFlightFetcher(size_t shard, const std::string& key) {
+  DCHECK(GetShardTaskRunner(shard)->RunsTasksOnCurrentThread());
+  shards_[shard].in_flight.erase(key);
 }
 
 void Pool::FetcherStarting(scoped_refptr<cnet::Fetcher> fetcher) {
@@ -392,6 +741,7 @@ void Pool::FetcherStarting(scoped_refptr<cnet::Fetcher> fetcher) {
   }
 
   outstanding_requests_++;
+  tags_.FetcherStarted(fetcher);
 }
 
 void Pool::FetcherCompleted(scoped_refptr<Fetcher> fetcher) {
@@ -401,20 +751,16 @@ void Pool::FetcherCompleted(scoped_refptr<Fetcher> fetcher) {
     return;
   }
 
-  FetcherToTag::iterator it = fetcher_to_tag_.find(fetcher);
-  if (it != fetcher_to_tag_.end()) {
-    int tag = it->second;
-    TagToFetcherList::iterator list_it = tag_to_fetcher_list_.find(tag);
-    if (list_it != tag_to_fetcher_list_.end()) {
-      FetcherList fetcher_list(list_it->second);
-      fetcher_list.erase(fetcher);
-      if (fetcher_list.size() == 0) {
-        tag_to_fetcher_list_.erase(list_it);
-      }
-    }
-    fetcher_to_tag_.erase(it);
+  ReleaseBodyMemory(fetcher, false);
+
+  if (scheduler_.enabled()) {
+    RequestScheduler::Fetchers ready;
+    scheduler_.Remove(fetcher, &ready);
+    StartScheduledFetchers(ready);
   }
 
+  tags_.Remove(fetcher);
+
   DCHECK(outstanding_requests_ > 0);
   if (outstanding_requests_ > 0) {
     outstanding_requests_--;
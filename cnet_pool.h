@@ -4,14 +4,24 @@
 #ifndef YAHOO_CNET_CNET_POOL_H_
 #define YAHOO_CNET_CNET_POOL_H_
 
-#include <set>
+#include <deque>
 #include <map>
+#include <vector>
 
+#include "base/atomicops.h"
+#include "base/callback.h"
 #include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
 #include "base/memory/scoped_ptr.h"
 #include "base/observer_list.h"
-#include "base/threading/thread.h"
+#include "base/synchronization/lock.h"
+#include "base/time/time.h"
+#include "yahoo/cnet/cnet_engine.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+#include "yahoo/cnet/cnet_request_scheduler.h"
+#include "yahoo/cnet/cnet_tag_registry.h"
+
+class GURL;
 
 namespace net {
 class NetworkChangeNotifier;
@@ -25,6 +35,7 @@ namespace cnet {
 class Fetcher;
 class ProxyConfigService;
 class Pool;
+class ReadBufferPool;
 
 struct PoolTraits {
   static void Destruct(const Pool* pool);
@@ -38,6 +49,24 @@ class Pool : public base::RefCountedThreadSafe<Pool, PoolTraits> {
 
     std::string user_agent;
 
+    // The engine whose threads the pool runs on, shared with other pools.
+    // If NULL, the pool has an engine of its own, with the threads below.
+    // Pools on one engine need cache paths of their own.  If the engine
+    // shares its network sessions, its SPDY, QUIC and SSL false start
+    // settings replace the pool's.
+    scoped_refptr<Engine> engine;
+
+    // The number of network threads, each with its own URL request context.
+    // Requests are assigned to them by host, so that requests for a host
+    // still share connections.  With several, each gets its own cache in a
+    // subdirectory of the cache path, with an even share of its bytes.
+    int network_threads;
+
+    // The number of threads that run callbacks.  Each fetcher's callbacks
+    // run in order on one of them, so a slow callback only holds up the
+    // fetchers that share its thread.
+    int work_threads;
+
     bool enable_spdy;
     bool enable_quic;
 
@@ -48,9 +77,64 @@ class Pool : public base::RefCountedThreadSafe<Pool, PoolTraits> {
     base::FilePath cache_path;
     unsigned cache_max_bytes;
 
+    // The most bytes of idle read buffers to keep for reuse across fetchers.
+    // If 0, buffers aren't recycled.
+    int64 read_buffer_pool_max_bytes;
+
+    // Downloads to files collect this many bytes before handing them to the
+    // file thread in a single write.  If 0, each read is written at once.
+    int file_write_batch_bytes;
+
+    // Space out each fetcher's progress events by at least this much time
+    // and this many bytes.  Progress is coalesced regardless, so at most one
+    // event per fetcher waits for the work thread, and it reports the latest
+    // values.  The final progress is always reported.
+    int progress_interval_ms;
+    int64 progress_min_bytes;
+
+    // The most requests in flight at once, across every host and for any one
+    // host.  The rest wait in priority order, and fetchers of equal priority
+    // take turns by tag.  If 0, there is no limit.
+    int max_requests;
+    int max_requests_per_host;
+
+    // Let cacheable GETs for the same URL, with the same headers and cache
+    // behavior, share one request while it's in flight.  Each fetcher gets
+    // its own response, sharing the body.
+    bool coalesce_requests;
+
+    // The most bytes that in-flight fetchers may hold for bodies buffered in
+    // memory.  Fetchers wait to start or to read more once it is used up.
+    // If 0, there is no limit.
+    int64 body_memory_budget;
+    // When over budget, move the largest buffered bodies to temporary files.
+    bool spill_bodies_over_budget;
+    // The directory for bodies moved from memory to temporary files.  If
+    // empty, the system's temporary directory is used.
+    base::FilePath spill_path;
+
     int log_level;
   };
 
+  struct Stats {
+    Stats();
+
+    int64 read_buffer_hits;
+    int64 read_buffer_misses;
+    int64 read_buffer_idle_bytes;
+
+    int64 body_memory_used_bytes;
+    int64 body_memory_waiters;
+    int64 body_spills;
+
+    int64 requests_queued;
+
+    // Coalescable fetchers that joined a request in flight, and those that
+    // had to send their own.
+    int64 coalesce_hits;
+    int64 coalesce_misses;
+  };
+
   class Observer {
    public:
     virtual ~Observer() {}
@@ -79,46 +163,134 @@ class Pool : public base::RefCountedThreadSafe<Pool, PoolTraits> {
 
   void Preconnect(const std::string& url, int num_streams);
 
-  // TODO: move the add-tag logic into an observer on the fetcher.
+  // Tags group fetchers for operations on all of them at once.  A fetcher
+  // may have several tags, and leaves them when it completes.
   void TagFetcher(scoped_refptr<Fetcher> fetcher, int tag);
+  void UntagFetcher(scoped_refptr<Fetcher> fetcher);
   void CancelTag(int tag);
+  // Change the priority of every fetcher with |tag|, including those that
+  // have started.
+  void SetTagPriority(int tag, Fetcher::Priority priority);
+  void PauseTag(int tag);
+  void ResumeTag(int tag);
+  void GetTagStats(int tag, TagRegistry::TagStats* stats);
+  void AddTagReceivedBytes(Fetcher* fetcher, int64 bytes);
 
   // TODO: convert these to observers on the fetcher.
   void FetcherStarting(scoped_refptr<Fetcher> fetcher);
   void FetcherCompleted(scoped_refptr<Fetcher> fetcher);
 
+  // Admission under the request limits, which runs on the pool's network
+  // thread.  A fetcher that asks to be scheduled is started again once it
+  // may run.  One that gives up before starting unschedules itself, and one
+  // that starts gives back its slot when it completes.
+  bool IsSchedulingRequests() const { return scheduler_.enabled(); }
+  void ScheduleFetcher(scoped_refptr<Fetcher> fetcher, const std::string& host,
+      net::RequestPriority priority);
+  void RescheduleFetcher(scoped_refptr<Fetcher> fetcher,
+      net::RequestPriority priority);
+  void UnscheduleFetcher(scoped_refptr<Fetcher> fetcher);
+
+  // The coalescable requests in flight on a shard, by the fetchers that
+  // run them.  Only valid on the shard's thread.
+  bool coalesce_requests() const { return coalesce_requests_; }
+  scoped_refptr<Fetcher> FindInFlightFetcher(size_t shard,
+      const std::string& key);
+  void AddInFlightFetcher(size_t shard, const std::string& key,
+      scoped_refptr<Fetcher> fetcher);
+  void RemoveInFlightFetcher(size_t shard, const std::string& key);
+
+  // The pool's own network thread, which is the first shard's.  The pool's
+  // bookkeeping, such as observers and the scheduler, lives there.
   scoped_refptr<base::SingleThreadTaskRunner> GetNetworkTaskRunner() const;
+  // The first work thread, for callbacks that don't belong to a fetcher.
   scoped_refptr<base::SingleThreadTaskRunner> GetWorkTaskRunner() const;
   scoped_refptr<base::SingleThreadTaskRunner> GetFileTaskRunner();
 
-  net::URLRequestContext* GetURLRequestContext() { return context_.get(); }
+  // The threads that run callbacks.  New fetchers are spread across them in
+  // turn, unless they are ordered by a tag, whose fetchers share a thread.
+  size_t work_thread_count() const { return work_thread_count_; }
+  size_t AssignWorkThread();
+  size_t GetWorkThreadForTag(int tag) const;
+  scoped_refptr<base::SingleThreadTaskRunner> GetWorkThreadTaskRunner(
+      size_t index) const;
+
+  // The network threads that run the requests.  A request for |url| runs
+  // on the thread of the shard that its host maps to.
+  size_t shard_count() const { return shard_count_; }
+  size_t GetShardForUrl(const GURL& url) const;
+  scoped_refptr<base::SingleThreadTaskRunner> GetShardTaskRunner(
+      size_t shard) const;
+
+  // Only valid on the shard's thread.
+  net::URLRequestContext* GetURLRequestContext(size_t shard);
+
+  scoped_refptr<ReadBufferPool> read_buffers() { return read_buffers_; }
+  int file_write_batch_bytes() { return file_write_batch_bytes_; }
+  base::TimeDelta progress_interval() const { return progress_interval_; }
+  int64 progress_min_bytes() const { return progress_min_bytes_; }
+
+  // Accounting for the memory budget of buffered bodies, shared by every
+  // network thread.  When the budget is used up, or a reservation is
+  // refused, |retry| is registered in the same step, so that a release on
+  // another thread can't slip in between and miss it.  It runs on the pool's
+  // network thread once some memory is released.  A null |retry| isn't
+  // registered.  A fetcher that gives up waiting drops its retry with
+  // CancelBodyMemoryWait().
+  bool IsBodyMemoryAvailable(scoped_refptr<Fetcher> fetcher,
+      const base::Closure& retry);
+  bool ReserveBodyMemory(scoped_refptr<Fetcher> fetcher, int64 bytes,
+      const base::Closure& retry);
+  void ReleaseBodyMemory(scoped_refptr<Fetcher> fetcher, bool spilled);
+  void CancelBodyMemoryWait(scoped_refptr<Fetcher> fetcher);
+  const base::FilePath& spill_path() { return spill_path_; }
+
+  void GetStats(Stats* stats);
 
   int log_level() { return log_level_; }
 
  private:
-  void InitializeURLRequestContext();
+  typedef std::map<std::string, scoped_refptr<Fetcher> > InFlightFetchers;
+  typedef std::deque<std::pair<scoped_refptr<Fetcher>, base::Closure> >
+      BodyMemoryWaiters;
+
+  // A network thread, and the request context that lives on it.
+  struct Shard {
+    Shard();
+    ~Shard();
+
+    net::URLRequestContext* context;
+    // Owned by the context, or by the engine if it shares its sessions.
+    cnet::ProxyConfigService* proxy_config_service;
+    InFlightFetchers in_flight;
+  };
+
+  void InitializeURLRequestContext(size_t shard);
   void OnDestruct() const;
-  static void DeleteThreads(base::Thread* network, base::Thread* work,
-      base::Thread* file);
+
+  void RunBodyMemoryWaiters();
+  void StartScheduledFetchers(const RequestScheduler::Fetchers& ready);
 
   void AllocSystemProxyOnUi();
-  void ActivateSystemProxy(net::ProxyConfigService *system_proxy_service);
+  void ActivateSystemProxy(size_t shard,
+      net::ProxyConfigService *system_proxy_service);
+  size_t GetShardForHost(const std::string& host) const;
+  void SetShardProxyConfig(size_t shard, const std::string& rules);
+  void SetShardSslFalseStart(size_t shard, bool value);
   
-  typedef std::set<scoped_refptr<Fetcher> > FetcherList;
-  typedef std::map<int, FetcherList> TagToFetcherList;
-  typedef std::map<scoped_refptr<Fetcher>, int> FetcherToTag;
-
-  scoped_ptr<net::URLRequestContext> context_;
-  cnet::ProxyConfigService* proxy_config_service_; // Owned by URLRequestContext
+  typedef std::map<scoped_refptr<Fetcher>, int64> FetcherToBytes;
 
   scoped_refptr<base::SingleThreadTaskRunner> ui_runner_;
-  base::Thread* network_thread_;
-  base::Thread* work_thread_;
-  base::Thread* file_thread_;
+  scoped_refptr<Engine> engine_;
+  size_t shard_count_;
+  std::vector<Shard> shards_;
+  size_t work_thread_count_;
+  base::subtle::Atomic32 next_work_thread_;
   
-  TagToFetcherList tag_to_fetcher_list_;
-  FetcherToTag fetcher_to_tag_;
+  TagRegistry tags_;
   unsigned outstanding_requests_;
+  RequestScheduler scheduler_;
+  bool coalesce_requests_;
 
   std::string user_agent_;
   bool enable_spdy_;
@@ -130,6 +302,27 @@ class Pool : public base::RefCountedThreadSafe<Pool, PoolTraits> {
   bool trust_all_cert_authorities_;
   int log_level_;
 
+  scoped_refptr<ReadBufferPool> read_buffers_;
+  int file_write_batch_bytes_;
+  base::TimeDelta progress_interval_;
+  int64 progress_min_bytes_;
+
+  int64 body_memory_budget_;
+  bool spill_bodies_over_budget_;
+  base::FilePath spill_path_;
+  FetcherToBytes body_reservations_;
+  BodyMemoryWaiters body_memory_waiters_;
+  bool body_memory_waiters_scheduled_;
+
+  // Guards the accounting of body memory, which fetchers on every network
+  // thread share, and the counters that GetStats() reads.
+  base::Lock stats_lock_;
+  int64 body_memory_used_;
+  int64 body_spills_;
+  int64 requests_queued_;
+  int64 coalesce_hits_;
+  int64 coalesce_misses_;
+
   ObserverList<Observer> observers_;
 
   virtual ~Pool();
@@ -0,0 +1,71 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_progress_coalescer.h"
+
+namespace cnet {
+
+ProgressCoalescer::ProgressCoalescer(base::TimeDelta min_interval,
+    int64 min_bytes)
+    : min_interval_(min_interval), min_bytes_(min_bytes),
+      current_(0), total_(-1), updated_(false), pending_(false),
+      reported_any_(false),
+      reported_current_(0), reported_total_(-1) {
+}
+
+ProgressCoalescer::~ProgressCoalescer() {
+}
+
+bool ProgressCoalescer::Update(int64 current, int64 total,
+    base::TimeTicks now) {
+  base::AutoLock lock(lock_);
+  current_ = current;
+  total_ = total;
+  updated_ = true;
+  if (pending_) {
+    return false;
+  }
+
+  bool finished = (total > 0) && (current >= total);
+  if (!finished && reported_any_) {
+    if ((current == reported_current_) && (total == reported_total_)) {
+      return false;
+    }
+    if ((now - reported_time_) < min_interval_) {
+      return false;
+    }
+    if ((current - reported_current_) < min_bytes_) {
+      return false;
+    }
+  }
+
+  pending_ = true;
+  return true;
+}
+
+bool ProgressCoalescer::Flush() {
+  base::AutoLock lock(lock_);
+  if (!updated_ || pending_ ||
+      (reported_any_ && (current_ == reported_current_) &&
+       (total_ == reported_total_))) {
+    return false;
+  }
+
+  pending_ = true;
+  return true;
+}
+
+void ProgressCoalescer::Take(int64* current, int64* total,
+    base::TimeTicks now) {
+  base::AutoLock lock(lock_);
+  pending_ = false;
+  reported_any_ = true;
+  reported_current_ = current_;
+  reported_total_ = total_;
+  reported_time_ = now;
+
+  *current = current_;
+  *total = total_;
+}
+
+} // namespace cnet
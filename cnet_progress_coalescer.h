@@ -0,0 +1,55 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_PROGRESS_COALESCER_H_
+#define YAHOO_CNET_CNET_PROGRESS_COALESCER_H_
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+#include "base/time/time.h"
+
+namespace cnet {
+
+// Coalesces a transfer's progress into at most one pending event.  The
+// network thread reports each change with Update(), which says whether to
+// schedule an event; while one is pending, later changes just replace its
+// values.  The event calls Take() when it runs, and so reports the latest
+// values rather than stale ones.  Events can be spaced out by time and by
+// bytes, except that reaching the total, or a Flush() at the end of the
+// transfer, always reports the final values.  It is thread safe.
+class ProgressCoalescer : public base::RefCountedThreadSafe<ProgressCoalescer> {
+ public:
+  ProgressCoalescer(base::TimeDelta min_interval, int64 min_bytes);
+
+  // Return true if the caller should schedule an event.
+  bool Update(int64 current, int64 total, base::TimeTicks now);
+  // Return true if the caller should schedule an event for values that
+  // haven't been reported yet.
+  bool Flush();
+
+  // Get the values for the event that is running.
+  void Take(int64* current, int64* total, base::TimeTicks now);
+
+ private:
+  base::TimeDelta min_interval_;
+  int64 min_bytes_;
+
+  base::Lock lock_;
+  int64 current_;
+  int64 total_;
+  bool updated_;
+  bool pending_;
+  bool reported_any_;
+  int64 reported_current_;
+  int64 reported_total_;
+  base::TimeTicks reported_time_;
+
+  ~ProgressCoalescer();
+  friend class base::RefCountedThreadSafe<ProgressCoalescer>;
+  DISALLOW_COPY_AND_ASSIGN(ProgressCoalescer);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_PROGRESS_COALESCER_H_
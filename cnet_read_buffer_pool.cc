@@ -0,0 +1,58 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_read_buffer_pool.h"
+
+#include "base/logging.h"
+#include "net/base/io_buffer.h"
+
+namespace cnet {
+
+ReadBufferPool::ReadBufferPool(int buffer_size, int64 max_idle_bytes)
+    : buffer_size_(buffer_size), max_idle_bytes_(max_idle_bytes),
+      hits_(0), misses_(0) {
+  DCHECK(buffer_size_ > 0);
+}
+
+ReadBufferPool::~ReadBufferPool() {
+}
+
+scoped_refptr<net::IOBufferWithSize> ReadBufferPool::Acquire() {
+  {
+    base::AutoLock lock(lock_);
+    while (!idle_.empty()) {
+      scoped_refptr<net::IOBufferWithSize> buffer(idle_.back());
+      idle_.pop_back();
+
+      // A task that used the buffer may not have released it yet; let
+      // that task have it.
+      if (buffer->HasOneRef()) {
+        hits_++;
+        return buffer;
+      }
+    }
+    misses_++;
+  }
+
+  return new net::IOBufferWithSize(buffer_size_);
+}
+
+void ReadBufferPool::Recycle(scoped_refptr<net::IOBufferWithSize> buffer) {
+  if ((buffer.get() == NULL) || (buffer->size() != buffer_size_)) {
+    return;
+  }
+
+  base::AutoLock lock(lock_);
+  if ((int64)(idle_.size() + 1) * buffer_size_ <= max_idle_bytes_) {
+    idle_.push_back(buffer);
+  }
+}
+
+void ReadBufferPool::GetStats(int64* hits, int64* misses, int64* idle_bytes) {
+  base::AutoLock lock(lock_);
+  *hits = hits_;
+  *misses = misses_;
+  *idle_bytes = (int64)idle_.size() * buffer_size_;
+}
+
+} // namespace cnet
@@ -0,0 +1,53 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_READ_BUFFER_POOL_H_
+#define YAHOO_CNET_CNET_READ_BUFFER_POOL_H_
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+
+namespace net {
+class IOBufferWithSize;
+}
+
+namespace cnet {
+
+// A free list of the fixed-size buffers that fetchers use for reads that
+// they hand off elsewhere (e.g., to the file thread).  Fetchers borrow a
+// buffer with Acquire(), and give it back with Recycle() once nobody else
+// needs it, so that steady-state downloading doesn't allocate.  The idle
+// buffers are bounded by a byte budget.  It is thread safe.
+class ReadBufferPool : public base::RefCountedThreadSafe<ReadBufferPool> {
+ public:
+  ReadBufferPool(int buffer_size, int64 max_idle_bytes);
+
+  int buffer_size() const { return buffer_size_; }
+
+  scoped_refptr<net::IOBufferWithSize> Acquire();
+  void Recycle(scoped_refptr<net::IOBufferWithSize> buffer);
+
+  void GetStats(int64* hits, int64* misses, int64* idle_bytes);
+
+ private:
+  typedef std::vector<scoped_refptr<net::IOBufferWithSize> > BufferList;
+
+  int buffer_size_;
+  int64 max_idle_bytes_;
+
+  base::Lock lock_;
+  BufferList idle_;
+  int64 hits_;
+  int64 misses_;
+
+  ~ReadBufferPool();
+  friend class base::RefCountedThreadSafe<ReadBufferPool>;
+  DISALLOW_COPY_AND_ASSIGN(ReadBufferPool);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_READ_BUFFER_POOL_H_
@@ -0,0 +1,181 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_request_scheduler.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+
+namespace cnet {
+
+RequestScheduler::Waiter::Waiter()
+    : group(0) {
+}
+
+RequestScheduler::Waiter::~Waiter() {
+}
+
+RequestScheduler::Level::Level()
+    : last_group(kint64min) {
+}
+
+RequestScheduler::Level::~Level() {
+}
+
+RequestScheduler::RequestScheduler(int max_requests,
+    int max_requests_per_host)
+    : max_requests_(std::max(0, max_requests)),
+      max_requests_per_host_(std::max(0, max_requests_per_host)) {
+}
+
+RequestScheduler::~RequestScheduler() {
+}
+
+bool RequestScheduler::Add(scoped_refptr<Fetcher> fetcher,
+    const std::string& host, net::RequestPriority priority, int64 group) {
+  DCHECK(active_.find(fetcher) == active_.end());
+  DCHECK(waiting_.find(fetcher) == waiting_.end());
+
+  // Anything already waiting is held up by its host's cap, or else it
+  // would have started when the room opened up.
+  if (HasRoom(host)) {
+    Activate(fetcher, host);
+    return true;
+  }
+
+  Waiter waiter;
+  waiter.fetcher = fetcher;
+  waiter.host = host;
+  waiter.group = group;
+  Enqueue(waiter, priority);
+  return false;
+}
+
+void RequestScheduler::SetPriority(scoped_refptr<Fetcher> fetcher,
+    net::RequestPriority priority) {
+  Waiter waiter;
+  if (Dequeue(fetcher, &waiter)) {
+    Enqueue(waiter, priority);
+  }
+}
+
+void RequestScheduler::Remove(scoped_refptr<Fetcher> fetcher,
+    Fetchers* ready) {
+  FetcherToHost::iterator it = active_.find(fetcher);
+  if (it != active_.end()) {
+    HostCounts::iterator count_it = host_active_.find(it->second);
+    if (--count_it->second == 0) {
+      host_active_.erase(count_it);
+    }
+    active_.erase(it);
+  } else {
+    Waiter waiter;
+    Dequeue(fetcher, &waiter);
+  }
+
+  while (StartNext(ready)) {
+  }
+}
+
+bool RequestScheduler::HasRoom(const std::string& host) const {
+  if ((max_requests_ > 0) &&
+      (active_.size() >= static_cast<size_t>(max_requests_))) {
+    return false;
+  }
+  if (max_requests_per_host_ > 0) {
+    HostCounts::const_iterator it = host_active_.find(host);
+    if ((it != host_active_.end()) && (it->second >= max_requests_per_host_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void RequestScheduler::Activate(scoped_refptr<Fetcher> fetcher,
+    const std::string& host) {
+  active_[fetcher] = host;
+  host_active_[host]++;
+}
+
+void RequestScheduler::Enqueue(const Waiter& waiter,
+    net::RequestPriority priority) {
+  levels_[priority].groups[waiter.group].push_back(waiter);
+  waiting_[waiter.fetcher] = priority;
+}
+
+bool RequestScheduler::Dequeue(scoped_refptr<Fetcher> fetcher,
+    Waiter* waiter) {
+  FetcherToPriority::iterator it = waiting_.find(fetcher);
+  if (it == waiting_.end()) {
+    return false;
+  }
+  GroupQueues& groups = levels_[it->second].groups;
+  waiting_.erase(it);
+
+  for (GroupQueues::iterator group_it = groups.begin();
+       group_it != groups.end(); ++group_it) {
+    WaiterQueue& queue = group_it->second;
+    for (WaiterQueue::iterator waiter_it = queue.begin();
+         waiter_it != queue.end(); ++waiter_it) {
+      if (waiter_it->fetcher.get() == fetcher.get()) {
+        *waiter = *waiter_it;
+        queue.erase(waiter_it);
+        if (queue.empty()) {
+          groups.erase(group_it);
+        }
+        return true;
+      }
+    }
+  }
+
+  NOTREACHED();
+  return false;
+}
+
+bool RequestScheduler::StartNext(Fetchers* ready) {
+  if (waiting_.empty()) {
+    return false;
+  }
+
+  for (int priority = net::NUM_PRIORITIES - 1; priority >= 0; priority--) {
+    Level& level = levels_[priority];
+    if (level.groups.empty()) {
+      continue;
+    }
+
+    // Give each group a turn, starting after the one that went last.  A
+    // group whose waiters are all held up by their hosts' caps is skipped.
+    GroupQueues::iterator group_it = level.groups.upper_bound(
+        level.last_group);
+    for (size_t i = 0; i < level.groups.size(); i++, ++group_it) {
+      if (group_it == level.groups.end()) {
+        group_it = level.groups.begin();
+      }
+
+      WaiterQueue& queue = group_it->second;
+      for (WaiterQueue::iterator it = queue.begin(); it != queue.end();
+           ++it) {
+        if (!HasRoom(it->host)) {
+          continue;
+        }
+
+        scoped_refptr<Fetcher> fetcher = it->fetcher;
+        Activate(fetcher, it->host);
+        ready->push_back(fetcher);
+        waiting_.erase(fetcher);
+        level.last_group = group_it->first;
+        queue.erase(it);
+        if (queue.empty()) {
+          level.groups.erase(group_it);
+        }
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+} // namespace cnet
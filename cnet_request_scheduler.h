@@ -0,0 +1,99 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_REQUEST_SCHEDULER_H_
+#define YAHOO_CNET_CNET_REQUEST_SCHEDULER_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "net/base/request_priority.h"
+
+namespace cnet {
+
+class Fetcher;
+
+// Decides when fetchers may start, under a cap on all of the requests in
+// flight and a cap on those to each host.  The others wait, and start in
+// priority order as requests finish.  Within a priority, the groups (the
+// pool's tags) take turns, so that a burst from one group doesn't starve
+// the others.  A cap of 0 is unlimited.  It isn't thread safe.
+class RequestScheduler {
+ public:
+  typedef std::vector<scoped_refptr<Fetcher> > Fetchers;
+
+  RequestScheduler(int max_requests, int max_requests_per_host);
+  ~RequestScheduler();
+
+  // Whether there is any cap to enforce.
+  bool enabled() const {
+    return (max_requests_ > 0) || (max_requests_per_host_ > 0);
+  }
+
+  // Return true if |fetcher| may start now; otherwise it waits.
+  bool Add(scoped_refptr<Fetcher> fetcher, const std::string& host,
+      net::RequestPriority priority, int64 group);
+
+  // Move a waiting fetcher to the end of the line for |priority|.
+  void SetPriority(scoped_refptr<Fetcher> fetcher,
+      net::RequestPriority priority);
+
+  // Remove a fetcher that finished, or that no longer wants to start, and
+  // add the fetchers that may now start to |ready|.
+  void Remove(scoped_refptr<Fetcher> fetcher, Fetchers* ready);
+
+  size_t active_count() const { return active_.size(); }
+  size_t waiting_count() const { return waiting_.size(); }
+
+ private:
+  struct Waiter {
+    Waiter();
+    ~Waiter();
+
+    scoped_refptr<Fetcher> fetcher;
+    std::string host;
+    int64 group;
+  };
+  typedef std::deque<Waiter> WaiterQueue;
+  typedef std::map<int64, WaiterQueue> GroupQueues;
+
+  // The waiters of one priority.
+  struct Level {
+    Level();
+    ~Level();
+
+    GroupQueues groups;
+    // The group that started a fetcher last, whose turn is over.
+    int64 last_group;
+  };
+
+  typedef std::map<scoped_refptr<Fetcher>, std::string> FetcherToHost;
+  typedef std::map<scoped_refptr<Fetcher>, net::RequestPriority>
+      FetcherToPriority;
+  typedef std::map<std::string, int> HostCounts;
+
+  bool HasRoom(const std::string& host) const;
+  void Activate(scoped_refptr<Fetcher> fetcher, const std::string& host);
+  void Enqueue(const Waiter& waiter, net::RequestPriority priority);
+  bool Dequeue(scoped_refptr<Fetcher> fetcher, Waiter* waiter);
+  bool StartNext(Fetchers* ready);
+
+  int max_requests_;
+  int max_requests_per_host_;
+
+  FetcherToHost active_;
+  HostCounts host_active_;
+
+  Level levels_[net::NUM_PRIORITIES];
+  FetcherToPriority waiting_;
+
+  DISALLOW_COPY_AND_ASSIGN(RequestScheduler);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_REQUEST_SCHEDULER_H_
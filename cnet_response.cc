@@ -3,44 +3,97 @@
 // found in the LICENSE file.
 #include "yahoo/cnet/cnet_response.h"
 
-#include "net/base/io_buffer.h"
+#include "base/bind.h"
+#include "base/files/file_util.h"
+#include "base/task_runner.h"
 #include "net/http/http_response_headers.h"
 #include "yahoo/cnet/cnet.h"
+#include "yahoo/cnet/cnet_rope_buffer.h"
 
 namespace cnet {
 
 Response::Response(const std::string& initial_url,
     const GURL& original_url, const GURL& final_url,
-    scoped_refptr<net::GrowableIOBuffer> read_buffer,
+    scoped_refptr<RopeBuffer> body_buffer,
+    const base::FilePath& body_file_path,
+    scoped_refptr<base::TaskRunner> temp_file_runner,
     const UrlParams& url_params, scoped_ptr<CnetLoadTiming> load_timing,
     const net::URLRequestStatus& status, int http_response_code,
     scoped_refptr<net::HttpResponseHeaders> response_headers,
     scoped_ptr<net::HttpResponseInfo> response_info)
     : initial_url_(initial_url),
       original_url_(original_url), final_url_(final_url),
-      read_buffer_(read_buffer), url_params_(url_params),
+      body_buffer_(body_buffer), body_file_path_(body_file_path),
+      temp_file_runner_(temp_file_runner), url_params_(url_params),
       timing_(load_timing.Pass()), status_(status),
       http_response_code_(http_response_code),
       response_headers_(response_headers),
       response_info_(response_info.Pass()) {
 }
 
+Response::Response(const std::string& initial_url, const GURL& original_url,
+    scoped_refptr<Response> source)
+    : initial_url_(initial_url), original_url_(original_url),
+      final_url_(source->final_url_), body_buffer_(source->body_buffer_),
+      body_file_path_(source->body_file_path_),
+      url_params_(source->url_params_), status_(source->status_),
+      http_response_code_(source->http_response_code_),
+      response_headers_(source->response_headers_), source_(source) {
+  if (source->timing_ != NULL) {
+    timing_.reset(new CnetLoadTiming(*source->timing_));
+  }
+  if (source->response_info_ != NULL) {
+    response_info_.reset(new net::HttpResponseInfo(*source->response_info_));
+  }
+}
+
 Response::~Response() {
+  if ((temp_file_runner_.get() != NULL) && !body_file_path_.empty()) {
+    temp_file_runner_->PostTask(FROM_HERE,
+        base::Bind(base::IgnoreResult(&base::DeleteFile), body_file_path_,
+                   false));
+  }
 }
 
 const char* Response::response_body() {
-  if (read_buffer_.get() == NULL) {
+  if (body_buffer_.get() == NULL) {
     return NULL;
   } else {
-    return read_buffer_->StartOfBuffer();
+    return body_buffer_->Flatten();
   }
 }
 
 int Response::response_length() {
-  if (read_buffer_.get() == NULL) {
+  if (body_buffer_.get() == NULL) {
+    return 0;
+  } else {
+    return body_buffer_->size();
+  }
+}
+
+size_t Response::response_chunk_count() {
+  if (body_buffer_.get() == NULL) {
     return 0;
   } else {
-    return read_buffer_->offset();
+    return body_buffer_->chunk_count();
+  }
+}
+
+const char* Response::response_chunk(size_t index, int* length) {
+  if (body_buffer_.get() == NULL) {
+    *length = 0;
+    return NULL;
+  } else {
+    return body_buffer_->chunk_data(index, length);
+  }
+}
+
+char* Response::DetachBody(int* length) {
+  if (body_buffer_.get() == NULL) {
+    *length = 0;
+    return NULL;
+  } else {
+    return body_buffer_->Detach(length);
   }
 }
 
@@ -4,6 +4,7 @@
 #ifndef YAHOO_CNET_CNET_RESPONSE_H_
 #define YAHOO_CNET_CNET_RESPONSE_H_
 
+#include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
 #include "net/http/http_response_info.h"
 #include "net/url_request/url_request_status.h"
@@ -12,24 +13,36 @@
 
 struct CnetLoadTiming;
 
+namespace base {
+class TaskRunner;
+}
+
 namespace net {
-class GrowableIOBuffer;
 class HttpResponseHeaders;
 }
 
 namespace cnet {
 
+class RopeBuffer;
+
 class Response : public base::RefCountedThreadSafe<Response> {
  public:
   Response(const std::string& initial_url,
       const GURL& original_url, const GURL& final_url,
-      scoped_refptr<net::GrowableIOBuffer> read_buffer,
+      scoped_refptr<RopeBuffer> body_buffer,
+      const base::FilePath& body_file_path,
+      scoped_refptr<base::TaskRunner> temp_file_runner,
       const UrlParams& url_params,
       scoped_ptr<CnetLoadTiming> load_timing,
       const net::URLRequestStatus& status, int http_response_code,
       scoped_refptr<net::HttpResponseHeaders> response_headers,
       scoped_ptr<net::HttpResponseInfo> response_info);
 
+  // A response for another fetcher of the same request, which shares the
+  // body of |source|, and keeps any temporary file of it alive.
+  Response(const std::string& initial_url, const GURL& original_url,
+      scoped_refptr<Response> source);
+
   const std::string& initial_url() { return initial_url_; }
   const GURL& original_url() { return original_url_; }
   const GURL& final_url() { return final_url_; }
@@ -65,20 +78,42 @@ class Response : public base::RefCountedThreadSafe<Response> {
             net::HttpResponseInfo::CONNECTION_INFO_QUIC1_SPDY3);
   }
 
+  // A contiguous view of the body.  If the body arrived in several chunks,
+  // the first call copies them into a single buffer.
   const char *response_body();
   int response_length();
 
+  // A scatter-gather view of the body, which never copies.
+  size_t response_chunk_count();
+  const char* response_chunk(size_t index, int* length);
+
+  // Transfer the body to the caller, who must free() it, leaving the
+  // response with an empty body.  Returns NULL if there is nothing to
+  // transfer.  It must not race with the other readers of the body.
+  char* DetachBody(int* length);
+
+  // The file that holds the body, if it was written to disk instead of
+  // memory.  A temporary file is deleted along with the response.
+  const base::FilePath& response_file_path() { return body_file_path_; }
+  bool response_file_is_temporary() {
+    return (temp_file_runner_.get() != NULL) ||
+        ((source_.get() != NULL) && source_->response_file_is_temporary());
+  }
+
  private:
   std::string initial_url_;
   GURL original_url_;
   GURL final_url_;
-  scoped_refptr<net::GrowableIOBuffer> read_buffer_;
+  scoped_refptr<RopeBuffer> body_buffer_;
+  base::FilePath body_file_path_;
+  scoped_refptr<base::TaskRunner> temp_file_runner_;
   UrlParams url_params_;
   scoped_ptr<CnetLoadTiming> timing_;
   net::URLRequestStatus status_;
   int http_response_code_;
   scoped_refptr<net::HttpResponseHeaders> response_headers_;
   scoped_ptr<net::HttpResponseInfo> response_info_;
+  scoped_refptr<Response> source_;
 
   virtual ~Response();
   friend class base::RefCountedThreadSafe<Response>;
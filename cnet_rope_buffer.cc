@@ -0,0 +1,244 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_rope_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/logging.h"
+#include "net/base/io_buffer.h"
+
+namespace cnet {
+
+// A chunk's memory comes from malloc(), rather than new[] as in the other
+// IOBuffers, so that Detach() can hand it to a caller that free()s it.
+class RopeBuffer::Chunk : public net::IOBuffer {
+ public:
+  explicit Chunk(int capacity)
+      : real_data_(static_cast<char*>(malloc(capacity))),
+        capacity_(capacity), offset_(0) {
+    CHECK(real_data_ != NULL);
+    data_ = real_data_;
+  }
+
+  int capacity() const { return capacity_; }
+  int offset() const { return offset_; }
+  int RemainingCapacity() const { return capacity_ - offset_; }
+  char* StartOfBuffer() { return real_data_; }
+
+  void set_offset(int offset) {
+    DCHECK((offset >= 0) && (offset <= capacity_));
+    offset_ = offset;
+    data_ = real_data_ + offset;
+  }
+
+  // Give up the memory; the chunk is then empty.
+  char* ReleaseData() {
+    char* data = real_data_;
+    real_data_ = NULL;
+    data_ = NULL;
+    capacity_ = 0;
+    offset_ = 0;
+    return data;
+  }
+
+ private:
+  virtual ~Chunk() override {
+    // Keep the base class from deleting our memory with delete[].
+    data_ = NULL;
+    free(real_data_);
+  }
+
+  char* real_data_;
+  int capacity_;
+  int offset_;
+
+  DISALLOW_COPY_AND_ASSIGN(Chunk);
+};
+
+RopeBuffer::RopeBuffer(int chunk_size)
+    : chunk_size_(chunk_size), size_(0), external_data_(NULL),
+      external_capacity_(0), external_size_(0), shared_(false) {
+  DCHECK(chunk_size_ > 0);
+}
+
+RopeBuffer::~RopeBuffer() {
+}
+
+void RopeBuffer::Reserve(int capacity) {
+  base::AutoLock lock(lock_);
+  if ((size_ == 0) && (capacity > 0) && (external_data_ == NULL)) {
+    chunks_.clear();
+    AppendChunk(capacity);
+  }
+}
+
+void RopeBuffer::SetExternalBuffer(char* data, int capacity) {
+  base::AutoLock lock(lock_);
+  if ((size_ == 0) && (data != NULL) && (capacity > 0)) {
+    chunks_.clear();
+    external_data_ = data;
+    external_capacity_ = capacity;
+  }
+}
+
+int RopeBuffer::NextChunkSize() {
+  base::AutoLock lock(lock_);
+  if (HasExternalRoomLocked()) {
+    return 0;
+  }
+  if (chunks_.empty() || (chunks_.back()->RemainingCapacity() == 0)) {
+    return chunk_size_;
+  }
+  return 0;
+}
+
+net::IOBuffer* RopeBuffer::GetWriteBuffer(int* length) {
+  base::AutoLock lock(lock_);
+  if (HasExternalRoomLocked()) {
+    external_write_buffer_ =
+        new net::WrappedIOBuffer(external_data_ + external_size_);
+    *length = external_capacity_ - external_size_;
+    return external_write_buffer_.get();
+  }
+  if (chunks_.empty() || (chunks_.back()->RemainingCapacity() == 0)) {
+    AppendChunk(chunk_size_);
+  }
+  *length = chunks_.back()->RemainingCapacity();
+  return chunks_.back().get();
+}
+
+void RopeBuffer::DidWrite(int bytes) {
+  base::AutoLock lock(lock_);
+  if (HasExternalRoomLocked()) {
+    DCHECK(bytes <= external_capacity_ - external_size_);
+    external_size_ += bytes;
+    size_ += bytes;
+    return;
+  }
+  DCHECK(!chunks_.empty());
+  Chunk* tail = chunks_.back().get();
+  DCHECK(bytes <= tail->RemainingCapacity());
+  tail->set_offset(tail->offset() + bytes);
+  size_ += bytes;
+}
+
+size_t RopeBuffer::chunk_count() {
+  base::AutoLock lock(lock_);
+  TrimLocked();
+  return ((external_size_ > 0) ? 1:0) + InternalChunkCountLocked();
+}
+
+const char* RopeBuffer::chunk_data(size_t index, int* length) {
+  base::AutoLock lock(lock_);
+  TrimLocked();
+  if (external_size_ > 0) {
+    if (index == 0) {
+      *length = external_size_;
+      return external_data_;
+    }
+    index--;
+  }
+  if (index >= InternalChunkCountLocked()) {
+    *length = 0;
+    return NULL;
+  }
+  *length = chunks_[index]->offset();
+  return chunks_[index]->StartOfBuffer();
+}
+
+const char* RopeBuffer::Flatten() {
+  base::AutoLock lock(lock_);
+  return FlattenLocked();
+}
+
+char* RopeBuffer::Detach(int* length) {
+  base::AutoLock lock(lock_);
+  *length = 0;
+  if ((FlattenLocked() == NULL) || (external_size_ > 0) || (size_ == 0)) {
+    // The caller already owns an external buffer.
+    return NULL;
+  }
+
+  if (shared_) {
+    char* data = static_cast<char*>(malloc(size_));
+    if (data != NULL) {
+      memcpy(data, chunks_[0]->StartOfBuffer(), size_);
+      *length = size_;
+    }
+    return data;
+  }
+
+  char* data = chunks_[0]->ReleaseData();
+  *length = size_;
+  chunks_.clear();
+  size_ = 0;
+  return data;
+}
+
+void RopeBuffer::Share() {
+  base::AutoLock lock(lock_);
+  FlattenLocked();
+  shared_ = true;
+}
+
+const char* RopeBuffer::FlattenLocked() {
+  TrimLocked();
+  size_t internal_count = InternalChunkCountLocked();
+  if (external_size_ > 0) {
+    if (internal_count == 0) {
+      return external_data_;
+    }
+  } else if (chunks_.empty()) {
+    return NULL;
+  } else if (chunks_.size() == 1) {
+    return chunks_[0]->StartOfBuffer();
+  }
+
+  // The body overflowed the external buffer, or spans several chunks, so
+  // move all of it into one chunk.
+  scoped_refptr<Chunk> flat(new Chunk(size_));
+  if (external_size_ > 0) {
+    memcpy(flat->data(), external_data_, external_size_);
+    flat->set_offset(external_size_);
+  }
+  for (ChunkList::const_iterator it = chunks_.begin(); it != chunks_.end();
+       ++it) {
+    memcpy(flat->data(), (*it)->StartOfBuffer(), (*it)->offset());
+    flat->set_offset(flat->offset() + (*it)->offset());
+  }
+  DCHECK(flat->offset() == size_);
+
+  chunks_.clear();
+  chunks_.push_back(flat);
+  external_data_ = NULL;
+  external_capacity_ = 0;
+  external_size_ = 0;
+  return flat->StartOfBuffer();
+}
+
+void RopeBuffer::AppendChunk(int capacity) {
+  chunks_.push_back(new Chunk(capacity));
+}
+
+bool RopeBuffer::HasExternalRoomLocked() const {
+  // Once the rope allocates a chunk, it never returns to the external buffer.
+  return (external_data_ != NULL) && chunks_.empty() &&
+      (external_size_ < external_capacity_);
+}
+
+size_t RopeBuffer::InternalChunkCountLocked() const {
+  // Only the tail chunk may be empty, and trimming drops it unless it's the
+  // only one.
+  return (size_ > external_size_) ? chunks_.size() : 0;
+}
+
+void RopeBuffer::TrimLocked() {
+  // A read that hits the end of the body may leave an empty tail.
+  while ((chunks_.size() > 1) && (chunks_.back()->offset() == 0)) {
+    chunks_.pop_back();
+  }
+}
+
+} // namespace cnet
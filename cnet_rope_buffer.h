@@ -0,0 +1,104 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_ROPE_BUFFER_H_
+#define YAHOO_CNET_CNET_ROPE_BUFFER_H_
+
+#include <vector>
+
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+
+namespace net {
+class IOBuffer;
+}
+
+namespace cnet {
+
+// Accumulates a response body as a list of chunks (a rope).  Growing the
+// body appends a new chunk, so previously received bytes are never copied.
+//
+// The fetcher writes into the rope from the network thread, and then hands
+// it to a Response, after which it is only read.  The readers are
+// thread safe.
+class RopeBuffer : public base::RefCountedThreadSafe<RopeBuffer> {
+ public:
+  explicit RopeBuffer(int chunk_size);
+
+  // Size the first chunk, such as when the content length is known.  This
+  // is ignored if the rope already contains data.
+  void Reserve(int capacity);
+
+  // Write the first |capacity| bytes of the body directly into |data|, which
+  // the caller owns and must keep valid for the life of the rope.  Bytes
+  // beyond the capacity go to chunks that the rope allocates.  This is
+  // ignored if the rope already contains data.
+  void SetExternalBuffer(char* data, int capacity);
+
+  // The size of the chunk that the next GetWriteBuffer() will allocate, or
+  // 0 if the tail chunk still has room.
+  int NextChunkSize();
+
+  // Get a buffer for the next read, with room for |*length| bytes.  The
+  // buffer stays valid until the next call to DidWrite().
+  net::IOBuffer* GetWriteBuffer(int* length);
+  // Commit |bytes| written into the buffer from GetWriteBuffer().
+  void DidWrite(int bytes);
+
+  // The number of bytes in the rope.
+  int size() const { return size_; }
+
+  // The number of bytes that landed in the external buffer.
+  int external_size() const { return external_size_; }
+
+  // Scatter-gather access to the chunks.  Empty chunks are never reported.
+  size_t chunk_count();
+  const char* chunk_data(size_t index, int* length);
+
+  // Get a contiguous view of the rope.  If the rope has more than one chunk,
+  // this copies them into a single chunk, which then replaces them; any
+  // pointer previously returned by chunk_data() is invalidated.
+  // Returns NULL if nothing was ever written.
+  const char* Flatten();
+
+  // Flatten the rope, and transfer its memory to the caller, who must
+  // release it with free().  The rope is then empty.  Returns NULL if the
+  // rope is empty, or if the body is in an external buffer, which the caller
+  // already owns.  A shared rope isn't emptied; the caller gets a copy.
+  char* Detach(int* length);
+
+  // Flatten the rope for several responses to read, after which it never
+  // changes.
+  void Share();
+
+ private:
+  class Chunk;
+
+  const char* FlattenLocked();
+  void AppendChunk(int capacity);
+  void TrimLocked();
+  bool HasExternalRoomLocked() const;
+  size_t InternalChunkCountLocked() const;
+
+  typedef std::vector<scoped_refptr<Chunk> > ChunkList;
+
+  int chunk_size_;
+  int size_;
+  ChunkList chunks_;
+
+  // The caller's buffer, which always holds the start of the body.
+  char* external_data_;
+  int external_capacity_;
+  int external_size_;
+  scoped_refptr<net::IOBuffer> external_write_buffer_;
+  bool shared_;
+  base::Lock lock_;
+
+  ~RopeBuffer();
+  friend class base::RefCountedThreadSafe<RopeBuffer>;
+  DISALLOW_COPY_AND_ASSIGN(RopeBuffer);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_ROPE_BUFFER_H_
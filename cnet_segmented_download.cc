@@ -0,0 +1,353 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_segmented_download.h"
+
+#include <inttypes.h>
+
+#include "base/bind.h"
+#include "base/files/file.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
+#include "net/http/http_response_headers.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+#include "yahoo/cnet/cnet_pool.h"
+#include "yahoo/cnet/cnet_response.h"
+
+namespace {
+
+const int kMaxSegments = 16;
+const int64 kDefaultMinSegmentSize = 1024 * 1024;
+
+} // namespace
+
+namespace cnet {
+
+SegmentedDownload::Segment::Segment()
+    : first_byte(0), last_byte(-1), received_bytes(0) {
+}
+
+SegmentedDownload::Segment::~Segment() {
+}
+
+SegmentedDownload::SegmentedDownload(scoped_refptr<Pool> pool,
+    const std::string& url, const base::FilePath& output_path,
+    int max_segments, CompletionCallback completion,
+    ProgressCallback progress)
+    : pool_(pool), url_(url), output_path_(output_path),
+      max_segments_(max_segments), min_segment_size_(kDefaultMinSegmentSize),
+      completion_(completion), progress_(progress), started_(false),
+      cancelled_(false), succeeded_(false), total_bytes_(-1),
+      segment_count_(0), active_segments_(0), user_data_(NULL) {
+  if (max_segments_ < 1) {
+    max_segments_ = 1;
+  } else if (max_segments_ > kMaxSegments) {
+    max_segments_ = kMaxSegments;
+  }
+}
+
+SegmentedDownload::~SegmentedDownload() {
+}
+
+void SegmentedDownload::SetHeader(const std::string& key,
+    const std::string& value) {
+  headers_[key] = value;
+}
+
+void SegmentedDownload::SetMinSegmentSize(int64 bytes) {
+  min_segment_size_ = (bytes > 0) ? bytes:kDefaultMinSegmentSize;
+}
+
+scoped_refptr<Fetcher> SegmentedDownload::CreateFetcher(
+    const std::string& method, Fetcher::CompletionCallback completion,
+    Fetcher::ProgressCallback download) {
+  scoped_refptr<Fetcher> fetcher(new Fetcher(pool_, url_, method,
+      completion, download, Fetcher::ProgressCallback()));
+  // Our state lives on the first work thread.
+  fetcher->SetWorkThread(0);
+  for (Headers::const_iterator it = headers_.begin(); it != headers_.end();
+       ++it) {
+    fetcher->SetHeader(it->first, it->second);
+  }
+  fetcher->set_user_data(user_data_);
+  return fetcher;
+}
+
+void SegmentedDownload::Start() {
+  if (!pool_->GetWorkTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&SegmentedDownload::Start, this));
+    return;
+  }
+
+  if (started_) {
+    return;
+  }
+  started_ = true;
+
+  if (cancelled_) {
+    Finish(NULL);
+    return;
+  }
+
+  probe_fetcher_ = CreateFetcher("HEAD",
+      base::Bind(&SegmentedDownload::OnProbeComplete, this),
+      Fetcher::ProgressCallback());
+  probe_fetcher_->Start();
+}
+
+void SegmentedDownload::Cancel() {
+  if (!pool_->GetWorkTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&SegmentedDownload::Cancel, this));
+    return;
+  }
+
+  if (cancelled_) {
+    return;
+  }
+  cancelled_ = true;
+
+  // Each fetcher still runs its completion, which finishes the download.
+  if (probe_fetcher_.get() != NULL) {
+    probe_fetcher_->Cancel();
+  }
+  if (single_fetcher_.get() != NULL) {
+    single_fetcher_->Cancel();
+  }
+  for (size_t i = 0; i < segments_.size(); i++) {
+    if (segments_[i].fetcher.get() != NULL) {
+      segments_[i].fetcher->Cancel();
+    }
+  }
+}
+
+void SegmentedDownload::OnProbeComplete(scoped_refptr<Fetcher> fetcher,
+    scoped_refptr<Response> response) {
+  probe_fetcher_ = NULL;
+  probe_response_ = response;
+
+  if (cancelled_) {
+    Finish(response);
+    return;
+  }
+
+  scoped_refptr<net::HttpResponseHeaders> headers =
+      response->response_headers();
+  if (!response->status().is_success() ||
+      (response->http_response_code() != 200) || (headers.get() == NULL) ||
+      !headers->HasHeaderValue("Accept-Ranges", "bytes")) {
+    // Let a normal download sort out what the server supports.
+    StartSingle();
+    return;
+  }
+
+  total_bytes_ = headers->GetContentLength();
+  int segments = max_segments_;
+  if (total_bytes_ / min_segment_size_ < segments) {
+    segments = static_cast<int>(total_bytes_ / min_segment_size_);
+  }
+  if (segments < 2) {
+    StartSingle();
+    return;
+  }
+
+  // Have every range come from the same version of the file.  A weak
+  // ETag isn't allowed in If-Range.
+  std::string etag;
+  if (headers->EnumerateHeader(NULL, "ETag", &etag) &&
+      !StartsWithASCII(etag, "W/", true)) {
+    validator_ = etag;
+  } else {
+    headers->EnumerateHeader(NULL, "Last-Modified", &validator_);
+  }
+
+  int64 segment_size = total_bytes_ / segments;
+  segment_count_ = segments;
+  segments_.resize(segments);
+  for (int i = 0; i < segments; i++) {
+    segments_[i].first_byte = i * segment_size;
+    segments_[i].last_byte = (i == segments - 1) ?
+        (total_bytes_ - 1):((i + 1) * segment_size - 1);
+  }
+
+  pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&SegmentedDownload::FileCreate, this, total_bytes_));
+}
+
+void SegmentedDownload::StartSingle() {
+  segment_count_ = 1;
+  single_fetcher_ = CreateFetcher("GET",
+      base::Bind(&SegmentedDownload::OnSingleComplete, this),
+      base::Bind(&SegmentedDownload::OnSingleProgress, this));
+  single_fetcher_->SetOutputFilePath(output_path_);
+  single_fetcher_->Start();
+}
+
+void SegmentedDownload::OnSingleProgress(scoped_refptr<Fetcher> fetcher,
+    int64_t current, int64_t total) {
+  if (!progress_.is_null()) {
+    progress_.Run(this, current, total);
+  }
+}
+
+void SegmentedDownload::OnSingleComplete(scoped_refptr<Fetcher> fetcher,
+    scoped_refptr<Response> response) {
+  single_fetcher_ = NULL;
+
+  int code = response->http_response_code();
+  if (!cancelled_ && response->status().is_success() &&
+      (code >= 200) && (code < 300)) {
+    succeeded_ = true;
+    Finish(response);
+  } else {
+    FileDelete(response);
+  }
+}
+
+void SegmentedDownload::FileCreate(int64 length) {
+  base::File file(output_path_,
+      base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+  bool success = file.IsValid() && file.SetLength(length);
+  if (!success && (pool_->log_level() > 0)) {
+    LOG(ERROR) << "Failed to create output file: " << output_path_.value();
+  }
+
+  pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&SegmentedDownload::OnFileCreated, this, success));
+}
+
+void SegmentedDownload::OnFileCreated(bool success) {
+  if (cancelled_ || !success) {
+    segments_.clear();
+    FileDelete(probe_response_);
+    return;
+  }
+
+  StartSegments();
+}
+
+void SegmentedDownload::StartSegments() {
+  for (size_t i = 0; i < segments_.size(); i++) {
+    Segment& segment = segments_[i];
+    segment.fetcher = CreateFetcher("GET",
+        base::Bind(&SegmentedDownload::OnSegmentComplete, this, i),
+        base::Bind(&SegmentedDownload::OnSegmentProgress, this, i));
+    segment.fetcher->SetHeader("Range", base::StringPrintf(
+        "bytes=%" PRId64 "-%" PRId64, segment.first_byte, segment.last_byte));
+    if (!validator_.empty()) {
+      segment.fetcher->SetHeader("If-Range", validator_);
+    }
+    segment.fetcher->SetCacheBehavior(Fetcher::CACHE_DISABLE);
+    segment.fetcher->SetOutputFileRegion(output_path_, segment.first_byte);
+  }
+
+  active_segments_ = static_cast<int>(segments_.size());
+  for (size_t i = 0; i < segments_.size(); i++) {
+    segments_[i].fetcher->Start();
+  }
+}
+
+void SegmentedDownload::OnSegmentProgress(size_t index,
+    scoped_refptr<Fetcher> fetcher, int64_t current, int64_t total) {
+  segments_[index].received_bytes = current;
+
+  if (!progress_.is_null()) {
+    int64 received = 0;
+    for (size_t i = 0; i < segments_.size(); i++) {
+      received += segments_[i].received_bytes;
+    }
+    progress_.Run(this, received, total_bytes_);
+  }
+}
+
+bool SegmentedDownload::IsSegmentComplete(const Segment& segment,
+    scoped_refptr<Response> response) {
+  // A 200 means that the server ignored the range, or that the file
+  // changed since the probe.
+  if (!response->status().is_success() ||
+      (response->http_response_code() != 206)) {
+    return false;
+  }
+
+  scoped_refptr<net::HttpResponseHeaders> headers =
+      response->response_headers();
+  int64 first_byte = -1;
+  int64 last_byte = -1;
+  int64 length = -1;
+  if ((headers.get() == NULL) ||
+      !headers->GetContentRange(&first_byte, &last_byte, &length) ||
+      (first_byte != segment.first_byte) ||
+      (last_byte != segment.last_byte) || (length != total_bytes_)) {
+    return false;
+  }
+
+  return segment.received_bytes == (segment.last_byte - segment.first_byte + 1);
+}
+
+void SegmentedDownload::OnSegmentComplete(size_t index,
+    scoped_refptr<Fetcher> fetcher, scoped_refptr<Response> response) {
+  active_segments_--;
+
+  if ((failed_response_.get() == NULL) &&
+      (cancelled_ || !IsSegmentComplete(segments_[index], response))) {
+    if (pool_->log_level() > 0) {
+      LOG(ERROR) << "Segment " << index << " failed <" << url_ << ">";
+    }
+    failed_response_ = response;
+
+    // Stop the rest of the segments.
+    for (size_t i = 0; i < segments_.size(); i++) {
+      if (i != index) {
+        segments_[i].fetcher->Cancel();
+      }
+    }
+  }
+
+  if (active_segments_ > 0) {
+    return;
+  }
+
+  // Wait for every segment before removing the file that they write into.
+  segments_.clear();
+  if (failed_response_.get() != NULL) {
+    FileDelete(failed_response_);
+  } else {
+    // The last segment's response reports the output file.
+    succeeded_ = true;
+    Finish(response);
+  }
+}
+
+void SegmentedDownload::FileDelete(scoped_refptr<Response> response) {
+  if (!pool_->GetFileTaskRunner()->RunsTasksOnCurrentThread()) {
+    pool_->GetFileTaskRunner()->PostTask(FROM_HERE,
+        base::Bind(&SegmentedDownload::FileDelete, this, response));
+    return;
+  }
+
+  if (!base::DeleteFile(output_path_, false) && (pool_->log_level() > 0)) {
+    LOG(ERROR) << "Failed to remove output file: " << output_path_.value();
+  }
+
+  pool_->GetWorkTaskRunner()->PostTask(FROM_HERE,
+      base::Bind(&SegmentedDownload::Finish, this, response));
+}
+
+void SegmentedDownload::Finish(scoped_refptr<Response> response) {
+  // Ensure that we never invoke the completion again.
+  CompletionCallback completion = completion_;
+  completion_.Reset();
+  progress_.Reset();
+
+  probe_response_ = NULL;
+  failed_response_ = NULL;
+
+  if (!completion.is_null()) {
+    completion.Run(this, response);
+  }
+}
+
+} // namespace cnet
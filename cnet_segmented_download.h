@@ -0,0 +1,126 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_SEGMENTED_DOWNLOAD_H_
+#define YAHOO_CNET_CNET_SEGMENTED_DOWNLOAD_H_
+
+#include <string>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+#include "yahoo/cnet/cnet_headers.h"
+
+namespace cnet {
+
+class Pool;
+class Response;
+
+// Downloads a large file over several connections at once.  It probes the
+// URL with a HEAD request, and if the server reports a content length and
+// accepts byte ranges, it presizes the output file and fetches contiguous
+// ranges of it in parallel, each with its own fetcher writing into its own
+// region of the file.  Otherwise it falls back to a single fetcher.
+//
+// The callbacks run on the pool's work thread.  The completion receives
+// the response of the last fetcher to finish on success, whose body file
+// is the output file, or the response of the first fetcher that failed; a
+// failed download removes the output file.
+class SegmentedDownload
+    : public base::RefCountedThreadSafe<SegmentedDownload> {
+ public:
+  typedef base::Callback<void(scoped_refptr<SegmentedDownload> download,
+      scoped_refptr<Response> response)> CompletionCallback;
+  typedef base::Callback<void(scoped_refptr<SegmentedDownload> download,
+      int64_t current, int64_t total)> ProgressCallback;
+
+  SegmentedDownload(scoped_refptr<Pool> pool, const std::string& url,
+      const base::FilePath& output_path, int max_segments,
+      CompletionCallback completion, ProgressCallback progress);
+
+  void SetHeader(const std::string& key, const std::string& value);
+
+  // Don't split the file into ranges smaller than |bytes|.
+  void SetMinSegmentSize(int64 bytes);
+
+  void set_user_data(void* user_data) { user_data_ = user_data; }
+  void* get_user_data() { return user_data_; }
+
+  void Start();
+  void Cancel();
+
+  // Valid once the completion runs.
+  bool succeeded() const { return succeeded_; }
+  int segment_count() const { return segment_count_; }
+
+ private:
+  struct Segment {
+    Segment();
+    ~Segment();
+
+    scoped_refptr<Fetcher> fetcher;
+    int64 first_byte;
+    int64 last_byte;
+    int64 received_bytes;
+  };
+
+  scoped_refptr<Fetcher> CreateFetcher(const std::string& method,
+      Fetcher::CompletionCallback completion,
+      Fetcher::ProgressCallback download);
+
+  void OnProbeComplete(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+  void StartSingle();
+  void OnSingleProgress(scoped_refptr<Fetcher> fetcher,
+      int64_t current, int64_t total);
+  void OnSingleComplete(scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+
+  void FileCreate(int64 length);
+  void OnFileCreated(bool success);
+  void StartSegments();
+  void OnSegmentProgress(size_t index, scoped_refptr<Fetcher> fetcher,
+      int64_t current, int64_t total);
+  void OnSegmentComplete(size_t index, scoped_refptr<Fetcher> fetcher,
+      scoped_refptr<Response> response);
+  bool IsSegmentComplete(const Segment& segment,
+      scoped_refptr<Response> response);
+
+  void FileDelete(scoped_refptr<Response> response);
+  void Finish(scoped_refptr<Response> response);
+
+  scoped_refptr<Pool> pool_;
+  std::string url_;
+  base::FilePath output_path_;
+  int max_segments_;
+  int64 min_segment_size_;
+  Headers headers_;
+  CompletionCallback completion_;
+  ProgressCallback progress_;
+
+  // Only accessed on the work thread, once started.
+  bool started_;
+  bool cancelled_;
+  bool succeeded_;
+  scoped_refptr<Fetcher> probe_fetcher_;
+  scoped_refptr<Fetcher> single_fetcher_;
+  scoped_refptr<Response> probe_response_;
+  scoped_refptr<Response> failed_response_;
+  std::string validator_;
+  int64 total_bytes_;
+  int segment_count_;
+  std::vector<Segment> segments_;
+  int active_segments_;
+
+  void* user_data_;
+
+  ~SegmentedDownload();
+  friend class base::RefCountedThreadSafe<SegmentedDownload>;
+  DISALLOW_COPY_AND_ASSIGN(SegmentedDownload);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_SEGMENTED_DOWNLOAD_H_
@@ -0,0 +1,27 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_ssl_config_service.h"
+
+#include <algorithm>
+
+namespace cnet {
+
+SSLConfigService::SSLConfigService(bool enable_ssl_false_start) {
+  config_.false_start_enabled = enable_ssl_false_start;
+  config_.require_forward_secrecy = true;
+
+  config_.version_min = std::max(
+      static_cast<uint16>(net::SSL_PROTOCOL_VERSION_TLS1),
+      net::kDefaultSSLVersionMin);
+  config_.version_max = net::kDefaultSSLVersionMax;
+}
+
+SSLConfigService::~SSLConfigService() {
+}
+
+void SSLConfigService::GetSSLConfig(net::SSLConfig *config) {
+  *config = config_;
+}
+
+} // namespace cnet
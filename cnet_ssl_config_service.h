@@ -0,0 +1,30 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_SSL_CONFIG_SERVICE_H_
+#define YAHOO_CNET_CNET_SSL_CONFIG_SERVICE_H_
+
+#include "net/ssl/ssl_config.h"
+#include "net/ssl/ssl_config_service.h"
+
+namespace cnet {
+
+// The SSL settings of a pool's sessions, or of an engine's shared sessions.
+class SSLConfigService : public net::SSLConfigService {
+ public:
+  SSLConfigService(bool enable_ssl_false_start);
+
+  // Overrides from net::SSLConfigService:
+  virtual void GetSSLConfig(net::SSLConfig* config) override;
+
+ private:
+  virtual ~SSLConfigService();
+
+  net::SSLConfig config_;
+
+  DISALLOW_COPY_AND_ASSIGN(SSLConfigService);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_SSL_CONFIG_SERVICE_H_
@@ -0,0 +1,156 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_tag_registry.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "yahoo/cnet/cnet_fetcher.h"
+
+namespace cnet {
+
+TagRegistry::TagStats::TagStats()
+    : fetchers(0), in_flight(0), received_bytes(0) {
+}
+
+TagRegistry::TagEntry::TagEntry()
+    : in_flight(0), received_bytes(0) {
+}
+
+TagRegistry::TagEntry::~TagEntry() {
+}
+
+TagRegistry::FetcherEntry::FetcherEntry()
+    : started(false) {
+}
+
+TagRegistry::FetcherEntry::~FetcherEntry() {
+}
+
+TagRegistry::TagRegistry() {
+}
+
+TagRegistry::~TagRegistry() {
+}
+
+void TagRegistry::Add(scoped_refptr<Fetcher> fetcher, int tag) {
+  if (fetcher.get() == NULL) {
+    return;
+  }
+
+  base::AutoLock lock(lock_);
+  FetcherEntry& fetcher_entry = fetchers_[fetcher.get()];
+  if (std::find(fetcher_entry.tags.begin(), fetcher_entry.tags.end(), tag) !=
+      fetcher_entry.tags.end()) {
+    return;
+  }
+  fetcher_entry.fetcher = fetcher;
+  fetcher_entry.tags.push_back(tag);
+
+  TagEntry& tag_entry = tags_[tag];
+  tag_entry.fetchers.insert(fetcher.get());
+  if (fetcher_entry.started) {
+    tag_entry.in_flight++;
+  }
+}
+
+void TagRegistry::Remove(scoped_refptr<Fetcher> fetcher) {
+  // Drop the registry's reference outside of the lock.
+  scoped_refptr<Fetcher> removed;
+
+  base::AutoLock lock(lock_);
+  FetcherMap::iterator it = fetchers_.find(fetcher.get());
+  if (it == fetchers_.end()) {
+    return;
+  }
+
+  const FetcherEntry& fetcher_entry = it->second;
+  for (size_t i = 0; i < fetcher_entry.tags.size(); i++) {
+    TagMap::iterator tag_it = tags_.find(fetcher_entry.tags[i]);
+    DCHECK(tag_it != tags_.end());
+    TagEntry& tag_entry = tag_it->second;
+    tag_entry.fetchers.erase(fetcher.get());
+    if (fetcher_entry.started) {
+      tag_entry.in_flight--;
+    }
+    if (tag_entry.fetchers.empty()) {
+      tags_.erase(tag_it);
+    }
+  }
+
+  removed = fetcher_entry.fetcher;
+  fetchers_.erase(it);
+}
+
+void TagRegistry::GetFetchers(int tag, Fetchers* fetchers) const {
+  base::AutoLock lock(lock_);
+  TagMap::const_iterator it = tags_.find(tag);
+  if (it == tags_.end()) {
+    return;
+  }
+
+  fetchers->reserve(fetchers->size() + it->second.fetchers.size());
+  for (base::hash_set<Fetcher*>::const_iterator fetcher_it =
+           it->second.fetchers.begin();
+       fetcher_it != it->second.fetchers.end(); ++fetcher_it) {
+    fetchers->push_back(*fetcher_it);
+  }
+}
+
+bool TagRegistry::GetFirstTag(scoped_refptr<Fetcher> fetcher,
+    int* tag) const {
+  base::AutoLock lock(lock_);
+  FetcherMap::const_iterator it = fetchers_.find(fetcher.get());
+  if (it == fetchers_.end()) {
+    return false;
+  }
+
+  DCHECK(!it->second.tags.empty());
+  *tag = it->second.tags.front();
+  return true;
+}
+
+void TagRegistry::FetcherStarted(scoped_refptr<Fetcher> fetcher) {
+  base::AutoLock lock(lock_);
+  FetcherMap::iterator it = fetchers_.find(fetcher.get());
+  if ((it == fetchers_.end()) || it->second.started) {
+    return;
+  }
+
+  it->second.started = true;
+  for (size_t i = 0; i < it->second.tags.size(); i++) {
+    tags_[it->second.tags[i]].in_flight++;
+  }
+}
+
+void TagRegistry::FetcherReceivedBytes(Fetcher* fetcher, int64 bytes) {
+  base::AutoLock lock(lock_);
+  if (fetchers_.empty()) {
+    return;
+  }
+  FetcherMap::const_iterator it = fetchers_.find(fetcher);
+  if (it == fetchers_.end()) {
+    return;
+  }
+
+  for (size_t i = 0; i < it->second.tags.size(); i++) {
+    tags_[it->second.tags[i]].received_bytes += bytes;
+  }
+}
+
+void TagRegistry::GetTagStats(int tag, TagStats* stats) const {
+  *stats = TagStats();
+
+  base::AutoLock lock(lock_);
+  TagMap::const_iterator it = tags_.find(tag);
+  if (it == tags_.end()) {
+    return;
+  }
+
+  stats->fetchers = it->second.fetchers.size();
+  stats->in_flight = it->second.in_flight;
+  stats->received_bytes = it->second.received_bytes;
+}
+
+} // namespace cnet
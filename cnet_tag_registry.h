@@ -0,0 +1,83 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_TAG_REGISTRY_H_
+#define YAHOO_CNET_CNET_TAG_REGISTRY_H_
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/containers/hash_tables.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+
+namespace cnet {
+
+class Fetcher;
+
+// Indexes fetchers by tag, so that operations on every fetcher with a tag,
+// such as a screen's worth of requests, don't touch the others.  A fetcher
+// may have several tags, and leaves all of them when it's removed.  A tag
+// goes away with its last fetcher, along with its counters.  It is thread
+// safe.
+class TagRegistry {
+ public:
+  typedef std::vector<scoped_refptr<Fetcher> > Fetchers;
+
+  struct TagStats {
+    TagStats();
+
+    // The fetchers with the tag, and those of them that have started.
+    int64 fetchers;
+    int64 in_flight;
+    // The body bytes that the tag's fetchers have received.
+    int64 received_bytes;
+  };
+
+  TagRegistry();
+  ~TagRegistry();
+
+  void Add(scoped_refptr<Fetcher> fetcher, int tag);
+  void Remove(scoped_refptr<Fetcher> fetcher);
+
+  void GetFetchers(int tag, Fetchers* fetchers) const;
+  // Return false if |fetcher| has no tag.
+  bool GetFirstTag(scoped_refptr<Fetcher> fetcher, int* tag) const;
+
+  void FetcherStarted(scoped_refptr<Fetcher> fetcher);
+  void FetcherReceivedBytes(Fetcher* fetcher, int64 bytes);
+
+  void GetTagStats(int tag, TagStats* stats) const;
+
+ private:
+  struct TagEntry {
+    TagEntry();
+    ~TagEntry();
+
+    base::hash_set<Fetcher*> fetchers;
+    int64 in_flight;
+    int64 received_bytes;
+  };
+
+  struct FetcherEntry {
+    FetcherEntry();
+    ~FetcherEntry();
+
+    scoped_refptr<Fetcher> fetcher;
+    std::vector<int> tags;
+    bool started;
+  };
+
+  typedef base::hash_map<int, TagEntry> TagMap;
+  typedef base::hash_map<Fetcher*, FetcherEntry> FetcherMap;
+
+  TagMap tags_;
+  FetcherMap fetchers_;
+  mutable base::Lock lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(TagRegistry);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_TAG_REGISTRY_H_
@@ -11,20 +11,47 @@
 //   https://code.google.com/p/googletest/wiki/Primer
 //   https://www.chromium.org/developers/testing
 
+#include <inttypes.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
 #include "base/metrics/statistics_recorder.h"
 #include "base/run_loop.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
 #include "base/test/launcher/unit_test_launcher.h"
+#include "base/threading/platform_thread.h"
+#include "net/base/io_buffer.h"
+#include "net/base/net_errors.h"
 #include "net/http/http_response_headers.h"
 #include "net/socket/client_socket_pool_base.h"
 #include "net/socket/ssl_server_socket.h"
+#include "net/test/embedded_test_server/embedded_test_server.h"
+#include "net/test/embedded_test_server/http_request.h"
+#include "net/test/embedded_test_server/http_response.h"
 #include "net/test/net_test_suite.h"
 #include "net/test/spawned_test_server/spawned_test_server.h"
 #include "testing/gtest/include/gtest/gtest.h"
 #include "testing/platform_test.h"
+#include "third_party/zlib/zlib.h"
 #include "yahoo/cnet/cnet.h"
+#include "yahoo/cnet/cnet_engine.h"
 #include "yahoo/cnet/cnet_fetcher.h"
+#include "yahoo/cnet/cnet_parallel_upload.h"
 #include "yahoo/cnet/cnet_pool.h"
+#include "yahoo/cnet/cnet_progress_coalescer.h"
+#include "yahoo/cnet/cnet_read_buffer_pool.h"
+#include "yahoo/cnet/cnet_request_scheduler.h"
 #include "yahoo/cnet/cnet_response.h"
+#include "yahoo/cnet/cnet_rope_buffer.h"
+#include "yahoo/cnet/cnet_segmented_download.h"
+#include "yahoo/cnet/cnet_tag_registry.h"
 
 using net::internal::ClientSocketPoolBaseHelper;
 
@@ -39,6 +66,179 @@ class LocalHttpTestServer : public net::SpawnedTestServer {
             "127.0.0.1", base::FilePath()) {}
 };
 
+// A local stand-in for the S3 multi-part upload API.  It fails the first
+// attempt at part 2, so that the part is retried.
+class FakeS3Server {
+ public:
+  FakeS3Server() : failed_part_(false), aborted_(false) {}
+
+  scoped_ptr<net::test_server::HttpResponse> HandleRequest(
+      const net::test_server::HttpRequest& request) {
+    // On the server's thread.
+    base::AutoLock lock(lock_);
+    scoped_ptr<net::test_server::BasicHttpResponse> response(
+        new net::test_server::BasicHttpResponse());
+    const std::string& url = request.relative_url;
+    size_t part_param = url.find("partNumber=");
+
+    if ((request.method == net::test_server::METHOD_POST) &&
+        EndsWith(url, "?uploads", true)) {
+      response->set_content("<InitiateMultipartUploadResult>"
+          "<UploadId>upload-1</UploadId></InitiateMultipartUploadResult>");
+    } else if ((request.method == net::test_server::METHOD_PUT) &&
+               (part_param != std::string::npos)) {
+      int number = atoi(url.c_str() + part_param + strlen("partNumber="));
+      if ((number == 2) && !failed_part_) {
+        failed_part_ = true;
+        response->set_code(net::HTTP_INTERNAL_SERVER_ERROR);
+        return response.Pass();
+      }
+      parts_[number] = request.content;
+      response->AddCustomHeader("ETag",
+          "\"etag-" + base::IntToString(number) + "\"");
+    } else if (request.method == net::test_server::METHOD_POST) {
+      // Assemble the parts in the listed order, checking their ETags.
+      const std::string& body = request.content;
+      size_t pos = 0;
+      while ((pos = body.find("<PartNumber>", pos)) != std::string::npos) {
+        pos += strlen("<PartNumber>");
+        int number = atoi(body.c_str() + pos);
+        std::string etag =
+            "<ETag>\"etag-" + base::IntToString(number) + "\"</ETag>";
+        if (body.find(etag, pos) == std::string::npos) {
+          response->set_code(net::HTTP_BAD_REQUEST);
+          return response.Pass();
+        }
+        object_ += parts_[number];
+      }
+      response->set_content("<CompleteMultipartUploadResult/>");
+    } else if (request.method == net::test_server::METHOD_DELETE) {
+      aborted_ = true;
+    } else {
+      response->set_code(net::HTTP_NOT_FOUND);
+    }
+    return response.Pass();
+  }
+
+  std::string object() {
+    base::AutoLock lock(lock_);
+    return object_;
+  }
+
+  bool aborted() {
+    base::AutoLock lock(lock_);
+    return aborted_;
+  }
+
+ private:
+  base::Lock lock_;
+  std::map<int, std::string> parts_;
+  std::string object_;
+  bool failed_part_;
+  bool aborted_;
+};
+
+// A response written out verbatim, such as headers without a body.
+class RawHttpResponse : public net::test_server::HttpResponse {
+ public:
+  explicit RawHttpResponse(const std::string& raw) : raw_(raw) {}
+
+  virtual std::string ToResponseString() const override { return raw_; }
+
+ private:
+  std::string raw_;
+};
+
+// A local server for one file that honors byte ranges, like a CDN.  A HEAD
+// advertises the ranges, and a range that doesn't match the If-Range
+// validator gets the whole file.
+class FakeRangeServer {
+ public:
+  FakeRangeServer(const std::string& content, const std::string& etag)
+      : content_(content), etag_(etag), range_requests_(0) {}
+
+  scoped_ptr<net::test_server::HttpResponse> HandleRequest(
+      const net::test_server::HttpRequest& request) {
+    // On the server's thread.
+    base::AutoLock lock(lock_);
+    requests_.push_back(request.headers);
+
+    if (request.method == net::test_server::METHOD_HEAD) {
+      return scoped_ptr<net::test_server::HttpResponse>(new RawHttpResponse(
+          base::StringPrintf("HTTP/1.1 200 OK\r\n"
+              "Accept-Ranges: bytes\r\n"
+              "Content-Length: %d\r\n"
+              "ETag: %s\r\n\r\n",
+              static_cast<int>(content_.size()), etag_.c_str())));
+    }
+
+    scoped_ptr<net::test_server::BasicHttpResponse> response(
+        new net::test_server::BasicHttpResponse());
+    response->AddCustomHeader("Accept-Ranges", "bytes");
+    response->AddCustomHeader("ETag", etag_);
+
+    int64 first_byte = 0;
+    int64 last_byte = static_cast<int64>(content_.size()) - 1;
+    std::map<std::string, std::string>::const_iterator range =
+        request.headers.find("Range");
+    std::map<std::string, std::string>::const_iterator if_range =
+        request.headers.find("If-Range");
+    if ((range != request.headers.end()) &&
+        ((if_range == request.headers.end()) ||
+         (if_range->second == etag_)) &&
+        ParseRange(range->second, &first_byte, &last_byte)) {
+      range_requests_++;
+      response->set_code(net::HTTP_PARTIAL_CONTENT);
+      response->AddCustomHeader("Content-Range", base::StringPrintf(
+          "bytes %" PRId64 "-%" PRId64 "/%d", first_byte, last_byte,
+          static_cast<int>(content_.size())));
+      response->set_content(
+          content_.substr(first_byte, last_byte - first_byte + 1));
+    } else {
+      response->set_content(content_);
+    }
+    return response.Pass();
+  }
+
+  int range_requests() {
+    base::AutoLock lock(lock_);
+    return range_requests_;
+  }
+
+  // The headers of every request so far.
+  std::vector<std::map<std::string, std::string> > requests() {
+    base::AutoLock lock(lock_);
+    return requests_;
+  }
+
+ private:
+  // Only "bytes=first-last" and "bytes=first-".
+  bool ParseRange(const std::string& value, int64* first_byte,
+      int64* last_byte) {
+    if (!StartsWithASCII(value, "bytes=", true)) {
+      return false;
+    }
+    std::string spec = value.substr(strlen("bytes="));
+    size_t dash = spec.find('-');
+    if ((dash == std::string::npos) ||
+        !base::StringToInt64(spec.substr(0, dash), first_byte)) {
+      return false;
+    }
+    if ((dash + 1 < spec.size()) &&
+        !base::StringToInt64(spec.substr(dash + 1), last_byte)) {
+      return false;
+    }
+    return (*first_byte >= 0) && (*first_byte <= *last_byte) &&
+        (*last_byte < static_cast<int64>(content_.size()));
+  }
+
+  base::Lock lock_;
+  std::string content_;
+  std::string etag_;
+  int range_requests_;
+  std::vector<std::map<std::string, std::string> > requests_;
+};
+
 class PoolTest : public PlatformTest {
  public:
   PoolTest()
@@ -47,15 +247,18 @@ class PoolTest : public PlatformTest {
     options.message_loop_type = base::MessageLoop::TYPE_UI;
     ui_thread_ = new base::Thread("cnet-ui");
     ui_thread_->StartWithOptions(options);
+  }
 
+  virtual ~PoolTest() { }
+
+  virtual void SetUp() override {
     cnet::Pool::Config config;
     config.user_agent = "cnet-unittest";
+    ConfigurePool(&config);
     pool_ = new cnet::Pool(ui_thread_->task_runner(), config);
     pool_->Start();
   }
 
-  virtual ~PoolTest() { }
-
   virtual void TearDown() override {
     StartDelete();
     quit_event_.Wait();
@@ -63,6 +266,9 @@ class PoolTest : public PlatformTest {
   }
 
  protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) {
+  }
+
   void StartDelete() {
     if (!pool_->GetNetworkTaskRunner()->RunsTasksOnCurrentThread()) {
       pool_->GetNetworkTaskRunner()->PostTask(FROM_HERE,
@@ -101,7 +307,11 @@ class FetcherTest : public PoolTest {
       : completed_event_(false, false),
         test_server_(base::FilePath(FILE_PATH_LITERAL(
             "yahoo/cnet/data/cnet_unittest"))),
-        download_progress_(0), upload_progress_(0) {
+        download_progress_(0), upload_progress_(0),
+        download_succeeded_(false), upload_succeeded_(false),
+        upload_source_offset_(0),
+        upload_buffer_released_(false), completed_on_network_(false),
+        completed_after_release_(false) {
   }
  
   void Reset() {
@@ -118,6 +328,23 @@ class FetcherTest : public PoolTest {
     completed_event_.Signal();
   }
 
+  void OnInlineFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On the fetcher's network thread.
+    completed_on_network_ = pool_->GetShardTaskRunner(
+        pool_->GetShardForUrl(response->original_url()))->
+            RunsTasksOnCurrentThread();
+    OnFetcherCompleted(fetcher, response);
+  }
+
+  void OnInlineStreamCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // What the inline data and release callbacks did before the completion.
+    completed_streamed_body_ = streamed_body_;
+    completed_after_release_ = upload_buffer_released_;
+    OnInlineFetcherCompleted(fetcher, response);
+  }
+
   void OnFetcherDownloadProgress(scoped_refptr<cnet::Fetcher> fetcher,
       int64_t current, int64_t total) {
     // On work thread.
@@ -130,6 +357,51 @@ class FetcherTest : public PoolTest {
     upload_progress_ = current;
   }
 
+  void OnDownloadCompleted(scoped_refptr<cnet::SegmentedDownload> download,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    download_succeeded_ = download->succeeded();
+    response_ = response;
+    completed_event_.Signal();
+  }
+
+  void OnUploadCompleted(scoped_refptr<cnet::ParallelUpload> upload,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    upload_succeeded_ = upload->succeeded();
+    response_ = response;
+    completed_event_.Signal();
+  }
+
+  void OnUploadProgress(scoped_refptr<cnet::ParallelUpload> upload,
+      int64_t current, int64_t total) {
+    // On work thread.
+    upload_progress_ = current;
+  }
+
+  int OnFetcherUploadRead(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<net::IOBuffer> buffer, int length) {
+    // On work thread.  Supply the body a few bytes at a time.
+    int chunk = std::min(std::min(length, 4),
+        (int)(upload_source_.length() - upload_source_offset_));
+    memcpy(buffer->data(), upload_source_.data() + upload_source_offset_,
+        chunk);
+    upload_source_offset_ += chunk;
+    return chunk;
+  }
+
+  void OnUploadBufferReleased() {
+    // On work thread, or inline on the network thread.
+    upload_buffer_released_ = true;
+  }
+
+  void OnFetcherData(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<net::IOBuffer> buffer, int length) {
+    // On work thread, or inline on the network thread.
+    streamed_body_.append(buffer->data(), length);
+    fetcher->AckData();
+  }
+
  protected:
   scoped_refptr<cnet::Response> WaitForCompletion() {
     completed_event_.Wait();
@@ -141,6 +413,15 @@ class FetcherTest : public PoolTest {
   scoped_refptr<cnet::Response> response_;
   int64 download_progress_;
   int64 upload_progress_;
+  bool download_succeeded_;
+  bool upload_succeeded_;
+  std::string streamed_body_;
+  std::string upload_source_;
+  size_t upload_source_offset_;
+  bool upload_buffer_released_;
+  bool completed_on_network_;
+  std::string completed_streamed_body_;
+  bool completed_after_release_;
 };
 
 TEST_F(FetcherTest, SimpleFetch) {
@@ -177,111 +458,1614 @@ TEST_F(FetcherTest, SimpleFetch) {
   EXPECT_EQ(download_progress_, response->response_length());
 }
 
-TEST_F(FetcherTest, FetchError) {
+TEST_F(FetcherTest, InlineCallbacks) {
   ASSERT_TRUE(test_server_.Start());
 
-  std::string url(test_server_.GetURL("close-socket").spec());
+  std::string url(test_server_.GetURL("files/hello.html").spec());
   scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
       pool_, url, "GET",
-      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnInlineFetcherCompleted,
+          base::Unretained(this)),
       base::Bind(&FetcherTest::OnFetcherDownloadProgress,
           base::Unretained(this)),
       base::Bind(&FetcherTest::OnFetcherUploadProgress,
           base::Unretained(this))));
+  fetcher->SetInlineCallbacks(true);
   fetcher->Start();
 
   scoped_refptr<cnet::Response> response = WaitForCompletion();
-  ASSERT_NE(response->status().status(), net::URLRequestStatus::SUCCESS);
-  ASSERT_EQ(response->status().status(), net::URLRequestStatus::FAILED);
-  ASSERT_EQ(response->http_response_code(), -1);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_TRUE(completed_on_network_);
+  EXPECT_EQ(download_progress_, response->response_length());
 }
 
-TEST_F(FetcherTest, ManyFetches0) {
+TEST_F(FetcherTest, InlineCallbacksWithData) {
+  ASSERT_TRUE(test_server_.Start());
+
+  const char body[] = "Hello, inline stream!";
+  std::string url(test_server_.GetURL("echo").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "POST",
+      base::Bind(&FetcherTest::OnInlineStreamCompleted,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetUploadBuffer("text/plain", body, strlen(body),
+      base::Bind(&FetcherTest::OnUploadBufferReleased,
+          base::Unretained(this)));
+  fetcher->SetDataCallback(
+      base::Bind(&FetcherTest::OnFetcherData, base::Unretained(this)), 1);
+  fetcher->SetInlineCallbacks(true);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+  EXPECT_TRUE(completed_on_network_);
+
+  // The completion ran after the last chunk and after the release.
+  EXPECT_EQ(std::string(body), completed_streamed_body_);
+  EXPECT_TRUE(completed_after_release_);
+}
+
+TEST_F(FetcherTest, PauseResume) {
   ASSERT_TRUE(test_server_.Start());
 
   std::string url(test_server_.GetURL("files/hello.html").spec());
-  for (int i = 0; i < 30; i++) {
-    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
-        pool_, url, "GET",
-        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
-            base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherUploadProgress,
-            base::Unretained(this))));
-    fetcher->Start();
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->Pause();
+  fetcher->Start();
 
-    scoped_refptr<cnet::Response> response = WaitForCompletion();
-    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
-    ASSERT_EQ(response->http_response_code(), 200);
+  // The paused fetcher receives the headers, but doesn't read the body.
+  EXPECT_FALSE(completed_event_.TimedWait(
+      base::TimeDelta::FromMilliseconds(200)));
+  EXPECT_EQ(download_progress_, 0);
 
-    Reset();
-  }
+  fetcher->Resume();
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+  EXPECT_EQ(std::string("Hello!\n\n"),
+      std::string(response->response_body(), response->response_length()));
 }
 
-TEST_F(FetcherTest, ManyFetches1) {
+TEST_F(FetcherTest, StreamingFetch) {
   ASSERT_TRUE(test_server_.Start());
 
   std::string url(test_server_.GetURL("files/hello.html").spec());
-  for (int i = 0; i < 30; i++) {
-    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
-        pool_, url, "GET",
-        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
-            base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherUploadProgress,
-            base::Unretained(this))));
-    fetcher->Start();
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetDataCallback(
+      base::Bind(&FetcherTest::OnFetcherData, base::Unretained(this)), 1);
+  fetcher->Start();
 
-    scoped_refptr<cnet::Response> response = WaitForCompletion();
-    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
-    ASSERT_EQ(response->http_response_code(), 200);
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
 
-    Reset();
-  }
+  // The body went to the data callback, not to the response.
+  EXPECT_EQ(std::string("Hello!\n\n"), streamed_body_);
+  EXPECT_EQ(0, response->response_length());
 }
 
-TEST_F(FetcherTest, ManyFetches2) {
+TEST_F(FetcherTest, FileFetch) {
   ASSERT_TRUE(test_server_.Start());
 
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("hello.html"));
+
   std::string url(test_server_.GetURL("files/hello.html").spec());
-  for (int i = 0; i < 30; i++) {
-    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
-        pool_, url, "GET",
-        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
-            base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherUploadProgress,
-            base::Unretained(this))));
-    fetcher->Start();
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputFilePath(output_path);
+  fetcher->Start();
 
-    scoped_refptr<cnet::Response> response = WaitForCompletion();
-    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
-    ASSERT_EQ(response->http_response_code(), 200);
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+  EXPECT_EQ(output_path, response->response_file_path());
+  EXPECT_FALSE(response->response_file_is_temporary());
 
-    Reset();
-  }
+  // The whole body arrives in one write batch.
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(std::string("Hello!\n\n"), file_body);
+
+  // Every buffer went back to the pool, including the one for the final,
+  // empty read.
+  int64 hits, misses, idle_bytes;
+  pool_->read_buffers()->GetStats(&hits, &misses, &idle_bytes);
+  EXPECT_GT(misses, 0);
+  EXPECT_EQ(misses * pool_->read_buffers()->buffer_size(), idle_bytes);
 }
 
-TEST_F(FetcherTest, ManyFetches3) {
+TEST_F(FetcherTest, ResumeKeepsPartialFileOnError) {
+  ASSERT_TRUE(test_server_.Start());
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("partial"));
+  base::FilePath state_path(output_path.AddExtension(
+      FILE_PATH_LITERAL("resume")));
+  std::string partial("Hel");
+  std::string state("3\n\"abc\"\n\n");
+  ASSERT_EQ((int)partial.size(),
+      base::WriteFile(output_path, partial.data(), partial.size()));
+  ASSERT_EQ((int)state.size(),
+      base::WriteFile(state_path, state.data(), state.size()));
+
+  // The server has nothing at the URL, so nothing can be resumed.
+  std::string url(test_server_.GetURL("files/missing.html").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputFilePath(output_path);
+  fetcher->SetResumable(true);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  EXPECT_NE(response->status().status(), net::URLRequestStatus::SUCCESS);
+
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(partial, file_body);
+  EXPECT_TRUE(base::PathExists(state_path));
+}
+
+TEST_F(FetcherTest, ResumeAppendsRange) {
+  std::string content("Hello, resumed world!\n");
+  FakeRangeServer range_server(content, "\"v1\"");
+  net::test_server::EmbeddedTestServer server;
+  ASSERT_TRUE(server.InitializeAndWaitUntilReady());
+  server.RegisterRequestHandler(base::Bind(&FakeRangeServer::HandleRequest,
+      base::Unretained(&range_server)));
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("partial"));
+  base::FilePath state_path(output_path.AddExtension(
+      FILE_PATH_LITERAL("resume")));
+  std::string partial("Hello");
+  std::string state("5\n\"v1\"\n\n");
+  ASSERT_EQ((int)partial.size(),
+      base::WriteFile(output_path, partial.data(), partial.size()));
+  ASSERT_EQ((int)state.size(),
+      base::WriteFile(state_path, state.data(), state.size()));
+
+  std::string url(server.GetURL("/partial").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputFilePath(output_path);
+  fetcher->SetResumable(true);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(206, response->http_response_code());
+
+  // The request asked for the rest of the version that we have.
+  std::vector<std::map<std::string, std::string> > requests =
+      range_server.requests();
+  ASSERT_EQ(1u, requests.size());
+  EXPECT_EQ("bytes=5-", requests[0]["Range"]);
+  EXPECT_EQ("\"v1\"", requests[0]["If-Range"]);
+
+  // The rest was appended to the partial file, which is now done.
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(content, file_body);
+  EXPECT_EQ((int64)content.size(), download_progress_);
+  EXPECT_FALSE(base::PathExists(state_path));
+}
+
+TEST_F(FetcherTest, ResumeRestartsWhenFileChanged) {
+  std::string content("Hello, resumed world!\n");
+  FakeRangeServer range_server(content, "\"v2\"");
+  net::test_server::EmbeddedTestServer server;
+  ASSERT_TRUE(server.InitializeAndWaitUntilReady());
+  server.RegisterRequestHandler(base::Bind(&FakeRangeServer::HandleRequest,
+      base::Unretained(&range_server)));
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("partial"));
+  base::FilePath state_path(output_path.AddExtension(
+      FILE_PATH_LITERAL("resume")));
+  std::string partial("XXXXX");
+  std::string state("5\n\"v1\"\n\n");
+  ASSERT_EQ((int)partial.size(),
+      base::WriteFile(output_path, partial.data(), partial.size()));
+  ASSERT_EQ((int)state.size(),
+      base::WriteFile(state_path, state.data(), state.size()));
+
+  std::string url(server.GetURL("/partial").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputFilePath(output_path);
+  fetcher->SetResumable(true);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(200, response->http_response_code());
+
+  // The request asked for the rest of the version that we have.
+  std::vector<std::map<std::string, std::string> > requests =
+      range_server.requests();
+  ASSERT_EQ(1u, requests.size());
+  EXPECT_EQ("bytes=5-", requests[0]["Range"]);
+  EXPECT_EQ("\"v1\"", requests[0]["If-Range"]);
+
+  // The file changed, so the whole new version replaced the partial one.
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(content, file_body);
+  EXPECT_EQ((int64)content.size(), download_progress_);
+  EXPECT_FALSE(base::PathExists(state_path));
+}
+
+TEST_F(FetcherTest, SpillToFile) {
   ASSERT_TRUE(test_server_.Start());
 
   std::string url(test_server_.GetURL("files/hello.html").spec());
-  for (int i = 0; i < 30; i++) {
-    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
-        pool_, url, "GET",
-        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
-            base::Unretained(this)),
-        base::Bind(&FetcherTest::OnFetcherUploadProgress,
-            base::Unretained(this))));
-    fetcher->Start();
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetSpillThreshold(4);
+  fetcher->Start();
 
-    scoped_refptr<cnet::Response> response = WaitForCompletion();
-    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
-    ASSERT_EQ(response->http_response_code(), 200);
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
 
-    Reset();
+  // The content length exceeds the threshold, so the body is in a file.
+  EXPECT_EQ(0, response->response_length());
+  ASSERT_FALSE(response->response_file_path().empty());
+  EXPECT_TRUE(response->response_file_is_temporary());
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(response->response_file_path(),
+      &file_body));
+  EXPECT_EQ(std::string("Hello!\n\n"), file_body);
+}
+
+TEST_F(FetcherTest, MultipartUpload) {
+  ASSERT_TRUE(test_server_.Start());
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path(temp_dir.path().AppendASCII("part.txt"));
+  ASSERT_EQ(10, base::WriteFile(file_path, "0123456789", 10));
+
+  std::string url(test_server_.GetURL("echo").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "POST",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetUrlParam("caption", "photos");
+  fetcher->SetUrlParamFile("photo1", "a.txt", "text/plain", file_path, 2, 3);
+  fetcher->SetUrlParamFile("photo2", "b.txt", "text/plain", file_path, 0,
+      kuint64max);
+  fetcher->SetUrlParamBytes("photo3", "c.txt", "text/plain", "in memory");
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+
+  // Every part arrives, in order.
+  std::string body(response->response_body(), response->response_length());
+  size_t caption = body.find("\r\n\r\nphotos\r\n");
+  size_t photo1 = body.find("filename=\"a.txt\"");
+  size_t photo2 = body.find("filename=\"b.txt\"");
+  size_t photo3 = body.find("filename=\"c.txt\"");
+  ASSERT_NE(std::string::npos, caption);
+  ASSERT_NE(std::string::npos, photo1);
+  ASSERT_NE(std::string::npos, photo2);
+  ASSERT_NE(std::string::npos, photo3);
+  EXPECT_LT(caption, photo1);
+  EXPECT_LT(photo1, photo2);
+  EXPECT_LT(photo2, photo3);
+  EXPECT_NE(std::string::npos, body.find("\r\n\r\n234\r\n"));
+  EXPECT_NE(std::string::npos, body.find("\r\n\r\n0123456789\r\n"));
+  EXPECT_NE(std::string::npos, body.find("\r\n\r\nin memory\r\n"));
+}
+
+TEST_F(FetcherTest, UploadBuffer) {
+  ASSERT_TRUE(test_server_.Start());
+
+  // Binary data, with an embedded NUL.
+  const char body[] = { 'a', 'b', '\0', 'c', 'd' };
+  std::string url(test_server_.GetURL("echo").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "POST",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetUploadBuffer("application/octet-stream", body, sizeof(body),
+      base::Bind(&FetcherTest::OnUploadBufferReleased,
+          base::Unretained(this)));
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+  std::string response_body(response->response_body(),
+      response->response_length());
+  EXPECT_EQ(std::string(body, sizeof(body)), response_body);
+
+  // The release is posted to the work thread before the completion.
+  EXPECT_TRUE(upload_buffer_released_);
+}
+
+TEST_F(FetcherTest, ChunkedUploadCallback) {
+  ASSERT_TRUE(test_server_.Start());
+
+  upload_source_ = "Hello, streamed upload!";
+  std::string url(test_server_.GetURL("echo").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "POST",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetUploadCallback("text/plain", -1,
+      base::Bind(&FetcherTest::OnFetcherUploadRead, base::Unretained(this)));
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+
+  // The server echoes the body that it received.
+  std::string response_body(response->response_body(),
+      response->response_length());
+  EXPECT_EQ(upload_source_, response_body);
+}
+
+TEST_F(FetcherTest, GzipUpload) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string source;
+  for (int i = 0; i < 5000; i++) {
+    source.append("{\"event\":\"compressible\"}\n");
+  }
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path(temp_dir.path().AppendASCII("upload.json"));
+  ASSERT_EQ(static_cast<int>(source.size()),
+      base::WriteFile(file_path, source.data(), source.size()));
+
+  std::string url(test_server_.GetURL("echo").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "POST",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetUploadFilePath("application/json", file_path, 0, kuint64max);
+  fetcher->SetUploadEncoding(cnet::Fetcher::UPLOAD_GZIP);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+
+  // The server echoes the compressed body, which inflates to the source.
+  std::string compressed(response->response_body(),
+      response->response_length());
+  EXPECT_LT(compressed.size(), source.size() / 10);
+
+  z_stream zstream;
+  memset(&zstream, 0, sizeof(zstream));
+  ASSERT_EQ(Z_OK, inflateInit2(&zstream, MAX_WBITS + 16));
+  std::string inflated(source.size() + 1, '\0');
+  zstream.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+  zstream.avail_in = compressed.size();
+  zstream.next_out = reinterpret_cast<Bytef*>(&inflated[0]);
+  zstream.avail_out = inflated.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&zstream, Z_FINISH));
+  inflated.resize(inflated.size() - zstream.avail_out);
+  inflateEnd(&zstream);
+  EXPECT_EQ(source, inflated);
+}
+
+TEST_F(FetcherTest, OutputBufferFetch) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  char output[64];
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputBuffer(output, sizeof(output),
+      cnet::Fetcher::OVERFLOW_FAIL);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+
+  // The body was read in place.
+  ASSERT_EQ(8, response->response_length());
+  EXPECT_EQ(output, response->response_body());
+  EXPECT_EQ(std::string("Hello!\n\n"), std::string(output, 8));
+}
+
+TEST_F(FetcherTest, OutputBufferOverflow) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  char output[4];
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputBuffer(output, sizeof(output),
+      cnet::Fetcher::OVERFLOW_FAIL);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  EXPECT_NE(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(net::ERR_FILE_TOO_BIG, response->status().error());
+}
+
+TEST_F(FetcherTest, FileRegionFetch) {
+  ASSERT_TRUE(test_server_.Start());
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("hello.html"));
+  ASSERT_EQ(4, base::WriteFile(output_path, "abcd", 4));
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->SetOutputFileRegion(output_path, 2);
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+
+  // The bytes before the region are untouched.
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(std::string("abHello!\n\n"), file_body);
+}
+
+TEST_F(FetcherTest, SegmentedDownload) {
+  std::string content;
+  for (int i = 0; i < 1000; i++) {
+    content += base::StringPrintf("%04d\n", i);
+  }
+  FakeRangeServer range_server(content, "\"v1\"");
+  net::test_server::EmbeddedTestServer server;
+  ASSERT_TRUE(server.InitializeAndWaitUntilReady());
+  server.RegisterRequestHandler(base::Bind(&FakeRangeServer::HandleRequest,
+      base::Unretained(&range_server)));
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("numbers.txt"));
+
+  std::string url(server.GetURL("/numbers.txt").spec());
+  scoped_refptr<cnet::SegmentedDownload> download(
+      new cnet::SegmentedDownload(pool_, url, output_path, 4,
+          base::Bind(&FetcherTest::OnDownloadCompleted,
+              base::Unretained(this)),
+          cnet::SegmentedDownload::ProgressCallback()));
+  download->SetMinSegmentSize(2);
+  download->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_TRUE(download_succeeded_);
+  ASSERT_TRUE(response.get() != NULL);
+  EXPECT_EQ(4, download->segment_count());
+  EXPECT_EQ(4, range_server.range_requests());
+  EXPECT_EQ(output_path, response->response_file_path());
+
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(output_path, &file_body));
+  EXPECT_EQ(content, file_body);
+}
+
+TEST_F(FetcherTest, ParallelUpload) {
+  FakeS3Server s3;
+  net::test_server::EmbeddedTestServer server;
+  ASSERT_TRUE(server.InitializeAndWaitUntilReady());
+  server.RegisterRequestHandler(base::Bind(&FakeS3Server::HandleRequest,
+      base::Unretained(&s3)));
+
+  std::string source;
+  for (int i = 0; i < 1000; i++) {
+    source += base::StringPrintf("%04d\n", i);
+  }
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path(temp_dir.path().AppendASCII("video.mp4"));
+  ASSERT_EQ(static_cast<int>(source.size()),
+      base::WriteFile(file_path, source.data(), source.size()));
+
+  std::string url(server.GetURL("/bucket/video.mp4").spec());
+  scoped_refptr<cnet::ParallelUpload> upload(new cnet::ParallelUpload(pool_,
+      new cnet::S3MultipartProtocol(url), file_path, "video/mp4", 3,
+      base::Bind(&FetcherTest::OnUploadCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnUploadProgress, base::Unretained(this))));
+  upload->SetPartSize(1024);
+  upload->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_TRUE(upload_succeeded_);
+  ASSERT_TRUE(response.get() != NULL);
+  EXPECT_EQ(5, upload->part_count());
+
+  // Part 2 failed once, and was sent again on its own.
+  EXPECT_EQ(source, s3.object());
+  EXPECT_FALSE(s3.aborted());
+  EXPECT_EQ(static_cast<int64>(source.size()), upload_progress_);
+}
+
+TEST_F(FetcherTest, FetchError) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("close-socket").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+          base::Unretained(this)),
+      base::Bind(&FetcherTest::OnFetcherUploadProgress,
+          base::Unretained(this))));
+  fetcher->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_NE(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::FAILED);
+  ASSERT_EQ(response->http_response_code(), -1);
+}
+
+TEST_F(FetcherTest, ManyFetches0) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < 30; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+TEST_F(FetcherTest, ManyFetches1) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < 30; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+TEST_F(FetcherTest, ManyFetches2) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < 30; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+TEST_F(FetcherTest, ManyFetches3) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < 30; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+class ShardedFetcherTest : public FetcherTest {
+ protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    config->network_threads = 3;
+  }
+};
+
+TEST_F(ShardedFetcherTest, ShardsByHost) {
+  ASSERT_EQ(pool_->shard_count(), 3u);
+
+  // Each host always maps to the same thread, and the hosts spread out.
+  std::set<size_t> shards;
+  for (int i = 0; i < 30; i++) {
+    GURL url(base::StringPrintf("http://host%d.example.com/", i));
+    size_t shard = pool_->GetShardForUrl(url);
+    ASSERT_LT(shard, pool_->shard_count());
+    EXPECT_EQ(shard, pool_->GetShardForUrl(url.Resolve("/other?a=b")));
+    shards.insert(shard);
+  }
+  EXPECT_GT(shards.size(), 1u);
+
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < 10; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+class WorkerFetcherTest : public FetcherTest {
+ public:
+  WorkerFetcherTest()
+      : unblocked_event_(false, false), was_unblocked_(false) {
+  }
+
+  void OnBlockedFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.  Hold the thread until the other fetcher completes.
+    was_unblocked_ = unblocked_event_.TimedWait(
+        base::TimeDelta::FromSeconds(10));
+    OnFetcherCompleted(fetcher, response);
+  }
+
+  void OnUnblockingFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On another work thread.
+    unblocked_event_.Signal();
+  }
+
+ protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    config->work_threads = 3;
+  }
+
+  base::WaitableEvent unblocked_event_;
+  bool was_unblocked_;
+};
+
+TEST_F(WorkerFetcherTest, SlowCallbackDoesNotBlockOthers) {
+  ASSERT_TRUE(test_server_.Start());
+  ASSERT_EQ(pool_->work_thread_count(), 3u);
+
+  // The pool gives consecutive fetchers different work threads.
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> blocked(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&WorkerFetcherTest::OnBlockedFetcherCompleted,
+          base::Unretained(this)),
+      cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+  scoped_refptr<cnet::Fetcher> unblocking(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&WorkerFetcherTest::OnUnblockingFetcherCompleted,
+          base::Unretained(this)),
+      cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+  blocked->Start();
+  unblocking->Start();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_TRUE(was_unblocked_);
+}
+
+class ScheduledFetcherTest : public FetcherTest {
+ public:
+  ScheduledFetcherTest()
+      : scheduled_completions_(0), scheduled_successes_(0) {
+  }
+
+  void OnScheduledFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    if (response->status().status() == net::URLRequestStatus::SUCCESS) {
+      scheduled_successes_++;
+    }
+    if (++scheduled_completions_ == kScheduledFetches) {
+      completed_event_.Signal();
+    }
+  }
+
+  void OnOrderedFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    completion_order_.push_back(fetcher);
+    if (completion_order_.size() == kOrderedFetches) {
+      completed_event_.Signal();
+    }
+  }
+
+ protected:
+  static const int kScheduledFetches = 5;
+  static const size_t kOrderedFetches = 2;
+
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    config->max_requests = 1;
+  }
+
+  // Take the only slot with a request that the server holds open, so that
+  // the requests after it wait.  Cancel it before the test ends.
+  scoped_refptr<cnet::Fetcher> StartBlockingFetcher() {
+    std::string url(test_server_.GetURL("slow?60").spec());
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&ScheduledFetcherTest::OnBlockingFetcherCompleted,
+            base::Unretained(this)),
+        cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+    fetcher->Start();
+    return fetcher;
   }
+
+  void OnBlockingFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+  }
+
+  void WaitForQueuedRequests(int64 count) {
+    // The pool counts them on its network thread.
+    cnet::Pool::Stats stats;
+    pool_->GetStats(&stats);
+    while (stats.requests_queued < count) {
+      base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(10));
+      pool_->GetStats(&stats);
+    }
+  }
+
+  int scheduled_completions_;
+  int scheduled_successes_;
+  std::vector<scoped_refptr<cnet::Fetcher> > completion_order_;
+};
+
+const int ScheduledFetcherTest::kScheduledFetches;
+const size_t ScheduledFetcherTest::kOrderedFetches;
+
+TEST_F(ScheduledFetcherTest, OneAtATime) {
+  ASSERT_TRUE(test_server_.Start());
+  ASSERT_TRUE(pool_->IsSchedulingRequests());
+
+  // Every fetcher runs, one after another.
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  for (int i = 0; i < kScheduledFetches; i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, url, "GET",
+        base::Bind(&ScheduledFetcherTest::OnScheduledFetcherCompleted,
+            base::Unretained(this)),
+        cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+    fetcher->Start();
+  }
+
+  completed_event_.Wait();
+  EXPECT_EQ(scheduled_successes_, kScheduledFetches);
+
+  cnet::Pool::Stats stats;
+  pool_->GetStats(&stats);
+  EXPECT_EQ(stats.requests_queued, 0);
+}
+
+TEST_F(ScheduledFetcherTest, Reprioritize) {
+  ASSERT_TRUE(test_server_.Start());
+  scoped_refptr<cnet::Fetcher> blocker = StartBlockingFetcher();
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> fetchers[kOrderedFetches];
+  for (size_t i = 0; i < kOrderedFetches; i++) {
+    fetchers[i] = new cnet::Fetcher(pool_, url, "GET",
+        base::Bind(&ScheduledFetcherTest::OnOrderedFetcherCompleted,
+            base::Unretained(this)),
+        cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback());
+  }
+  pool_->TagFetcher(fetchers[1], 7);
+  for (size_t i = 0; i < kOrderedFetches; i++) {
+    fetchers[i]->Start();
+  }
+  WaitForQueuedRequests(kOrderedFetches);
+
+  // Raising the later fetcher's tag lets it into the slot first.
+  pool_->SetTagPriority(7, cnet::Fetcher::PRIORITY_HIGHEST);
+  blocker->Cancel();
+  completed_event_.Wait();
+
+  ASSERT_EQ(kOrderedFetches, completion_order_.size());
+  EXPECT_EQ(fetchers[1], completion_order_[0]);
+  EXPECT_EQ(fetchers[0], completion_order_[1]);
+}
+
+TEST_F(ScheduledFetcherTest, CancelQueued) {
+  ASSERT_TRUE(test_server_.Start());
+  scoped_refptr<cnet::Fetcher> blocker = StartBlockingFetcher();
+
+  // A fetcher cancelled while it waits still completes.
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+      pool_, url, "GET",
+      base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+      cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+  fetcher->Start();
+  WaitForQueuedRequests(1);
+  fetcher->Cancel();
+
+  scoped_refptr<cnet::Response> response = WaitForCompletion();
+  ASSERT_TRUE(response.get() != NULL);
+  EXPECT_EQ(response->status().status(), net::URLRequestStatus::CANCELED);
+  EXPECT_EQ(response->status().error(), net::ERR_ABORTED);
+
+  cnet::Pool::Stats stats;
+  pool_->GetStats(&stats);
+  EXPECT_EQ(stats.requests_queued, 0);
+
+  blocker->Cancel();
+}
+
+TEST_F(ScheduledFetcherTest, CancelQueuedSegmentedDownload) {
+  ASSERT_TRUE(test_server_.Start());
+  scoped_refptr<cnet::Fetcher> blocker = StartBlockingFetcher();
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path(temp_dir.path().AppendASCII("hello.html"));
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::SegmentedDownload> download(
+      new cnet::SegmentedDownload(pool_, url, output_path, 4,
+          base::Bind(&FetcherTest::OnDownloadCompleted,
+              base::Unretained(this)),
+          cnet::SegmentedDownload::ProgressCallback()));
+  download->Start();
+  WaitForQueuedRequests(1);
+  download->Cancel();
+
+  WaitForCompletion();
+  EXPECT_FALSE(download_succeeded_);
+
+  blocker->Cancel();
+}
+
+TEST_F(ScheduledFetcherTest, CancelQueuedParallelUpload) {
+  ASSERT_TRUE(test_server_.Start());
+  scoped_refptr<cnet::Fetcher> blocker = StartBlockingFetcher();
+
+  std::string source("0123456789");
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath file_path(temp_dir.path().AppendASCII("video.mp4"));
+  ASSERT_EQ(static_cast<int>(source.size()),
+      base::WriteFile(file_path, source.data(), source.size()));
+
+  // The upload is cancelled before its first request is sent.
+  std::string url(test_server_.GetURL("bucket/video.mp4").spec());
+  scoped_refptr<cnet::ParallelUpload> upload(new cnet::ParallelUpload(pool_,
+      new cnet::S3MultipartProtocol(url), file_path, "video/mp4", 3,
+      base::Bind(&FetcherTest::OnUploadCompleted, base::Unretained(this)),
+      cnet::ParallelUpload::ProgressCallback()));
+  upload->Start();
+  WaitForQueuedRequests(1);
+  upload->Cancel();
+
+  WaitForCompletion();
+  EXPECT_FALSE(upload_succeeded_);
+
+  blocker->Cancel();
+}
+
+class BodyMemoryFetcherTest : public FetcherTest {
+ public:
+  BodyMemoryFetcherTest()
+      : expected_completions_(0) {
+  }
+
+  void OnBodyFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    base::AutoLock lock(responses_lock_);
+    responses_[fetcher] = response;
+    if (responses_.size() == expected_completions_) {
+      completed_event_.Signal();
+    }
+  }
+
+ protected:
+  // Less than one chunk of a buffered body.
+  static const int kBodyMemoryBudget = 1024;
+
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    config->body_memory_budget = kBodyMemoryBudget;
+  }
+
+  // The test server's chunked responses have no content length, so their
+  // bodies are reserved a chunk at a time as they arrive.
+  scoped_refptr<cnet::Fetcher> StartFetcher(const std::string& path) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pool_, test_server_.GetURL(path).spec(), "GET",
+        base::Bind(&BodyMemoryFetcherTest::OnBodyFetcherCompleted,
+            base::Unretained(this)),
+        cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+    fetcher->Start();
+    return fetcher;
+  }
+
+  CnetPoolStats GetPoolStats() {
+    CnetPoolStats stats;
+    CnetPoolGetStats(pool_.get(), &stats);
+    return stats;
+  }
+
+  scoped_refptr<cnet::Response> GetResponse(
+      scoped_refptr<cnet::Fetcher> fetcher) {
+    base::AutoLock lock(responses_lock_);
+    return responses_[fetcher];
+  }
+
+  size_t expected_completions_;
+  base::Lock responses_lock_;
+  std::map<scoped_refptr<cnet::Fetcher>, scoped_refptr<cnet::Response> >
+      responses_;
+};
+
+const int BodyMemoryFetcherTest::kBodyMemoryBudget;
+
+TEST_F(BodyMemoryFetcherTest, AdmitsBodyLargerThanBudget) {
+  ASSERT_TRUE(test_server_.Start());
+
+  // Its first chunk is larger than the whole budget, but nothing else holds
+  // any memory.
+  expected_completions_ = 1;
+  scoped_refptr<cnet::Fetcher> fetcher =
+      StartFetcher("chunked?chunkSize=8&chunksNumber=4");
+  completed_event_.Wait();
+
+  scoped_refptr<cnet::Response> response = GetResponse(fetcher);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  ASSERT_EQ(response->http_response_code(), 200);
+  EXPECT_EQ(std::string(32, '*'),
+      std::string(response->response_body(), response->response_length()));
+
+  CnetPoolStats stats = GetPoolStats();
+  EXPECT_EQ(0, stats.body_memory_used_bytes);
+  EXPECT_EQ(0, stats.body_memory_waiters);
+  EXPECT_EQ(0, stats.body_spills);
+}
+
+TEST_F(BodyMemoryFetcherTest, DefersStartOverBudget) {
+  ASSERT_TRUE(test_server_.Start());
+
+  expected_completions_ = 2;
+  scoped_refptr<cnet::Fetcher> holder =
+      StartFetcher("chunked?waitBetweenChunks=300&chunkSize=8&chunksNumber=4");
+  while (GetPoolStats().body_memory_used_bytes == 0) {
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(10));
+  }
+  EXPECT_GT(GetPoolStats().body_memory_used_bytes, kBodyMemoryBudget);
+
+  // The budget is used up, so the second fetcher waits to start until the
+  // first one gives its memory back.
+  scoped_refptr<cnet::Fetcher> waiter =
+      StartFetcher("chunked?chunkSize=8&chunksNumber=2");
+  while (GetPoolStats().body_memory_waiters == 0) {
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(10));
+  }
+  completed_event_.Wait();
+
+  scoped_refptr<cnet::Response> response = GetResponse(holder);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(std::string(32, '*'),
+      std::string(response->response_body(), response->response_length()));
+  response = GetResponse(waiter);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(std::string(16, '*'),
+      std::string(response->response_body(), response->response_length()));
+
+  CnetPoolStats stats = GetPoolStats();
+  EXPECT_EQ(0, stats.body_memory_used_bytes);
+  EXPECT_EQ(0, stats.body_memory_waiters);
+  EXPECT_EQ(0, stats.body_spills);
+}
+
+class SpillingFetcherTest : public BodyMemoryFetcherTest {
+ protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    BodyMemoryFetcherTest::ConfigurePool(config);
+    config->spill_bodies_over_budget = true;
+  }
+};
+
+TEST_F(SpillingFetcherTest, SpillsLargestBody) {
+  ASSERT_TRUE(test_server_.Start());
+
+  // Both start while no memory is held.  The first one holds the budget
+  // while it is paused, so the second one's first chunk is refused, and the
+  // first one's body moves to a file to make room.
+  expected_completions_ = 2;
+  scoped_refptr<cnet::Fetcher> largest =
+      StartFetcher("chunked?waitBetweenChunks=200&chunkSize=8&chunksNumber=5");
+  scoped_refptr<cnet::Fetcher> other =
+      StartFetcher("chunked?chunkSize=8&chunksNumber=4");
+  while (GetPoolStats().body_memory_used_bytes == 0) {
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(10));
+  }
+  largest->Pause();
+  while (GetPoolStats().body_memory_waiters == 0) {
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(10));
+  }
+
+  // The body moves once its reads continue.
+  largest->Resume();
+  completed_event_.Wait();
+
+  scoped_refptr<cnet::Response> response = GetResponse(largest);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(0, response->response_length());
+  ASSERT_FALSE(response->response_file_path().empty());
+  EXPECT_TRUE(response->response_file_is_temporary());
+  std::string file_body;
+  ASSERT_TRUE(base::ReadFileToString(response->response_file_path(),
+      &file_body));
+  EXPECT_EQ(std::string(40, '*'), file_body);
+
+  response = GetResponse(other);
+  ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+  EXPECT_EQ(std::string(32, '*'),
+      std::string(response->response_body(), response->response_length()));
+
+  CnetPoolStats stats = GetPoolStats();
+  EXPECT_EQ(0, stats.body_memory_used_bytes);
+  EXPECT_EQ(0, stats.body_memory_waiters);
+  EXPECT_EQ(1, stats.body_spills);
+}
+
+class CoalescingFetcherTest : public FetcherTest {
+ public:
+  CoalescingFetcherTest()
+      : expected_completions_(0) {
+  }
+
+  void OnCoalescedFetcherCompleted(scoped_refptr<cnet::Fetcher> fetcher,
+      scoped_refptr<cnet::Response> response) {
+    // On work thread.
+    responses_[fetcher] = response;
+    if (responses_.size() == expected_completions_) {
+      completed_event_.Signal();
+    }
+  }
+
+ protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    config->coalesce_requests = true;
+  }
+
+  scoped_refptr<cnet::Fetcher> CreateFetcher(const std::string& url) {
+    return new cnet::Fetcher(pool_, url, "GET",
+        base::Bind(&CoalescingFetcherTest::OnCoalescedFetcherCompleted,
+            base::Unretained(this)),
+        cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback());
+  }
+
+  size_t expected_completions_;
+  std::map<scoped_refptr<cnet::Fetcher>, scoped_refptr<cnet::Response> >
+      responses_;
+};
+
+TEST_F(CoalescingFetcherTest, SharesOneRequest) {
+  ASSERT_TRUE(test_server_.Start());
+
+  // The later fetchers start while the first one's request is in flight.
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> fetchers[3];
+  expected_completions_ = arraysize(fetchers);
+  for (size_t i = 0; i < arraysize(fetchers); i++) {
+    fetchers[i] = CreateFetcher(url);
+    fetchers[i]->Start();
+  }
+  completed_event_.Wait();
+
+  for (size_t i = 0; i < arraysize(fetchers); i++) {
+    scoped_refptr<cnet::Response> response = responses_[fetchers[i]];
+    ASSERT_TRUE(response.get() != NULL);
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+    EXPECT_GT(response->response_length(), 0);
+    EXPECT_EQ(response->response_body(),
+        responses_[fetchers[0]]->response_body());
+  }
+
+  // Detaching a shared body copies it.
+  int length = 0;
+  char* body = responses_[fetchers[1]]->DetachBody(&length);
+  ASSERT_TRUE(body != NULL);
+  EXPECT_EQ(length, responses_[fetchers[0]]->response_length());
+  EXPECT_EQ(memcmp(body, responses_[fetchers[0]]->response_body(), length), 0);
+  free(body);
+
+  cnet::Pool::Stats stats;
+  pool_->GetStats(&stats);
+  EXPECT_EQ(stats.coalesce_hits, 2);
+  EXPECT_EQ(stats.coalesce_misses, 1);
+}
+
+TEST_F(CoalescingFetcherTest, CancelDoesNotCancelOthers) {
+  ASSERT_TRUE(test_server_.Start());
+
+  // Cancelling a fetcher that follows the request drops only that fetcher,
+  // and cancelling the fetcher that runs it hands it to another.
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Fetcher> fetchers[4];
+  expected_completions_ = arraysize(fetchers);
+  for (size_t i = 0; i < arraysize(fetchers); i++) {
+    fetchers[i] = CreateFetcher(url);
+    fetchers[i]->Start();
+  }
+  fetchers[2]->Cancel();
+  fetchers[0]->Cancel();
+  completed_event_.Wait();
+
+  for (size_t i = 0; i < arraysize(fetchers); i++) {
+    scoped_refptr<cnet::Response> response = responses_[fetchers[i]];
+    ASSERT_TRUE(response.get() != NULL);
+    if ((i == 0) || (i == 2)) {
+      EXPECT_EQ(response->status().status(),
+          net::URLRequestStatus::CANCELED);
+      EXPECT_EQ(response->status().error(), net::ERR_ABORTED);
+    } else {
+      ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+      ASSERT_EQ(response->http_response_code(), 200);
+    }
+  }
+}
+
+class EngineFetcherTest : public FetcherTest {
+ public:
+  virtual void SetUp() override {
+    FetcherTest::SetUp();
+
+    cnet::Pool::Config config;
+    config.user_agent = "cnet-unittest-other";
+    config.engine = engine_;
+    other_pool_ = new cnet::Pool(ui_thread_->task_runner(), config);
+    other_pool_->Start();
+  }
+
+  virtual void TearDown() override {
+    // The engine's threads stop once the last pool is deleted.
+    other_pool_ = NULL;
+    engine_ = NULL;
+    FetcherTest::TearDown();
+  }
+
+ protected:
+  virtual void ConfigurePool(cnet::Pool::Config* config) override {
+    cnet::Engine::Config engine_config;
+    engine_config.share_network_session = true;
+    engine_ = new cnet::Engine(ui_thread_->task_runner(), engine_config);
+    engine_->Start();
+    config->engine = engine_;
+  }
+
+  scoped_refptr<cnet::Engine> engine_;
+  scoped_refptr<cnet::Pool> other_pool_;
+};
+
+TEST_F(EngineFetcherTest, PoolsShareThreads) {
+  EXPECT_EQ(pool_->GetNetworkTaskRunner(), other_pool_->GetNetworkTaskRunner());
+  EXPECT_EQ(pool_->GetWorkTaskRunner(), other_pool_->GetWorkTaskRunner());
+  EXPECT_EQ(pool_->GetFileTaskRunner(), other_pool_->GetFileTaskRunner());
+
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Pool> pools[] = { pool_, other_pool_ };
+  for (size_t i = 0; i < arraysize(pools); i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pools[i], url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    Reset();
+  }
+}
+
+TEST_F(EngineFetcherTest, PoolsShareConnections) {
+  ASSERT_TRUE(test_server_.Start());
+
+  std::string url(test_server_.GetURL("files/hello.html").spec());
+  scoped_refptr<cnet::Pool> pools[] = { pool_, other_pool_ };
+  uint32_t socket_log_id = 0;
+  for (size_t i = 0; i < arraysize(pools); i++) {
+    scoped_refptr<cnet::Fetcher> fetcher(new cnet::Fetcher(
+        pools[i], url, "GET",
+        base::Bind(&FetcherTest::OnFetcherCompleted, base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherDownloadProgress,
+            base::Unretained(this)),
+        base::Bind(&FetcherTest::OnFetcherUploadProgress,
+            base::Unretained(this))));
+    fetcher->Start();
+
+    scoped_refptr<cnet::Response> response = WaitForCompletion();
+    ASSERT_EQ(response->status().status(), net::URLRequestStatus::SUCCESS);
+    ASSERT_EQ(response->http_response_code(), 200);
+
+    // The other pool's request goes out on the first one's connection.
+    const CnetLoadTiming* timing = response->load_timing();
+    ASSERT_TRUE(timing != NULL);
+    if (i == 0) {
+      socket_log_id = timing->socket_log_id;
+    } else {
+      EXPECT_TRUE(timing->socket_reused);
+      EXPECT_EQ(timing->socket_log_id, socket_log_id);
+    }
+
+    Reset();
+  }
+}
+
+TEST_F(PoolTest, RequestSchedulerOrder) {
+  cnet::RequestScheduler scheduler(1, 0);
+  ASSERT_TRUE(scheduler.enabled());
+
+  scoped_refptr<cnet::Fetcher> fetchers[5];
+  for (int i = 0; i < 5; i++) {
+    fetchers[i] = new cnet::Fetcher(pool_, "http://example.com/", "GET",
+        cnet::Fetcher::CompletionCallback(), cnet::Fetcher::ProgressCallback(),
+        cnet::Fetcher::ProgressCallback());
+  }
+
+  EXPECT_TRUE(scheduler.Add(fetchers[0], "example.com", net::LOW, 1));
+  EXPECT_FALSE(scheduler.Add(fetchers[1], "example.com", net::LOW, 1));
+  EXPECT_FALSE(scheduler.Add(fetchers[2], "example.com", net::LOW, 1));
+  EXPECT_FALSE(scheduler.Add(fetchers[3], "example.com", net::LOW, 2));
+  EXPECT_FALSE(scheduler.Add(fetchers[4], "example.com", net::IDLE, 2));
+  EXPECT_EQ(scheduler.waiting_count(), 4u);
+
+  // Raising a waiter's priority puts it first.
+  scheduler.SetPriority(fetchers[4], net::HIGHEST);
+
+  // Then the tags take turns within a priority.
+  int expected[] = { 4, 1, 3, 2 };
+  scoped_refptr<cnet::Fetcher> active = fetchers[0];
+  for (size_t i = 0; i < arraysize(expected); i++) {
+    cnet::RequestScheduler::Fetchers ready;
+    scheduler.Remove(active, &ready);
+    ASSERT_EQ(ready.size(), 1u);
+    EXPECT_EQ(ready[0], fetchers[expected[i]]);
+    active = ready[0];
+  }
+
+  cnet::RequestScheduler::Fetchers ready;
+  scheduler.Remove(active, &ready);
+  EXPECT_TRUE(ready.empty());
+  EXPECT_EQ(scheduler.active_count(), 0u);
+}
+
+TEST_F(PoolTest, TagRegistry) {
+  cnet::TagRegistry registry;
+  scoped_refptr<cnet::Fetcher> first(new cnet::Fetcher(pool_,
+      "http://example.com/", "GET", cnet::Fetcher::CompletionCallback(),
+      cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+  scoped_refptr<cnet::Fetcher> second(new cnet::Fetcher(pool_,
+      "http://example.com/", "GET", cnet::Fetcher::CompletionCallback(),
+      cnet::Fetcher::ProgressCallback(), cnet::Fetcher::ProgressCallback()));
+
+  registry.Add(first, 1);
+  registry.Add(first, 2);
+  registry.Add(second, 1);
+  registry.Add(second, 1);
+
+  cnet::TagRegistry::Fetchers fetchers;
+  registry.GetFetchers(1, &fetchers);
+  EXPECT_EQ(fetchers.size(), 2u);
+  int tag = 0;
+  ASSERT_TRUE(registry.GetFirstTag(first, &tag));
+  EXPECT_EQ(tag, 1);
+
+  // Counters cover every tag of a fetcher.
+  registry.FetcherStarted(first);
+  registry.FetcherReceivedBytes(first.get(), 100);
+  cnet::TagRegistry::TagStats stats;
+  registry.GetTagStats(1, &stats);
+  EXPECT_EQ(stats.fetchers, 2);
+  EXPECT_EQ(stats.in_flight, 1);
+  EXPECT_EQ(stats.received_bytes, 100);
+  registry.GetTagStats(2, &stats);
+  EXPECT_EQ(stats.fetchers, 1);
+  EXPECT_EQ(stats.received_bytes, 100);
+
+  // A fetcher leaves all of its tags, and a tag goes away with its last
+  // fetcher.
+  registry.Remove(first);
+  registry.GetTagStats(1, &stats);
+  EXPECT_EQ(stats.fetchers, 1);
+  EXPECT_EQ(stats.in_flight, 0);
+  registry.GetTagStats(2, &stats);
+  EXPECT_EQ(stats.fetchers, 0);
+  EXPECT_FALSE(registry.GetFirstTag(first, &tag));
+
+  registry.Remove(second);
+  fetchers.clear();
+  registry.GetFetchers(1, &fetchers);
+  EXPECT_TRUE(fetchers.empty());
+}
+
+TEST(ProgressCoalescerTest, CoalescesAndSpacesEvents) {
+  scoped_refptr<cnet::ProgressCoalescer> progress(
+      new cnet::ProgressCoalescer(base::TimeDelta::FromMilliseconds(100),
+          1000));
+  base::TimeTicks now = base::TimeTicks::Now();
+  int64 current;
+  int64 total;
+
+  // The first update schedules an event, and later ones join it.
+  EXPECT_TRUE(progress->Update(10, 10000, now));
+  EXPECT_FALSE(progress->Update(20, 10000, now));
+  progress->Take(&current, &total, now);
+  EXPECT_EQ(20, current);
+  EXPECT_EQ(10000, total);
+
+  // Too soon, and then too few bytes.
+  EXPECT_FALSE(progress->Update(5000, 10000, now));
+  now += base::TimeDelta::FromMilliseconds(200);
+  EXPECT_FALSE(progress->Update(500, 10000, now));
+  EXPECT_TRUE(progress->Update(5000, 10000, now));
+  progress->Take(&current, &total, now);
+  EXPECT_EQ(5000, current);
+
+  // The total is always reported, and the end flushes what was held back.
+  EXPECT_TRUE(progress->Update(10000, 10000, now));
+  progress->Take(&current, &total, now);
+  EXPECT_FALSE(progress->Flush());
+  now += base::TimeDelta::FromMilliseconds(200);
+  EXPECT_FALSE(progress->Update(10500, -1, now));
+  EXPECT_TRUE(progress->Flush());
+  progress->Take(&current, &total, now);
+  EXPECT_EQ(10500, current);
+  EXPECT_EQ(-1, total);
+}
+
+TEST(RopeBufferTest, ChunksAndFlatten) {
+  scoped_refptr<cnet::RopeBuffer> rope(new cnet::RopeBuffer(4));
+  EXPECT_EQ(0u, rope->chunk_count());
+
+  std::string expected("Hello, rope!");
+  size_t written = 0;
+  while (written < expected.length()) {
+    int available = 0;
+    net::IOBuffer* buffer = rope->GetWriteBuffer(&available);
+    ASSERT_GT(available, 0);
+    int length = std::min(available, (int)(expected.length() - written));
+    memcpy(buffer->data(), expected.data() + written, length);
+    rope->DidWrite(length);
+    written += length;
+  }
+
+  // Probing for the end of the body leaves an empty chunk.
+  int available = 0;
+  rope->GetWriteBuffer(&available);
+
+  ASSERT_EQ((int)expected.length(), rope->size());
+  ASSERT_EQ(3u, rope->chunk_count());
+  std::string gathered;
+  for (size_t i = 0; i < rope->chunk_count(); i++) {
+    int length = 0;
+    const char* chunk = rope->chunk_data(i, &length);
+    gathered.append(chunk, length);
+  }
+  EXPECT_EQ(expected, gathered);
+
+  std::string flattened(rope->Flatten(), rope->size());
+  EXPECT_EQ(expected, flattened);
+  EXPECT_EQ(1u, rope->chunk_count());
+}
+
+TEST(RopeBufferTest, ExternalBuffer) {
+  scoped_refptr<cnet::RopeBuffer> rope(new cnet::RopeBuffer(4));
+  char external[6];
+  rope->SetExternalBuffer(external, sizeof(external));
+  EXPECT_EQ(0, rope->NextChunkSize());
+
+  std::string expected("Hello, rope!");
+  size_t written = 0;
+  while (written < expected.length()) {
+    int available = 0;
+    net::IOBuffer* buffer = rope->GetWriteBuffer(&available);
+    ASSERT_GT(available, 0);
+    int length = std::min(available, (int)(expected.length() - written));
+    memcpy(buffer->data(), expected.data() + written, length);
+    rope->DidWrite(length);
+    written += length;
+  }
+
+  // The start of the body landed in the caller's memory, and the overflow
+  // in the rope's own chunks.
+  EXPECT_EQ(6, rope->external_size());
+  EXPECT_EQ(0, memcmp(external, expected.data(), sizeof(external)));
+  ASSERT_EQ(3u, rope->chunk_count());
+  int length = 0;
+  EXPECT_EQ(external, rope->chunk_data(0, &length));
+  EXPECT_EQ(6, length);
+
+  std::string flattened(rope->Flatten(), rope->size());
+  EXPECT_EQ(expected, flattened);
+  EXPECT_EQ(1u, rope->chunk_count());
+  EXPECT_EQ(0, rope->external_size());
+}
+
+TEST(RopeBufferTest, Detach) {
+  scoped_refptr<cnet::RopeBuffer> rope(new cnet::RopeBuffer(4));
+  int length = -1;
+  EXPECT_EQ(NULL, rope->Detach(&length));
+  EXPECT_EQ(0, length);
+
+  std::string expected("Hello!");
+  size_t written = 0;
+  while (written < expected.length()) {
+    int available = 0;
+    net::IOBuffer* buffer = rope->GetWriteBuffer(&available);
+    int chunk = std::min(available, (int)(expected.length() - written));
+    memcpy(buffer->data(), expected.data() + written, chunk);
+    rope->DidWrite(chunk);
+    written += chunk;
+  }
+
+  // The chunks are joined, and the caller then owns the memory.
+  char* body = rope->Detach(&length);
+  ASSERT_TRUE(body != NULL);
+  EXPECT_EQ(expected, std::string(body, length));
+  free(body);
+  EXPECT_EQ(0, rope->size());
+  EXPECT_EQ(0u, rope->chunk_count());
+}
+
+TEST(ReadBufferPoolTest, RecyclesWithinBudget) {
+  scoped_refptr<cnet::ReadBufferPool> buffers(
+      new cnet::ReadBufferPool(16, 16));
+
+  scoped_refptr<net::IOBufferWithSize> first = buffers->Acquire();
+  scoped_refptr<net::IOBufferWithSize> second = buffers->Acquire();
+  ASSERT_EQ(16, first->size());
+  net::IOBufferWithSize* first_raw = first.get();
+
+  // Only one buffer fits in the budget.
+  buffers->Recycle(first);
+  buffers->Recycle(second);
+  first = NULL;
+  second = NULL;
+
+  int64 hits, misses, idle_bytes;
+  buffers->GetStats(&hits, &misses, &idle_bytes);
+  EXPECT_EQ(0, hits);
+  EXPECT_EQ(2, misses);
+  EXPECT_EQ(16, idle_bytes);
+
+  scoped_refptr<net::IOBufferWithSize> reused = buffers->Acquire();
+  EXPECT_EQ(first_raw, reused.get());
+
+  // A buffer that is still referenced elsewhere isn't handed out again.
+  buffers->Recycle(reused);
+  scoped_refptr<net::IOBufferWithSize> fresh = buffers->Acquire();
+  EXPECT_NE(reused.get(), fresh.get());
+
+  buffers->GetStats(&hits, &misses, &idle_bytes);
+  EXPECT_EQ(1, hits);
+  EXPECT_EQ(3, misses);
+  EXPECT_EQ(0, idle_bytes);
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,266 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "yahoo/cnet/cnet_upload_stream.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/task_runner.h"
+#include "base/task_runner_util.h"
+#include "net/base/io_buffer.h"
+#include "net/base/net_errors.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// How much of the source to compress in each task.
+const int kCompressionInputSize = 32 * 1024;
+const int kCompressionOutputBlockSize = 8 * 1024;
+
+} // namespace
+
+namespace cnet {
+
+UploadCallbackStream::UploadCallbackStream(int64 length,
+    const ReadCallback& read)
+    : net::UploadDataStream(length < 0, 0), length_(length), read_(read),
+      bytes_read_(0), started_(false), weak_factory_(this) {
+}
+
+UploadCallbackStream::~UploadCallbackStream() {
+}
+
+int UploadCallbackStream::InitInternal() {
+  if (started_) {
+    // The callback already consumed part of the body.
+    return net::ERR_FAILED;
+  }
+  if (!is_chunked()) {
+    SetSize(length_);
+  }
+  return net::OK;
+}
+
+int UploadCallbackStream::ReadInternal(net::IOBuffer* buf, int buf_len) {
+  if (!is_chunked()) {
+    if (bytes_read_ >= length_) {
+      return 0;
+    }
+    if (buf_len > length_ - bytes_read_) {
+      buf_len = static_cast<int>(length_ - bytes_read_);
+    }
+  }
+
+  started_ = true;
+  read_.Run(make_scoped_refptr(buf), buf_len,
+      base::Bind(&UploadCallbackStream::OnReadDone,
+                 weak_factory_.GetWeakPtr()));
+  return net::ERR_IO_PENDING;
+}
+
+void UploadCallbackStream::ResetInternal() {
+  // Drop the result of a read in progress.
+  weak_factory_.InvalidateWeakPtrs();
+}
+
+void UploadCallbackStream::OnReadDone(int result) {
+  if (result == 0) {
+    if (is_chunked()) {
+      SetIsFinalChunk();
+    } else {
+      // The callback ended the body short of its declared length.
+      result = net::ERR_FAILED;
+    }
+  } else if (result > 0) {
+    bytes_read_ += result;
+  }
+  OnReadCompleted(result);
+}
+
+// The zlib state of one pass over the body.  It's only used on the task
+// runner, one block at a time, but it may be released on either thread.
+class UploadCompressionStream::Compressor
+    : public base::RefCountedThreadSafe<Compressor> {
+ public:
+  explicit Compressor(Format format)
+      : format_(format), initialized_(false) {
+    memset(&zstream_, 0, sizeof(zstream_));
+  }
+
+  // Append the compressed form of |length| bytes of |input| to |output|,
+  // followed by the end of the compressed stream if |finish| is set.
+  bool Compress(scoped_refptr<net::IOBuffer> input, int length, bool finish,
+      std::string* output) {
+    if (!initialized_) {
+      // A window of 16 more bits asks zlib for a gzip wrapper.
+      int window_bits = (format_ == FORMAT_GZIP) ? (MAX_WBITS + 16):MAX_WBITS;
+      if (deflateInit2(&zstream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+              window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+      }
+      initialized_ = true;
+    }
+
+    zstream_.next_in = reinterpret_cast<Bytef*>(input->data());
+    zstream_.avail_in = length;
+
+    char block[kCompressionOutputBlockSize];
+    int result = Z_OK;
+    do {
+      zstream_.next_out = reinterpret_cast<Bytef*>(block);
+      zstream_.avail_out = sizeof(block);
+      result = deflate(&zstream_, finish ? Z_FINISH:Z_NO_FLUSH);
+      if (result == Z_STREAM_ERROR) {
+        return false;
+      }
+      output->append(block, sizeof(block) - zstream_.avail_out);
+    } while (zstream_.avail_out == 0);
+
+    return !finish || (result == Z_STREAM_END);
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<Compressor>;
+
+  ~Compressor() {
+    if (initialized_) {
+      deflateEnd(&zstream_);
+    }
+  }
+
+  Format format_;
+  bool initialized_;
+  z_stream zstream_;
+
+  DISALLOW_COPY_AND_ASSIGN(Compressor);
+};
+
+UploadCompressionStream::UploadCompressionStream(
+    scoped_ptr<net::UploadDataStream> source, Format format,
+    scoped_refptr<base::TaskRunner> task_runner)
+    : net::UploadDataStream(true, 0), source_(source.Pass()), format_(format),
+      task_runner_(task_runner), output_offset_(0), compressed_all_(false),
+      pending_buf_len_(0), weak_factory_(this) {
+}
+
+UploadCompressionStream::~UploadCompressionStream() {
+}
+
+int UploadCompressionStream::InitInternal() {
+  // Start the compressed stream over, in case the body is being resent.
+  compressor_ = new Compressor(format_);
+  input_buffer_ = new net::IOBuffer(kCompressionInputSize);
+  output_.clear();
+  output_offset_ = 0;
+  compressed_all_ = false;
+
+  return source_->Init(
+      base::Bind(&UploadCompressionStream::OnSourceInitCompleted,
+                 weak_factory_.GetWeakPtr()));
+}
+
+void UploadCompressionStream::OnSourceInitCompleted(int result) {
+  OnInitCompleted(result);
+}
+
+int UploadCompressionStream::ReadInternal(net::IOBuffer* buf, int buf_len) {
+  if (compressed_all_ || (output_offset_ < output_.size())) {
+    return CopyOutput(buf, buf_len);
+  }
+
+  pending_buf_ = buf;
+  pending_buf_len_ = buf_len;
+  return ReadSource();
+}
+
+void UploadCompressionStream::ResetInternal() {
+  // Drop the results of a read or a compression in progress.
+  weak_factory_.InvalidateWeakPtrs();
+  pending_buf_ = NULL;
+}
+
+int UploadCompressionStream::ReadSource() {
+  int result = 0;
+  if (!source_->IsEOF()) {
+    result = source_->Read(input_buffer_.get(), kCompressionInputSize,
+        base::Bind(&UploadCompressionStream::OnSourceReadCompleted,
+                   weak_factory_.GetWeakPtr()));
+    if (result == net::ERR_IO_PENDING) {
+      return result;
+    }
+    if (result < 0) {
+      pending_buf_ = NULL;
+      return result;
+    }
+  }
+
+  Compress(result);
+  return net::ERR_IO_PENDING;
+}
+
+void UploadCompressionStream::OnSourceReadCompleted(int result) {
+  if (result < 0) {
+    pending_buf_ = NULL;
+    OnReadCompleted(result);
+    return;
+  }
+
+  Compress(result);
+}
+
+void UploadCompressionStream::Compress(int length) {
+  bool finish = source_->IsEOF();
+  std::string* output = new std::string();
+  base::PostTaskAndReplyWithResult(task_runner_.get(), FROM_HERE,
+      base::Bind(&Compressor::Compress, compressor_, input_buffer_, length,
+                 finish, output),
+      base::Bind(&UploadCompressionStream::OnCompressed,
+                 weak_factory_.GetWeakPtr(), finish, base::Owned(output)));
+}
+
+void UploadCompressionStream::OnCompressed(bool finish, std::string* output,
+    bool success) {
+  if (!success) {
+    pending_buf_ = NULL;
+    OnReadCompleted(net::ERR_FAILED);
+    return;
+  }
+
+  output_.swap(*output);
+  output_offset_ = 0;
+  compressed_all_ = finish;
+
+  if (output_.empty() && !compressed_all_) {
+    // zlib held onto the block to compress it along with the next one.
+    int result = ReadSource();
+    if (result != net::ERR_IO_PENDING) {
+      OnReadCompleted(result);
+    }
+    return;
+  }
+
+  scoped_refptr<net::IOBuffer> buf;
+  buf.swap(pending_buf_);
+  OnReadCompleted(CopyOutput(buf.get(), pending_buf_len_));
+}
+
+int UploadCompressionStream::CopyOutput(net::IOBuffer* buf, int buf_len) {
+  size_t bytes = std::min(static_cast<size_t>(buf_len),
+      output_.size() - output_offset_);
+  memcpy(buf->data(), output_.data() + output_offset_, bytes);
+  output_offset_ += bytes;
+
+  if (output_offset_ == output_.size()) {
+    output_.clear();
+    output_offset_ = 0;
+    if (compressed_all_) {
+      SetIsFinalChunk();
+    }
+  }
+  return static_cast<int>(bytes);
+}
+
+} // namespace cnet
@@ -0,0 +1,122 @@
+// Copyright 2014, Yahoo! Inc.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef YAHOO_CNET_CNET_UPLOAD_STREAM_H_
+#define YAHOO_CNET_CNET_UPLOAD_STREAM_H_
+
+#include <string>
+
+#include "base/callback.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/memory/weak_ptr.h"
+#include "net/base/upload_data_stream.h"
+
+namespace base {
+class TaskRunner;
+}
+
+namespace net {
+class IOBuffer;
+}
+
+namespace cnet {
+
+// An upload body that is pulled from a callback as the request sends it,
+// rather than materialized in memory or in a file.  If the length is
+// unknown (negative), then the body is sent with chunked transfer encoding,
+// and ends when the callback supplies 0 bytes.
+//
+// The stream lives on the network thread.  It asks for each read with
+// |read|, which must eventually run its done callback on the network
+// thread, with the number of bytes written into the buffer, 0 at the end of
+// the body, or a negative net error.  The body can't be rewound, so a
+// request that must resend it (e.g., after a 307 redirect) fails.
+class UploadCallbackStream : public net::UploadDataStream {
+ public:
+  typedef base::Callback<void(int result)> ReadDoneCallback;
+  typedef base::Callback<void(scoped_refptr<net::IOBuffer> buffer,
+      int length, const ReadDoneCallback& done)> ReadCallback;
+
+  UploadCallbackStream(int64 length, const ReadCallback& read);
+  virtual ~UploadCallbackStream();
+
+ private:
+  // Overrides for net::UploadDataStream.
+  virtual int InitInternal() override;
+  virtual int ReadInternal(net::IOBuffer* buf, int buf_len) override;
+  virtual void ResetInternal() override;
+
+  void OnReadDone(int result);
+
+  int64 length_;
+  ReadCallback read_;
+  int64 bytes_read_;
+  bool started_;
+
+  base::WeakPtrFactory<UploadCallbackStream> weak_factory_;
+
+  DISALLOW_COPY_AND_ASSIGN(UploadCallbackStream);
+};
+
+// Compresses another upload body as the request sends it.  The compressed
+// length isn't known ahead of time, so the body is sent with chunked
+// transfer encoding; the caller sets the Content-Encoding header.
+//
+// The stream lives on the network thread, and reads its source there.  The
+// compression itself runs on |task_runner|, one block at a time.  The
+// stream can be rewound if its source can.
+class UploadCompressionStream : public net::UploadDataStream {
+ public:
+  enum Format {
+    FORMAT_GZIP = 0,
+
+    // The zlib format, which HTTP calls "deflate".
+    FORMAT_DEFLATE,
+  };
+
+  UploadCompressionStream(scoped_ptr<net::UploadDataStream> source,
+      Format format, scoped_refptr<base::TaskRunner> task_runner);
+  virtual ~UploadCompressionStream();
+
+ private:
+  class Compressor;
+
+  // Overrides for net::UploadDataStream.
+  virtual int InitInternal() override;
+  virtual int ReadInternal(net::IOBuffer* buf, int buf_len) override;
+  virtual void ResetInternal() override;
+
+  void OnSourceInitCompleted(int result);
+  int ReadSource();
+  void OnSourceReadCompleted(int result);
+  void Compress(int length);
+  void OnCompressed(bool finish, std::string* output, bool success);
+  int CopyOutput(net::IOBuffer* buf, int buf_len);
+
+  scoped_ptr<net::UploadDataStream> source_;
+  Format format_;
+  scoped_refptr<base::TaskRunner> task_runner_;
+
+  // Replaced whenever the stream is rewound, since a block from before may
+  // still be compressing.
+  scoped_refptr<Compressor> compressor_;
+  scoped_refptr<net::IOBuffer> input_buffer_;
+
+  // Compressed bytes not yet read from the stream.
+  std::string output_;
+  size_t output_offset_;
+  bool compressed_all_;
+
+  // The read waiting on the source or the compressor.
+  scoped_refptr<net::IOBuffer> pending_buf_;
+  int pending_buf_len_;
+
+  base::WeakPtrFactory<UploadCompressionStream> weak_factory_;
+
+  DISALLOW_COPY_AND_ASSIGN(UploadCompressionStream);
+};
+
+} // namespace cnet
+
+#endif  // YAHOO_CNET_CNET_UPLOAD_STREAM_H_
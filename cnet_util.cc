@@ -167,6 +167,7 @@ int main(int argc, char* argv[]) {
       "upload-type"));
   std::string upload_key(command_line.GetSwitchValueASCII("upload-key"));
   std::string output_path(command_line.GetSwitchValueASCII("output-path"));
+  bool resume(command_line.HasSwitch("resume"));
   std::string min_speed(command_line.GetSwitchValueASCII("min-speed"));
   std::string quic_host(command_line.GetSwitchValueASCII("quic-host"));
   std::string quic_port_str(command_line.GetSwitchValueASCII("quic-port"));
@@ -232,6 +233,7 @@ int main(int argc, char* argv[]) {
     }
     if (!output_path.empty()) {
       CnetFetcherSetOutputFile(fetcher, output_path.c_str());
+      CnetFetcherSetResumable(fetcher, resume);
     }
     if (!oauth_app_key.empty()) {
       CnetFetcherSetOauthCredentials(fetcher,